@@ -40,6 +40,11 @@ void setup()
     // 允许 SDK 的日志输出
     client.enableDebuggingMessages();
 
+    // 将设备证书缓存到 LittleFS，重启后直接使用缓存的证书连接，无需再次请求
+    client.enableAccessTokenCache();
+    // 将服务器 IP 缓存到 LittleFS，重启后无需等待 DNS 解析即可连接
+    client.enableDnsCacheFile();
+
     // 连接 WiFi AP
     client.setWifiCredentials(ssid, password);
 }
@@ -63,10 +68,8 @@ void pubSensors()
     obj["humidity"] = 62.5;
     obj["co2"] = 2321;
     obj["light"] = 653;
-    char attributes[512];
-    serializeJson(obj, attributes);
     // 调用属性上报方法
-    client.reportAttributes(attributes);
+    client.reportAttributes(obj);
 }
 
 void loop()
@@ -91,10 +91,8 @@ void pubSensors()
     obj["humidity"] = 62.5;
     obj["co2"] = 2321;
     obj["light"] = 653;
-    char attributes[512];
-    serializeJson(obj, attributes);
     // 调用属性上报方法
-    client.reportAttributes(attributes);
+    client.reportAttributes(obj);
 }
 
 void checkResetButton()
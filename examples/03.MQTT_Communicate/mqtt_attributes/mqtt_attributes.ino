@@ -55,31 +55,20 @@ void onMQTTConnect()
     client.onAttributesGetResponse([](const String &topic, const String &payload)
                                    { Serial.println("attributes get response: " + topic + ", payload: " + payload); });
 
-    // 订阅云平台下发属性的消息
-    client.onAttributesPush([](const String &payload)
-                            {
-                                Serial.println("attributes push: " + payload);
-                                DynamicJsonDocument doc(512);
-                                DeserializationError error = deserializeJson(doc, payload);
-                                if (error)
-                                {
-                                    Serial.printf("deserialize error: %s\n", error.f_str());
-                                    return;
-                                }
-                                JsonObject obj = doc.as<JsonObject>();
-                                if (obj.containsKey("relay1"))
-                                {
-                                    if (obj["relay1"] == true)
-                                    {
-                                        Serial.println("relay1 ON");
-                                        // todo 输出 GPIO 控制继电器
-                                    }
-                                    else
-                                    {
-                                        Serial.println("relay1 OFF");
-                                        // todo 输出 GPIO 控制继电器
-                                    }
-                                } });
+    // 按属性标识符订阅云平台下发的属性，属性获取的回复中包含该属性时也会调用
+    // SDK 只解析已订阅的属性值，其它属性直接跳过
+    client.onAttribute("relay1", [](const JsonVariant &value)
+                       {
+                           if (value == true)
+                           {
+                               Serial.println("relay1 ON");
+                               // todo 输出 GPIO 控制继电器
+                           }
+                           else
+                           {
+                               Serial.println("relay1 OFF");
+                               // todo 输出 GPIO 控制继电器
+                           } });
 
     // 读取设备在云平台上的属性
     client.getAttributes();
@@ -92,15 +81,13 @@ void onMQTTConnect()
 void pubSensors()
 {
     // 这个示例模拟传感器数值，仅用于演示如何生成 JSON。实际项目中可读取传感器真实数据。
-    DynamicJsonDocument obj(512);
-    obj["temperature"] = 31.2;
-    obj["humidity"] = 62.5;
-    obj["co2"] = 2321;
-    obj["light"] = 653;
-    char attributes[512];
-    serializeJson(obj, attributes);
-    // 调用属性上报方法
-    client.reportAttributes(attributes);
+    // 属性 JSON 直接写入 SDK 的固定缓冲区，不占用堆内存，然后调用 send() 上报。
+    client.beginAttributes()
+        .add("temperature", 31.2)
+        .add("humidity", 62.5)
+        .add("co2", 2321)
+        .add("light", 653)
+        .send();
 }
 
 void loop()
@@ -61,7 +61,9 @@ void pubEvent()
     obj["params"] = params;
     char event[512];
     serializeJson(obj, event);
-    client.reportEvent(1000, event);
+    // 以 QoS 1 上报事件，云平台确认收到后执行回调，未确认时 SDK 会自动重发
+    client.reportEvent(1000, event, [](uint16_t packetId, bool delivered)
+                       { Serial.printf("event #%u %s\n", packetId, delivered ? "delivered" : "lost"); });
 }
 
 void loop()
@@ -82,12 +82,10 @@ void onMQTTConnect() {
     live_resp_timer = millis();
   });
 
-  // 订阅命令消息
-  client.onCommandSend([](const String &topic, const JsonObject &obj) {
+  // 按命令标识符订阅 otaUpgrade 命令，SDK 只解析匹配命令的 params
+  client.onCommand("otaUpgrade", [](const String &topic, const JsonObject &params) {
     Serial.println("recv command: " + topic);
-    if (obj["method"] == "otaUpgrade") {
-      handleOTA(obj["params"]);
-    }
+    handleOTA(params);
   });
 
   // 延迟 1 秒上报首次传感器数据
@@ -104,20 +102,16 @@ void pubStartInfo() {
   obj["wifi_ssid"] = wm.getWiFiSSID();
   obj["ip"] = WiFi.localIP().toString();
   obj["start_ts"] = getTime();
-  char attributes[512];
-  serializeJson(obj, attributes);
   // 调用属性上报方法
-  client.reportAttributes(attributes);
+  client.reportAttributes(obj);
 }
 
 void pubLiveInfo() {
   // 上报活跃信息
   DynamicJsonDocument obj(512);
   obj["live_ts"] = getTime();
-  char attributes[512];
-  serializeJson(obj, attributes);
   // 调用属性上报方法
-  client.reportAttributes(attributes);
+  client.reportAttributes(obj);
 }
 
 // OTA
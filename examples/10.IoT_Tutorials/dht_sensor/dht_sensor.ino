@@ -21,10 +21,10 @@ ThingsCloudMQTT client(
   THINGSCLOUD_DEVICE_ACCESS_TOKEN,
   THINGSCLOUD_PROJECT_KEY);
 
-// 上报数据的间隔时间计时器
+// 读取传感器的间隔时间计时器
 unsigned long timer1 = millis();
-// 设置定时上报数据的时间间隔，单位是 ms。免费版项目请务必大于30秒，否则设备可能会被限连。
-const int report_interval = 1000 * 60 * 5;
+// 设置读取传感器的时间间隔，单位是 ms。只有数据变化超过死区时才会上报。
+const int sample_interval = 1000 * 5;
 
 // 设置DHT11的数据引脚
 #define DHTPIN 4
@@ -45,6 +45,11 @@ void setup()
   // 连接 WiFi AP
   client.setWifiCredentials(ssid, password);
 
+  // 温度变化超过 0.5 度、湿度变化超过 5% 时才上报，两次上报至少间隔 60 秒。
+  // 免费版项目请务必大于30秒，否则设备可能会被限连。数据不变时每 30 分钟上报一次。
+  client.setAttributeReporting("temperature", 0.5, DEADBAND_ABSOLUTE, 1000 * 60, 1000 * 60 * 30);
+  client.setAttributeReporting("humidity", 5, DEADBAND_PERCENT, 1000 * 60, 1000 * 60 * 30);
+
   dht.begin();
 }
 
@@ -67,14 +72,9 @@ void pubSensors()
   Serial.print(t);
   Serial.println();
 
-  // 生成属性 JSON
-  DynamicJsonDocument obj(512);
-  obj["temperature"] = t;
-  obj["humidity"] = h;
-  char attributes[512];
-  serializeJson(obj, attributes);
-  // 调用属性上报方法
-  client.reportAttributes(attributes);
+  // 更新属性值，由 SDK 决定是否需要上报
+  client.updateAttribute("temperature", t);
+  client.updateAttribute("humidity", h);
 }
 
 // 必须实现这个回调函数，当 MQTT 连接成功后执行该函数。
@@ -91,8 +91,8 @@ void loop()
 {
   client.loop();
 
-  // 按间隔时间上报传感器数据
-  if (millis() - timer1 > report_interval)
+  // 按间隔时间读取传感器数据
+  if (millis() - timer1 > sample_interval)
   {
     timer1 = millis();
     pubSensors();
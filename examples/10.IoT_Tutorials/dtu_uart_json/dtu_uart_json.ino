@@ -138,20 +138,16 @@ void pubStartInfo() {
   obj["wifi_ssid"] = wm.getWiFiSSID();
   obj["ip"] = WiFi.localIP().toString();
   obj["start_ts"] = getTime();
-  char attributes[512];
-  serializeJson(obj, attributes);
   // 调用属性上报方法
-  client.reportAttributes(attributes);
+  client.reportAttributes(obj);
 }
 
 void pubLiveInfo() {
   // 上报活跃信息
   DynamicJsonDocument obj(512);
   obj["live_ts"] = getTime();
-  char attributes[512];
-  serializeJson(obj, attributes);
   // 调用属性上报方法
-  client.reportAttributes(attributes);
+  client.reportAttributes(obj);
 }
 
 void checkResetButton() {
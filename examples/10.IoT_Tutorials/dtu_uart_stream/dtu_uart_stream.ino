@@ -119,9 +119,9 @@ void onMQTTConnect() {
   });
 
   // 订阅云平台下发的自定义数据流
-  client.subscribe("data/stream/set", [](const String &topic, const String &payload) {
-    Serial.println("data set topic: " + topic + ", payload: " + payload);
-    SerialPort.write(payload.c_str(), payload.length());
+  // 使用零拷贝回调，直接将 MQTT 接收缓冲区中的数据转发到串口
+  client.subscribe("data/stream/set", [](const char *topic, const uint8_t *payload, size_t length) {
+    SerialPort.write(payload, length);
   });
 
   // 延迟 1 秒上报首次传感器数据
@@ -138,20 +138,16 @@ void pubStartInfo() {
   obj["wifi_ssid"] = wm.getWiFiSSID();
   obj["ip"] = WiFi.localIP().toString();
   obj["start_ts"] = getTime();
-  char attributes[512];
-  serializeJson(obj, attributes);
   // 调用属性上报方法
-  client.reportAttributes(attributes);
+  client.reportAttributes(obj);
 }
 
 void pubLiveInfo() {
   // 上报活跃信息
   DynamicJsonDocument obj(512);
   obj["live_ts"] = getTime();
-  char attributes[512];
-  serializeJson(obj, attributes);
   // 调用属性上报方法
-  client.reportAttributes(attributes);
+  client.reportAttributes(obj);
 }
 
 void checkResetButton() {
@@ -205,6 +201,8 @@ void loop() {
       Serial.println("SerialPort.read " + bufferStr);
       // report to cloud
       client.publish("data/stream", bufferStr);
+      // 重复内容较多的数据可以压缩后上报，接收端需要按 ThingsCloudLZSS 格式解压
+      // client.publishCompressed("data/stream", (const uint8_t *)buffer, size);
     }
   }
 }
@@ -73,29 +73,25 @@ void handleAttributes(const JsonObject &obj) {
 }
 
 /**
- * @brief 处理云平台下发的命令
+ * @brief 处理云平台下发的 switch_relay 命令
  *
- * 该函数会检查命令中的方法是否为 "switch_relay"，若满足条件则获取继电器状态并控制继电器，
- * 若存在 "delay_reverse" 字段，会在指定秒数后反转继电器状态。
+ * 获取继电器状态并控制继电器，若存在 "delay_reverse" 字段，会在指定秒数后反转继电器状态。
  *
- * @param command 包含命令信息的 Json 对象
+ * @param params 命令参数的 Json 对象
  */
-void handleCommand(const JsonObject &command) {
-  if (command.containsKey("method") && command["method"] == "switch_relay") {
-    JsonObject params = command["params"];
-    bool state = params["state"];
-    controlRelay(state);
-
-    if (params.containsKey("delay_reverse") && params["delay_reverse"].is<int>() && params["delay_reverse"] > 0) {
-      int delaySeconds = params["delay_reverse"];
-      // 将秒转换为毫秒
-      int delayMillis = delaySeconds * 1000;
-      // 记录延迟任务信息
-      delayTask.startTime = millis();
-      delayTask.delayDuration = delayMillis;
-      delayTask.curState = state;
-      delayTask.active = true;
-    }
+void handleSwitchRelay(const JsonObject &params) {
+  bool state = params["state"];
+  controlRelay(state);
+
+  if (params.containsKey("delay_reverse") && params["delay_reverse"].is<int>() && params["delay_reverse"] > 0) {
+    int delaySeconds = params["delay_reverse"];
+    // 将秒转换为毫秒
+    int delayMillis = delaySeconds * 1000;
+    // 记录延迟任务信息
+    delayTask.startTime = millis();
+    delayTask.delayDuration = delayMillis;
+    delayTask.curState = state;
+    delayTask.active = true;
   }
 }
 
@@ -114,10 +110,10 @@ void onMQTTConnect() {
     handleAttributes(obj);
   });
 
-  // 订阅云平台下发命令的消息
-  client.onCommandSend([](const String &topic, const JsonObject &obj) {
+  // 按命令标识符订阅云平台下发的命令，SDK 只解析匹配命令的 params
+  client.onCommand("switch_relay", [](const String &topic, const JsonObject &params) {
     Serial.println("recv command: " + topic);
-    handleCommand(obj);
+    handleSwitchRelay(params);
   });
 
   // 读取设备在云平台上的属性，用于初始化继电器状态。
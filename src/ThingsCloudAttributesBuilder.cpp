@@ -0,0 +1,279 @@
+/*
+  ThingsCloudAttributesBuilder.cpp - Fixed buffer JSON writer for the ThingsCloud attributes and data reports.
+  https://www.thingscloud.xyz
+*/
+
+#include "ThingsCloudAttributesBuilder.h"
+
+void ThingsCloudAttributesBuilder::begin(ThingsCloudMQTT *client, char *buffer, const size_t size, const char *topic)
+{
+    _client = client;
+    _length = 0;
+    _overflowed = false;
+    _closed = false;
+
+    size_t topicSize = strlen(topic) + 1;
+    if (topicSize > size)
+    {
+        _topic = "";
+        _buffer = nullptr;
+        _size = 0;
+        _overflowed = true;
+        return;
+    }
+    memcpy(buffer, topic, topicSize);
+    _topic = buffer;
+    _buffer = buffer + topicSize;
+    _size = size - topicSize;
+    writeChar('{');
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const char *value)
+{
+    if (beginMember(key))
+        writeString(value);
+    return *this;
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const String &value)
+{
+    return add(key, value.c_str());
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const bool value)
+{
+    if (beginMember(key))
+    {
+        if (value)
+            writeRaw("true", 4);
+        else
+            writeRaw("false", 5);
+    }
+    return *this;
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const int value)
+{
+    if (beginMember(key))
+        writeSigned(value);
+    return *this;
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const long value)
+{
+    if (beginMember(key))
+        writeSigned(value);
+    return *this;
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const unsigned int value)
+{
+    if (beginMember(key))
+        writeUnsigned(value);
+    return *this;
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const unsigned long value)
+{
+    if (beginMember(key))
+        writeUnsigned(value);
+    return *this;
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const long long value)
+{
+    if (beginMember(key))
+        writeSigned(value);
+    return *this;
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const unsigned long long value)
+{
+    if (beginMember(key))
+        writeUnsigned(value);
+    return *this;
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const float value, const uint8_t decimals)
+{
+    if (beginMember(key))
+        writeDouble(value, decimals);
+    return *this;
+}
+
+ThingsCloudAttributesBuilder &ThingsCloudAttributesBuilder::add(const char *key, const double value, const uint8_t decimals)
+{
+    if (beginMember(key))
+        writeDouble(value, decimals);
+    return *this;
+}
+
+const char *ThingsCloudAttributesBuilder::c_str()
+{
+    close();
+    return _overflowed || _buffer == nullptr ? "" : _buffer;
+}
+
+bool ThingsCloudAttributesBuilder::beginMember(const char *key)
+{
+    // Members added after send() or c_str() are dropped
+    if (_closed)
+        _overflowed = true;
+    if (_overflowed)
+        return false;
+
+    if (_length > 1)
+        writeChar(',');
+    writeString(key);
+    writeChar(':');
+    return !_overflowed;
+}
+
+void ThingsCloudAttributesBuilder::close()
+{
+    if (_closed || _buffer == nullptr)
+        return;
+
+    writeChar('}');
+    if (!_overflowed)
+        _buffer[_length] = '\0';
+    _closed = true;
+}
+
+// One byte is always kept for the terminating null character
+void ThingsCloudAttributesBuilder::writeChar(const char c)
+{
+    if (_overflowed || _length + 1 >= _size)
+    {
+        _overflowed = true;
+        return;
+    }
+    _buffer[_length++] = c;
+}
+
+void ThingsCloudAttributesBuilder::writeRaw(const char *str, const size_t length)
+{
+    if (_overflowed || _length + length >= _size)
+    {
+        _overflowed = true;
+        return;
+    }
+    memcpy(_buffer + _length, str, length);
+    _length += length;
+}
+
+void ThingsCloudAttributesBuilder::writeString(const char *str)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    writeChar('"');
+    for (const char *p = str; *p != '\0' && !_overflowed; p++)
+    {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\')
+        {
+            writeChar('\\');
+            writeChar(c);
+        }
+        else if (c == '\n')
+            writeRaw("\\n", 2);
+        else if (c == '\r')
+            writeRaw("\\r", 2);
+        else if (c == '\t')
+            writeRaw("\\t", 2);
+        else if (c < 0x20)
+        {
+            char escaped[6] = {'\\', 'u', '0', '0', hexDigits[c >> 4], hexDigits[c & 0x0F]};
+            writeRaw(escaped, sizeof(escaped));
+        }
+        else
+            writeChar(c);
+    }
+    writeChar('"');
+}
+
+void ThingsCloudAttributesBuilder::writeUnsigned(unsigned long long value)
+{
+    char digits[20];
+    size_t count = 0;
+    do
+    {
+        digits[sizeof(digits) - 1 - count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    writeRaw(digits + sizeof(digits) - count, count);
+}
+
+void ThingsCloudAttributesBuilder::writeSigned(long long value)
+{
+    if (value < 0)
+    {
+        writeChar('-');
+        writeUnsigned(0ULL - (unsigned long long)value);
+    }
+    else
+        writeUnsigned(value);
+}
+
+// Fixed notation rounded to the given decimals, trailing zeros removed. NaN and infinity are written as null.
+void ThingsCloudAttributesBuilder::writeDouble(double value, uint8_t decimals)
+{
+    if (isnan(value) || isinf(value))
+    {
+        writeRaw("null", 4);
+        return;
+    }
+
+    if (decimals > 9)
+        decimals = 9;
+    unsigned long long scale = 1;
+    for (uint8_t i = 0; i < decimals; i++)
+        scale *= 10;
+
+    bool negative = value < 0;
+    if (negative)
+        value = -value;
+
+    // Too large for a 64 bits fixed point: mantissa and exponent
+    if (value * scale >= 1e18)
+    {
+        int exponent = (int)floor(log10(value));
+        if (negative)
+            writeChar('-');
+        writeDouble(value / pow(10, exponent), decimals);
+        writeChar('e');
+        writeSigned(exponent);
+        return;
+    }
+
+    unsigned long long scaled = (unsigned long long)(value * scale + 0.5);
+    if (scaled == 0)
+    {
+        writeChar('0');
+        return;
+    }
+
+    if (negative)
+        writeChar('-');
+    writeUnsigned(scaled / scale);
+
+    unsigned long long fraction = scaled % scale;
+    if (fraction == 0)
+        return;
+
+    uint8_t count = decimals;
+    while (fraction % 10 == 0)
+    {
+        fraction /= 10;
+        count--;
+    }
+
+    char digits[9];
+    for (int i = count - 1; i >= 0; i--)
+    {
+        digits[i] = '0' + fraction % 10;
+        fraction /= 10;
+    }
+    writeChar('.');
+    writeRaw(digits, count);
+}
@@ -0,0 +1,61 @@
+/*
+  ThingsCloudAttributesBuilder.h - Fixed buffer JSON writer for the ThingsCloud attributes and data reports.
+  https://www.thingscloud.xyz
+*/
+
+#ifndef ThingsCloud_AttributesBuilder_H
+#define ThingsCloud_AttributesBuilder_H
+
+#include <Arduino.h>
+
+class ThingsCloudMQTT;
+
+// Writes a flat JSON object straight into a fixed buffer, without any heap allocation:
+//   client.beginAttributes().add("temperature", 31.2).add("humidity", 62).send();
+//   client.beginData("data/env").add("temperature", 31.2).send();
+// When the buffer is too small the payload is marked as overflowed and send() fails.
+// The topic is copied at the start of the buffer, so a temporary String can be given. It takes its length + 1 bytes.
+class ThingsCloudAttributesBuilder
+{
+private:
+    ThingsCloudMQTT *_client = nullptr;
+    const char *_topic = ""; // Copy at the start of the buffer given to begin()
+    char *_buffer = nullptr; // Payload, after the topic
+    size_t _size = 0;
+    size_t _length = 0;
+    bool _overflowed = false;
+    bool _closed = false;
+
+public:
+    void begin(ThingsCloudMQTT *client, char *buffer, const size_t size, const char *topic);
+
+    ThingsCloudAttributesBuilder &add(const char *key, const char *value);
+    ThingsCloudAttributesBuilder &add(const char *key, const String &value);
+    ThingsCloudAttributesBuilder &add(const char *key, const bool value);
+    ThingsCloudAttributesBuilder &add(const char *key, const int value);
+    ThingsCloudAttributesBuilder &add(const char *key, const long value);
+    ThingsCloudAttributesBuilder &add(const char *key, const unsigned int value);
+    ThingsCloudAttributesBuilder &add(const char *key, const unsigned long value);
+    ThingsCloudAttributesBuilder &add(const char *key, const long long value);
+    ThingsCloudAttributesBuilder &add(const char *key, const unsigned long long value);
+    ThingsCloudAttributesBuilder &add(const char *key, const float value, const uint8_t decimals = 3);
+    ThingsCloudAttributesBuilder &add(const char *key, const double value, const uint8_t decimals = 6);
+
+    bool send(); // Publish the report, false if the buffer overflowed or the publish failed. Defined with ThingsCloudMQTT.
+
+    const char *c_str(); // Closed JSON object
+    inline size_t length() const { return _length; };
+    inline bool overflowed() const { return _overflowed; };
+
+private:
+    bool beginMember(const char *key);
+    void close();
+    void writeChar(const char c);
+    void writeRaw(const char *str, const size_t length);
+    void writeString(const char *str);
+    void writeUnsigned(unsigned long long value);
+    void writeSigned(long long value);
+    void writeDouble(double value, uint8_t decimals);
+};
+
+#endif
@@ -0,0 +1,250 @@
+/*
+  ThingsCloudClient.cpp - Network client wrapper used by the ThingsCloud MQTT client.
+  https://www.thingscloud.xyz
+*/
+
+#include "ThingsCloudClient.h"
+#ifdef ESP32
+#include <lwip/sockets.h>
+#include <errno.h>
+#endif
+
+#define MQTT_PACKET_CONNECT 1
+#define MQTT_PACKET_PUBACK 4
+
+bool ThingsCloudClient::popPubAck(uint16_t &packetId)
+{
+    if (_pubAcks.empty())
+        return false;
+
+    packetId = _pubAcks.front();
+    _pubAcks.erase(_pubAcks.begin());
+    return true;
+}
+
+bool ThingsCloudClient::beginConnect(IPAddress ip, uint16_t port, const uint32_t timeout)
+{
+    abortConnect();
+    _client.stop();
+    resetFrame();
+    _skipConnectPacket = false;
+
+#ifdef ESP32
+    _connectSocket = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (_connectSocket < 0)
+    {
+        _connectStatus = CLIENT_STEP_FAILED;
+        return false;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = (uint32_t)ip;
+    address.sin_port = htons(port);
+
+    lwip_fcntl(_connectSocket, F_SETFL, lwip_fcntl(_connectSocket, F_GETFL, 0) | O_NONBLOCK);
+    if (lwip_connect(_connectSocket, (struct sockaddr *)&address, sizeof(address)) < 0 && errno != EINPROGRESS)
+    {
+        abortConnect();
+        return false;
+    }
+    _connectStatus = CLIENT_STEP_PENDING;
+#else
+    _client.setTimeout(timeout);
+    _connectStatus = _client.connect(ip, port) == 1 ? CLIENT_STEP_DONE : CLIENT_STEP_FAILED;
+#endif
+
+    return _connectStatus != CLIENT_STEP_FAILED;
+}
+
+// The caller gives up on its own timeout, with abortConnect()
+ClientStepStatus ThingsCloudClient::pollConnect()
+{
+#ifdef ESP32
+    if (_connectStatus != CLIENT_STEP_PENDING)
+        return _connectStatus;
+
+    fd_set writeSet;
+    FD_ZERO(&writeSet);
+    FD_SET(_connectSocket, &writeSet);
+    struct timeval timeout = {0, 0};
+    int ready = lwip_select(_connectSocket + 1, nullptr, &writeSet, nullptr, &timeout);
+    if (ready == 0)
+        return CLIENT_STEP_PENDING;
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (ready < 0 || lwip_getsockopt(_connectSocket, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0)
+    {
+        abortConnect();
+        return CLIENT_STEP_FAILED;
+    }
+
+    // Blocking again like the sockets opened by WiFiClient, which takes it over
+    int enable = 1;
+    lwip_fcntl(_connectSocket, F_SETFL, lwip_fcntl(_connectSocket, F_GETFL, 0) & ~O_NONBLOCK);
+    lwip_setsockopt(_connectSocket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    _client = WiFiClient(_connectSocket);
+    _connectSocket = -1;
+    _connectStatus = CLIENT_STEP_DONE;
+#endif
+
+    return _connectStatus;
+}
+
+void ThingsCloudClient::abortConnect()
+{
+#ifdef ESP32
+    if (_connectSocket >= 0)
+    {
+        lwip_close(_connectSocket);
+        _connectSocket = -1;
+    }
+#endif
+    _connectStatus = CLIENT_STEP_FAILED;
+}
+
+int ThingsCloudClient::connect(IPAddress ip, uint16_t port)
+{
+    resetFrame();
+    return _client.connect(ip, port);
+}
+
+int ThingsCloudClient::connect(const char *host, uint16_t port)
+{
+    resetFrame();
+    return _client.connect(host, port);
+}
+
+#ifdef ESP32
+int ThingsCloudClient::connect(IPAddress ip, uint16_t port, int32_t timeout)
+{
+    resetFrame();
+    return _client.connect(ip, port, timeout);
+}
+
+int ThingsCloudClient::connect(const char *host, uint16_t port, int32_t timeout)
+{
+    resetFrame();
+    return _client.connect(host, port, timeout);
+}
+#endif
+
+size_t ThingsCloudClient::write(uint8_t b)
+{
+    return _client.write(b);
+}
+
+size_t ThingsCloudClient::write(const uint8_t *buffer, size_t size)
+{
+    // PubSubClient writes its CONNECT packet in one call, reported as sent
+    if (_skipConnectPacket && size > 0 && (buffer[0] >> 4) == MQTT_PACKET_CONNECT)
+    {
+        _skipConnectPacket = false;
+        return size;
+    }
+    return _client.write(buffer, size);
+}
+
+int ThingsCloudClient::available()
+{
+    return _client.available();
+}
+
+int ThingsCloudClient::read()
+{
+    int b = _client.read();
+    if (b >= 0 && _mqttFraming)
+        frameByte(b);
+    return b;
+}
+
+int ThingsCloudClient::read(uint8_t *buffer, size_t size)
+{
+    int count = _client.read(buffer, size);
+    for (int i = 0; _mqttFraming && i < count; i++)
+        frameByte(buffer[i]);
+    return count;
+}
+
+int ThingsCloudClient::peek()
+{
+    return _client.peek();
+}
+
+void ThingsCloudClient::flush()
+{
+    _client.flush();
+}
+
+void ThingsCloudClient::stop()
+{
+    abortConnect();
+    _skipConnectPacket = false;
+    _client.stop();
+    resetFrame();
+}
+
+uint8_t ThingsCloudClient::connected()
+{
+    return _client.connected();
+}
+
+ThingsCloudClient::operator bool()
+{
+    return _client;
+}
+
+// ================== Private functions ====================-
+
+void ThingsCloudClient::resetFrame()
+{
+    _frameState = FRAME_TYPE;
+    _pubAcks.clear();
+}
+
+// Fixed header (type, remaining length), then the body. The packet id starts the body of a PUBACK.
+void ThingsCloudClient::frameByte(const uint8_t b)
+{
+    switch (_frameState)
+    {
+    case FRAME_TYPE:
+        _frameType = b >> 4;
+        _frameLength = 0;
+        _frameLengthShift = 0;
+        _frameState = FRAME_LENGTH;
+        break;
+
+    case FRAME_LENGTH:
+        _frameLength |= (uint32_t)(b & 0x7F) << _frameLengthShift;
+        _frameLengthShift += 7;
+        if (b & 0x80)
+        {
+            // At most 4 length bytes, the stream can not be followed anymore
+            if (_frameLengthShift > 21)
+                _frameState = FRAME_TYPE;
+            break;
+        }
+        _frameRead = 0;
+        _framePacketId = 0;
+        _frameState = FRAME_BODY;
+        if (_frameLength == 0)
+            frameEnd();
+        break;
+
+    case FRAME_BODY:
+        if (_frameRead < 2)
+            _framePacketId = (_framePacketId << 8) | b;
+        if (++_frameRead == _frameLength)
+            frameEnd();
+        break;
+    }
+}
+
+void ThingsCloudClient::frameEnd()
+{
+    if (_frameType == MQTT_PACKET_PUBACK && _frameLength >= 2)
+        _pubAcks.push_back(_framePacketId);
+    _frameState = FRAME_TYPE;
+}
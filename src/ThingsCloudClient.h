@@ -0,0 +1,96 @@
+/*
+  ThingsCloudClient.h - Network client wrapper used by the ThingsCloud MQTT client.
+  https://www.thingscloud.xyz
+*/
+
+#ifndef ThingsCloud_Client_H
+#define ThingsCloud_Client_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <vector>
+
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#include <WiFiClient.h>
+#endif
+
+// Progress of a connection step, see beginConnect() and ThingsCloudDNSCache::resolve()
+typedef enum
+{
+    CLIENT_STEP_PENDING = 0,
+    CLIENT_STEP_DONE = 1,
+    CLIENT_STEP_FAILED = 2
+} ClientStepStatus;
+
+// Pass-through client given to PubSubClient. It follows the MQTT framing of the received bytes
+// to collect the PUBACK packets, that PubSubClient reads and ignores. They are collected rather than reported
+// right away, as they are seen while PubSubClient fills its buffer.
+// It also opens the connection step by step, so that loop() never waits for the TCP handshake:
+// the CONNECT packet is sent by the ThingsCloud client, and the one PubSubClient writes afterwards is skipped.
+// Without mqttFraming, only the connection steps are used: the received bytes are not MQTT packets, like an http response.
+class ThingsCloudClient : public Client
+{
+private:
+    WiFiClient &_client;
+    bool _mqttFraming;
+    std::vector<uint16_t> _pubAcks; // Packet ids of the received PUBACK
+
+    // Inbound packet framing
+    typedef enum
+    {
+        FRAME_TYPE = 0,
+        FRAME_LENGTH = 1,
+        FRAME_BODY = 2
+    } FrameState;
+    FrameState _frameState = FRAME_TYPE;
+    uint8_t _frameType = 0;
+    uint32_t _frameLength = 0;
+    uint8_t _frameLengthShift = 0;
+    uint32_t _frameRead = 0;
+    uint16_t _framePacketId = 0;
+
+    // Connection steps
+    ClientStepStatus _connectStatus = CLIENT_STEP_FAILED;
+    bool _skipConnectPacket = false;
+#ifdef ESP32
+    int _connectSocket = -1;
+#endif
+
+public:
+    explicit ThingsCloudClient(WiFiClient &client, const bool mqttFraming = true) : _client(client), _mqttFraming(mqttFraming) {}
+
+    bool popPubAck(uint16_t &packetId); // Oldest received PUBACK, false if none
+
+    // Non-blocking on ESP32. The ESP8266 client has no such mode, the handshake then waits up to timeout milliseconds.
+    bool beginConnect(IPAddress ip, uint16_t port, const uint32_t timeout);
+    ClientStepStatus pollConnect();
+    void abortConnect();
+    inline void skipNextConnectPacket() { _skipConnectPacket = true; };
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char *host, uint16_t port) override;
+#ifdef ESP32
+    int connect(IPAddress ip, uint16_t port, int32_t timeout);
+    int connect(const char *host, uint16_t port, int32_t timeout);
+#endif
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buffer, size_t size) override;
+    int peek() override;
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override;
+
+private:
+    void resetFrame();
+    void frameByte(const uint8_t b);
+    void frameEnd();
+};
+
+#endif
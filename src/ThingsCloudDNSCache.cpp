@@ -0,0 +1,243 @@
+/*
+  ThingsCloudDNSCache.cpp - Host name cache for the ThingsCloud broker and API connections.
+  https://www.thingscloud.xyz
+*/
+
+#include "ThingsCloudDNSCache.h"
+#include <LittleFS.h>
+#include <lwip/dns.h>
+#ifdef ESP32
+#include <lwip/priv/tcpip_priv.h>
+
+// lwIP runs in its own task on ESP32: the query is started from that task, as WiFiGenericClass::hostByName does
+struct DNSQueryCall
+{
+    struct tcpip_api_call_data call;
+    const char *host;
+    ip_addr_t *address;
+    dns_found_callback found;
+    void *arg;
+    err_t err;
+};
+
+static err_t startDNSQuery(struct tcpip_api_call_data *data)
+{
+    DNSQueryCall *query = (DNSQueryCall *)data;
+    query->err = dns_gethostbyname(query->host, query->address, query->found, query->arg);
+    return ERR_OK;
+}
+#endif
+
+bool ThingsCloudDNSCache::enableFile(const char *path)
+{
+    if (!LittleFS.begin())
+        return false;
+    _path = path;
+
+    // One "host address" line per name, loaded as expired so that they are resolved again in the background
+    File file = LittleFS.open(path, "r");
+    if (!file)
+        return true;
+    std::vector<char> content(file.size() + 1, '\0');
+    file.read((uint8_t *)content.data(), content.size() - 1);
+    file.close();
+
+    char *line = content.data();
+    while (*line != '\0')
+    {
+        char *end = strchr(line, '\n');
+        if (end == nullptr)
+            break;
+        *end = '\0';
+
+        char *separator = strchr(line, ' ');
+        if (separator != nullptr)
+        {
+            *separator = '\0';
+            uint32_t address = strtoul(separator + 1, nullptr, 10);
+            Entry *entry = find(line) != nullptr ? find(line) : add(line);
+            if (entry != nullptr && address != 0)
+            {
+                entry->address = address;
+                entry->expired = true;
+            }
+        }
+        line = end + 1;
+    }
+    return true;
+}
+
+ClientStepStatus ThingsCloudDNSCache::resolve(const char *host, IPAddress &ip)
+{
+    Entry *entry = find(host);
+    if (entry == nullptr)
+        entry = add(host);
+    if (entry == nullptr)
+        return CLIENT_STEP_FAILED;
+
+    harvest(entry);
+    if (entry->expired || millis() - entry->resolvedMillis >= _ttl)
+    {
+        entry->expired = true;
+        if (entry->lookup.status == REFRESH_IDLE)
+        {
+            refresh(entry);
+            harvest(entry);
+        }
+    }
+
+    if (entry->address != 0 && !(entry->invalidated && entry->lookup.status == REFRESH_PENDING))
+    {
+        ip = IPAddress(entry->address);
+        return CLIENT_STEP_DONE;
+    }
+    if (entry->lookup.status == REFRESH_FAILED)
+    {
+        entry->lookup.status = REFRESH_IDLE;
+        return CLIENT_STEP_FAILED;
+    }
+    return CLIENT_STEP_PENDING;
+}
+
+void ThingsCloudDNSCache::invalidate(const char *host)
+{
+    Entry *entry = find(host);
+    if (entry != nullptr)
+    {
+        entry->expired = true;
+        entry->invalidated = entry->address != 0;
+    }
+}
+
+// ================== Private functions ====================-
+
+ThingsCloudDNSCache::Entry *ThingsCloudDNSCache::find(const char *host)
+{
+    for (std::size_t i = 0; i < DNS_CACHE_SIZE; i++)
+    {
+        if (strcmp(_entries[i].host, host) == 0)
+            return &_entries[i];
+    }
+    return nullptr;
+}
+
+// Take a free entry, or the one resolved the longest time ago
+ThingsCloudDNSCache::Entry *ThingsCloudDNSCache::add(const char *host)
+{
+    if (strlen(host) >= DNS_CACHE_HOST_SIZE)
+        return nullptr;
+
+    Entry *entry = nullptr;
+    for (std::size_t i = 0; i < DNS_CACHE_SIZE; i++)
+    {
+        if (_entries[i].host[0] == '\0')
+        {
+            entry = &_entries[i];
+            break;
+        }
+        if (entry == nullptr || millis() - _entries[i].resolvedMillis > millis() - entry->resolvedMillis)
+            entry = &_entries[i];
+    }
+
+    // A lookup still pending for the previous name is left to finish, harvest() drops its result
+    strcpy(entry->host, host);
+    entry->address = 0;
+    entry->resolvedMillis = 0;
+    entry->expired = true;
+    entry->invalidated = false;
+    entry->generation++;
+    return entry;
+}
+
+// Only called when no lookup is pending, so the network task does not write into the lookup meanwhile
+void ThingsCloudDNSCache::refresh(Entry *entry)
+{
+    Lookup *lookup = &entry->lookup;
+    lookup->generation = entry->generation;
+    lookup->status = REFRESH_PENDING;
+
+    ip_addr_t address;
+#ifdef ESP32
+    DNSQueryCall query;
+    query.host = entry->host;
+    query.address = &address;
+    query.found = &ThingsCloudDNSCache::onResolved;
+    query.arg = lookup;
+    query.err = ERR_ARG;
+    tcpip_api_call(startDNSQuery, &query.call);
+    err_t err = query.err;
+#else
+    err_t err = dns_gethostbyname(entry->host, &address, &ThingsCloudDNSCache::onResolved, lookup);
+#endif
+    if (err == ERR_OK)
+    {
+        lookup->address = ip_2_ip4(&address)->addr;
+        lookup->status = REFRESH_DONE;
+    }
+    else if (err != ERR_INPROGRESS)
+        lookup->status = REFRESH_FAILED;
+}
+
+// Take the result of the background resolution. On failure the last known good address is kept.
+void ThingsCloudDNSCache::harvest(Entry *entry)
+{
+    Lookup *lookup = &entry->lookup;
+    uint8_t status = lookup->status;
+    if (status != REFRESH_DONE && status != REFRESH_FAILED)
+        return;
+
+    // Started for the name the entry had before
+    if (lookup->generation != entry->generation)
+    {
+        lookup->status = REFRESH_IDLE;
+        return;
+    }
+
+    if (status == REFRESH_DONE)
+    {
+        bool changed = entry->address != lookup->address;
+        entry->address = lookup->address;
+        entry->resolvedMillis = millis();
+        entry->expired = false;
+        entry->invalidated = false;
+        lookup->status = REFRESH_IDLE;
+        if (changed)
+            save();
+    }
+    else if (entry->address != 0)
+    {
+        entry->invalidated = false;
+        lookup->status = REFRESH_IDLE;
+    }
+}
+
+// Written only when an address changed, to spare the flash
+void ThingsCloudDNSCache::save()
+{
+    if (_path == nullptr)
+        return;
+
+    File file = LittleFS.open(_path, "w");
+    if (!file)
+        return;
+    for (std::size_t i = 0; i < DNS_CACHE_SIZE; i++)
+    {
+        if (_entries[i].host[0] != '\0' && _entries[i].address != 0)
+            file.print(String(_entries[i].host) + " " + String(_entries[i].address) + "\n");
+    }
+    file.close();
+}
+
+// Called from the network task, a null address when the name could not be resolved.
+// Only the lookup is written, the status last: from then on the loop task owns it.
+void ThingsCloudDNSCache::onResolved(const char *name, const ip_addr_t *address, void *arg)
+{
+    Lookup *lookup = (Lookup *)arg;
+    if (address != nullptr)
+    {
+        lookup->address = ip_2_ip4(address)->addr;
+        lookup->status = REFRESH_DONE;
+    }
+    else
+        lookup->status = REFRESH_FAILED;
+}
@@ -0,0 +1,73 @@
+/*
+  ThingsCloudDNSCache.h - Host name cache for the ThingsCloud broker and API connections.
+  https://www.thingscloud.xyz
+*/
+
+#ifndef ThingsCloud_DNSCache_H
+#define ThingsCloud_DNSCache_H
+
+#include <Arduino.h>
+#include <lwip/ip_addr.h>
+#include "ThingsCloudClient.h"
+
+#define DNS_CACHE_SIZE 4
+#define DNS_CACHE_HOST_SIZE 64
+
+// A resolved address is used without any DNS query for ttl milliseconds. Past that, the last known good address
+// is still returned right away while the name is resolved again in the background, so a connection only waits for
+// the DNS the first time a name is seen, and still works during a DNS outage.
+// lwIP does not report the TTL of the records, the same TTL applies to every name.
+class ThingsCloudDNSCache
+{
+private:
+    typedef enum
+    {
+        REFRESH_IDLE = 0,
+        REFRESH_PENDING = 1,
+        REFRESH_DONE = 2,
+        REFRESH_FAILED = 3
+    } RefreshStatus;
+
+    // Background resolution, answered from the network task. While pending only the network task writes it,
+    // once done or failed only the loop task does.
+    struct Lookup
+    {
+        volatile uint8_t status = REFRESH_IDLE;
+        volatile uint32_t address = 0;
+        uint32_t generation = 0; // Generation of the entry the lookup was started for
+    };
+
+    struct Entry
+    {
+        char host[DNS_CACHE_HOST_SIZE] = {0};
+        uint32_t address = 0; // Last known good address, 0 until resolved
+        unsigned long resolvedMillis = 0;
+        bool expired = true;
+        bool invalidated = false; // The address did not answer, wait for the new resolution before using it again
+        uint32_t generation = 0;  // Bumped when the entry is given to another name
+        Lookup lookup;
+    };
+    Entry _entries[DNS_CACHE_SIZE];
+    unsigned long _ttl = 5 * 60 * 1000;
+    const char *_path = nullptr; // Last known good addresses, kept across reboots
+
+public:
+    inline void setTTL(const unsigned long ttl) { _ttl = ttl; };
+    bool enableFile(const char *path); // Load the addresses saved by a previous boot, and save the new ones
+
+    // Done with the cached address, pending until the first resolution of the name, failed if it could not be resolved
+    ClientStepStatus resolve(const char *host, IPAddress &ip);
+    // The address did not answer: the next calls are pending until the name is resolved again,
+    // the last known good address is only returned if that resolution fails
+    void invalidate(const char *host);
+
+private:
+    Entry *find(const char *host);
+    Entry *add(const char *host);
+    void refresh(Entry *entry);
+    void harvest(Entry *entry);
+    void save();
+    static void onResolved(const char *name, const ip_addr_t *address, void *arg);
+};
+
+#endif
@@ -0,0 +1,185 @@
+/*
+  ThingsCloudLZSS.cpp - Small window LZSS codec for the ThingsCloud data payloads.
+  https://www.thingscloud.xyz
+*/
+
+#include "ThingsCloudLZSS.h"
+
+size_t ThingsCloudLZSS::maxCompressedSize(const size_t length)
+{
+    // A stored payload is never larger than the header and the original payload
+    return 1 + length;
+}
+
+size_t ThingsCloudLZSS::compress(const uint8_t *input, const size_t length, uint8_t *output, const size_t outputSize)
+{
+    if (length > 0xFFFF)
+        return 0;
+
+    // Past the stored size, compressing does not help anymore
+    size_t limit = outputSize < length + 1 ? outputSize : length + 1;
+    size_t out = 3;
+    bool fits = limit > out;
+    if (fits)
+    {
+        output[0] = HEADER_COMPRESSED;
+        output[1] = length >> 8;
+        output[2] = length & 0xFF;
+    }
+
+    size_t pos = 0;
+    size_t flagPos = 0;
+    uint8_t bit = 8;
+    while (fits && pos < length)
+    {
+        if (bit == 8)
+        {
+            if (out >= limit)
+            {
+                fits = false;
+                break;
+            }
+            flagPos = out;
+            output[out++] = 0;
+            bit = 0;
+        }
+
+        // Longest match in the window, the nearest one first
+        size_t bestLength = 0;
+        size_t bestDistance = 0;
+        size_t maxLength = length - pos < MAX_MATCH ? length - pos : MAX_MATCH;
+        size_t windowStart = pos > WINDOW_SIZE ? pos - WINDOW_SIZE : 0;
+        for (size_t candidate = pos; maxLength >= MIN_MATCH && candidate-- > windowStart;)
+        {
+            if (input[candidate] != input[pos] || input[candidate + bestLength] != input[pos + bestLength])
+                continue;
+
+            size_t matchLength = 0;
+            while (matchLength < maxLength && input[candidate + matchLength] == input[pos + matchLength])
+                matchLength++;
+            if (matchLength > bestLength)
+            {
+                bestLength = matchLength;
+                bestDistance = pos - candidate;
+                if (matchLength == maxLength)
+                    break;
+            }
+        }
+
+        if (bestLength >= MIN_MATCH)
+        {
+            if (out + 2 > limit)
+            {
+                fits = false;
+                break;
+            }
+            uint16_t token = ((bestDistance - 1) << 7) | (bestLength - MIN_MATCH);
+            output[flagPos] |= 1 << bit;
+            output[out++] = token >> 8;
+            output[out++] = token & 0xFF;
+            pos += bestLength;
+        }
+        else
+        {
+            if (out + 1 > limit)
+            {
+                fits = false;
+                break;
+            }
+            output[out++] = input[pos++];
+        }
+        bit++;
+    }
+
+    if (fits && out < length + 1)
+        return out;
+
+    if (outputSize < length + 1)
+        return 0;
+    output[0] = HEADER_STORED;
+    // input may be null when empty, which memcpy() does not allow even for 0 bytes
+    if (length > 0)
+        memcpy(output + 1, input, length);
+    return length + 1;
+}
+
+bool ThingsCloudLZSS::isCompressed(const uint8_t *input, const size_t length)
+{
+    return length >= 1 && (input[0] == HEADER_STORED || (input[0] == HEADER_COMPRESSED && length >= 3));
+}
+
+size_t ThingsCloudLZSS::decompressedSize(const uint8_t *input, const size_t length)
+{
+    if (!isCompressed(input, length))
+        return 0;
+    if (input[0] == HEADER_STORED)
+        return length - 1;
+
+    size_t size = ((size_t)input[1] << 8) | input[2];
+    return size <= maxDecompressedSize(length) ? size : 0;
+}
+
+size_t ThingsCloudLZSS::maxDecompressedSize(const size_t length)
+{
+    if (length < 3)
+        return 0;
+    return (length - 3) / 2 * MAX_MATCH + (length - 3) % 2;
+}
+
+bool ThingsCloudLZSS::decompress(const uint8_t *input, const size_t length, uint8_t *output, const size_t outputSize, size_t &outputLength)
+{
+    if (!isCompressed(input, length))
+        return false;
+
+    // 0 from a header announcing a length is a size the payload cannot hold
+    size_t expected = decompressedSize(input, length);
+    if (expected == 0 && input[0] == HEADER_COMPRESSED && (input[1] != 0 || input[2] != 0))
+        return false;
+    if (expected > outputSize)
+        return false;
+
+    if (input[0] == HEADER_STORED)
+    {
+        if (expected > 0)
+            memcpy(output, input + 1, expected);
+        outputLength = expected;
+        return true;
+    }
+
+    size_t in = 3;
+    size_t out = 0;
+    while (out < expected)
+    {
+        if (in >= length)
+            return false;
+        uint8_t flags = input[in++];
+
+        for (uint8_t bit = 0; bit < 8 && out < expected; bit++)
+        {
+            if (flags & (1 << bit))
+            {
+                if (in + 2 > length)
+                    return false;
+                uint16_t token = (input[in] << 8) | input[in + 1];
+                in += 2;
+
+                // The match may overlap the bytes it produces
+                size_t distance = (token >> 7) + 1;
+                size_t matchLength = (token & 0x7F) + MIN_MATCH;
+                if (distance > out || out + matchLength > expected)
+                    return false;
+                for (size_t i = 0; i < matchLength; i++, out++)
+                    output[out] = output[out - distance];
+            }
+            else
+            {
+                if (in >= length)
+                    return false;
+                output[out++] = input[in++];
+            }
+        }
+    }
+
+    outputLength = expected;
+    return true;
+}
@@ -0,0 +1,40 @@
+/*
+  ThingsCloudLZSS.h - Small window LZSS codec for the ThingsCloud data payloads.
+  https://www.thingscloud.xyz
+*/
+
+#ifndef ThingsCloud_LZSS_H
+#define ThingsCloud_LZSS_H
+
+#include <Arduino.h>
+
+// A compressed payload starts with a header byte:
+//   0xF5, original length (2 bytes, big endian), LZSS stream
+//   0xF4, original payload, when compression does not make it smaller
+// The LZSS stream is made of groups of a flag byte followed by 8 items, bit 0 first: a literal byte when the bit is 0,
+// or a 2 bytes match when it is 1, with the distance - 1 in the high 9 bits and the length - 3 in the low 7 bits.
+// The window is the previous 512 bytes of the same payload, so every message is decoded on its own.
+// The header does not mark a payload as compressed: uncompressed payloads may start with the same bytes,
+// so the topics carrying compressed payloads are agreed on by both sides.
+class ThingsCloudLZSS
+{
+public:
+    static const uint8_t HEADER_COMPRESSED = 0xF5;
+    static const uint8_t HEADER_STORED = 0xF4;
+    static const size_t WINDOW_SIZE = 512;
+    static const size_t MIN_MATCH = 3;
+    static const size_t MAX_MATCH = 130;
+
+    static size_t maxCompressedSize(const size_t length);
+    // Return the size written to output, 0 if output is too small or the payload longer than 65535 bytes
+    static size_t compress(const uint8_t *input, const size_t length, uint8_t *output, const size_t outputSize);
+
+    static bool isCompressed(const uint8_t *input, const size_t length); // Starts with a valid header, for a payload known to be compressed
+    // Original length from the header, 0 when the header is not valid or announces more than the payload can hold
+    static size_t decompressedSize(const uint8_t *input, const size_t length);
+    static size_t maxDecompressedSize(const size_t length); // Each 2 bytes match gives at most MAX_MATCH bytes
+    // Return false if the payload is corrupted or output too small
+    static bool decompress(const uint8_t *input, const size_t length, uint8_t *output, const size_t outputSize, size_t &outputLength);
+};
+
+#endif
@@ -4,6 +4,202 @@
 */
 
 #include "ThingsCloudMQTT.h"
+#include <LittleFS.h>
+
+#define MQTT_PACKET_SUBSCRIBE 8
+#define MQTT_PACKET_UNSUBSCRIBE 10
+
+// =============== JSON scanning helpers ===================
+// Used to route inbound messages on a few top-level members, without a full parse of the payload.
+
+static const char *skipJsonWhitespace(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        p++;
+    return p;
+}
+
+// Return the end of the JSON value beginning at p, or nullptr if it is malformed
+static const char *skipJsonValue(const char *p, const char *end)
+{
+    if (p >= end)
+        return nullptr;
+
+    if (*p == '"')
+    {
+        p++;
+        while (p < end && *p != '"')
+        {
+            if (*p == '\\')
+                p++;
+            p++;
+        }
+        return p < end ? p + 1 : nullptr;
+    }
+
+    if (*p == '{' || *p == '[')
+    {
+        int depth = 0;
+        while (p < end)
+        {
+            if (*p == '"')
+            {
+                p = skipJsonValue(p, end);
+                if (p == nullptr)
+                    return nullptr;
+                continue;
+            }
+            if (*p == '{' || *p == '[')
+                depth++;
+            else if ((*p == '}' || *p == ']') && --depth == 0)
+                return p + 1;
+            p++;
+        }
+        return nullptr;
+    }
+
+    // Number, true, false or null
+    const char *start = p;
+    while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        p++;
+    return p > start ? p : nullptr;
+}
+
+// Call onMember(key, keyLength, value, valueLength) for each top-level member of a JSON object, until it returns false.
+// Keys are given without their quotes, values are raw JSON. Return false if the payload is not a JSON object.
+template <typename TCallback>
+static bool scanJsonObject(const char *p, size_t length, TCallback onMember)
+{
+    const char *end = p + length;
+
+    p = skipJsonWhitespace(p, end);
+    if (p >= end || *p != '{')
+        return false;
+    p = skipJsonWhitespace(p + 1, end);
+    if (p < end && *p == '}')
+        return true;
+
+    while (p < end && *p == '"')
+    {
+        const char *keyEnd = skipJsonValue(p, end);
+        if (keyEnd == nullptr)
+            return false;
+        const char *key = p + 1;
+        size_t keyLength = keyEnd - 1 - key;
+
+        p = skipJsonWhitespace(keyEnd, end);
+        if (p >= end || *p != ':')
+            return false;
+        p = skipJsonWhitespace(p + 1, end);
+
+        const char *valueEnd = skipJsonValue(p, end);
+        if (valueEnd == nullptr)
+            return false;
+        if (!onMember(key, keyLength, p, (size_t)(valueEnd - p)))
+            return true;
+
+        p = skipJsonWhitespace(valueEnd, end);
+        if (p < end && *p == ',')
+            p = skipJsonWhitespace(p + 1, end);
+        else
+            return p < end && *p == '}';
+    }
+    return false;
+}
+
+// FNV-1a hash, used to look up handlers by method or attribute name
+static uint32_t hashKey(const char *key, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Insert a handler record in a list sorted by key hash, replacing the record of the same key if any
+template <typename TRecord>
+static void insertKeyedHandler(std::vector<TRecord> &list, const TRecord &record)
+{
+    std::size_t i = 0;
+    while (i < list.size() && list[i].keyHash < record.keyHash)
+        i++;
+    while (i < list.size() && list[i].keyHash == record.keyHash && !list[i].key.equals(record.key))
+        i++;
+    if (i < list.size() && list[i].key.equals(record.key))
+        list[i] = record;
+    else
+        list.insert(list.begin() + i, record);
+}
+
+// Return the index of the handler record of a key, or -1
+template <typename TRecord>
+static int findKeyedHandler(const std::vector<TRecord> &list, const char *key, size_t length)
+{
+    uint32_t keyHash = hashKey(key, length);
+    for (std::size_t i = 0; i < list.size() && list[i].keyHash <= keyHash; i++)
+    {
+        if (list[i].keyHash == keyHash && list[i].key.length() == length && memcmp(list[i].key.c_str(), key, length) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Priority class of the ThingsCloud topics, used after the filters set by setPublishPriority()
+static const struct
+{
+    const char *topicFilter;
+    PublishPriority priority;
+} defaultPublishPriorities[] = {
+    {"event/report/+", PRIORITY_CRITICAL},
+    {"command/reply/+", PRIORITY_COMMAND_REPLY},
+    {"attributes/#", PRIORITY_ATTRIBUTE},
+};
+
+// Print adapter batching the serialized bytes into small writes to the MQTT client
+class MqttChunkWriter : public Print
+{
+public:
+    explicit MqttChunkWriter(PubSubClient &client) : _client(client) {}
+
+    size_t write(uint8_t c) override
+    {
+        if (_used == sizeof(_chunk) && !flushChunk())
+            return 0;
+        _chunk[_used++] = c;
+        return 1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        size_t count = 0;
+        while (count < size && write(buffer[count]) == 1)
+            count++;
+        return count;
+    }
+
+    bool flushChunk()
+    {
+        size_t used = _used;
+        _used = 0;
+        if (used == 0)
+            return true;
+        if (_client.write(_chunk, used) != used)
+            return false;
+        _written += used;
+        return true;
+    }
+
+    inline size_t written() const { return _written; };
+
+private:
+    PubSubClient &_client;
+    uint8_t _chunk[PUBLISH_STREAM_CHUNK_SIZE];
+    size_t _used = 0;
+    size_t _written = 0;
+};
 
 // =============== Constructor / destructor ===================
 
@@ -13,9 +209,17 @@ ThingsCloudMQTT::ThingsCloudMQTT(
     const char *projectKey) : _mqttHost(mqttHost),
                               _accessToken(accessToken),
                               _projectKey(projectKey),
-                              _mqttClient(mqttHost, _mqttServerPort, _wifiClient)
+                              _mqttTransport(_wifiClient),
+                              _httpTransport(_httpClient, false),
+                              _mqttClient(mqttHost, _mqttServerPort, _mqttTransport),
+                              _inboundJsonDoc(DEFAULT_JSON_DOCUMENT_CAPACITY),
+                              _routerJsonDoc(0),
+                              _attributesPushDoc(0),
+                              _attributesPushSnapshot(0),
+                              _pendingAttributesDoc(0)
 {
     // WiFi connection
+    _handleWiFi = false;
     _wifiConnected = false;
     _connectingToWifi = false;
     _nextWifiConnectionAttemptMillis = 500;
@@ -35,8 +239,16 @@ ThingsCloudMQTT::ThingsCloudMQTT(
                                _projectKey(projectKey),
                                _typeKey(typeKey),
                                _apiEndpoint(apiEndpoint),
-                               _mqttClient(mqttHost, _mqttServerPort, _wifiClient)
+                               _mqttTransport(_wifiClient),
+                               _httpTransport(_httpClient, false),
+                              _mqttClient(mqttHost, _mqttServerPort, _mqttTransport),
+                              _inboundJsonDoc(DEFAULT_JSON_DOCUMENT_CAPACITY),
+                              _routerJsonDoc(0),
+                              _attributesPushDoc(0),
+                              _attributesPushSnapshot(0),
+                              _pendingAttributesDoc(0)
 {
+    _handleWiFi = false;
     _wifiConnected = false;
     _connectingToWifi = false;
     _nextWifiConnectionAttemptMillis = 500;
@@ -61,6 +273,7 @@ void ThingsCloudMQTT::initState()
     _mqttClientName = String(DEFAULT_MQTT_CLIENT_NAME) + "_" + getEspChipUniqueId();
     _mqttConnected = false;
     _nextMqttConnectionAttemptMillis = 0;
+    _nextAccessTokenFetchAttemptMillis = 0;
     _mqttReconnectionAttemptDelay = 15 * 1000;
     _accessTokenFetchAttemptDelay = 10 * 1000;
     _mqttLastWillTopic = 0;
@@ -79,17 +292,149 @@ void ThingsCloudMQTT::initState()
 
 // =============== Configuration functions, most of them must be called before the first loop() call ==============
 
+void ThingsCloudMQTT::setReconnectionBackoff(const unsigned long maxDelayMillis, const unsigned long fastRetryMillis)
+{
+    _reconnectMaxDelay = maxDelayMillis;
+    _reconnectFastRetryDelay = fastRetryMillis;
+}
+
+void ThingsCloudMQTT::setMqttConnectionTimeouts(const unsigned int resolveMillis, const unsigned int tcpConnectMillis, const unsigned int connackMillis)
+{
+    _mqttResolveTimeout = resolveMillis;
+    _mqttTcpConnectTimeout = tcpConnectMillis;
+    _mqttConnackTimeout = connackMillis;
+}
+
 void ThingsCloudMQTT::enableDebuggingMessages(const bool enabled)
 {
     _enableSerialLogs = enabled;
 }
 
+void ThingsCloudMQTT::setJsonDocumentCapacity(const size_t capacity)
+{
+    _inboundJsonDoc = DynamicJsonDocument(capacity);
+}
+
+void ThingsCloudMQTT::enableInboundQueue(const uint8_t slotCount, const uint16_t slotSize, const InboundQueuePolicy policy)
+{
+    _inboundQueueBuffer.assign((size_t)slotCount * slotSize, 0);
+    _inboundQueueSlots.assign(slotCount, {0, 0});
+    _inboundQueueSlotSize = slotSize;
+    _inboundQueuePolicy = policy;
+    _inboundQueueHead = 0;
+    _inboundQueueCount = 0;
+}
+
+void ThingsCloudMQTT::setInboundDispatchBudget(const uint8_t maxMessages, const unsigned long maxMillis)
+{
+    _inboundDispatchMaxMessages = maxMessages;
+    _inboundDispatchMaxMillis = maxMillis;
+}
+
+void ThingsCloudMQTT::enableAttributesPushCoalescing(const unsigned long windowMillis, const size_t capacity)
+{
+    _attributesPushDoc = DynamicJsonDocument(capacity);
+    _attributesPushSnapshot = DynamicJsonDocument(capacity);
+    _attributesPushWindow = windowMillis;
+    _attributesPushPending = false;
+}
+
+bool ThingsCloudMQTT::enableOutbox(const size_t ramCapacity)
+{
+    return _outbox.begin(ramCapacity);
+}
+
+bool ThingsCloudMQTT::enableOutboxSpill(const char *path, const size_t maxBytes)
+{
+    bool success = _outbox.enableSpill(path, maxBytes);
+
+    if (_enableSerialLogs)
+    {
+        if (success)
+            Serial.printf("MQTT: Outbox spill file %s, %u pending messages\n", path, _outbox.getCount());
+        else
+            Serial.println("MQTT! Outbox spill disabled, LittleFS mount failed");
+    }
+    return success;
+}
+
+void ThingsCloudMQTT::setOutboxRetention(const String &topicFilter, const OutboxRetention retention)
+{
+    for (std::size_t i = 0; i < _outboxRetentionList.size(); i++)
+    {
+        if (_outboxRetentionList[i].topicFilter.equals(topicFilter))
+        {
+            _outboxRetentionList[i].retention = retention;
+            return;
+        }
+    }
+    _outboxRetentionList.push_back({topicFilter, retention});
+}
+
+void ThingsCloudMQTT::setOutboxDrainRate(const uint8_t maxMessages, const unsigned long intervalMillis)
+{
+    _outboxDrainMaxMessages = maxMessages;
+    _outboxDrainIntervalMillis = intervalMillis;
+}
+
+void ThingsCloudMQTT::setPublishPriority(const String &topicFilter, const PublishPriority priority)
+{
+    for (std::size_t i = 0; i < _publishPriorityList.size(); i++)
+    {
+        if (_publishPriorityList[i].topicFilter.equals(topicFilter))
+        {
+            _publishPriorityList[i].priority = priority;
+            return;
+        }
+    }
+    _publishPriorityList.push_back({topicFilter, priority});
+}
+
+PublishPriority ThingsCloudMQTT::getPublishPriority(const char *topic) const
+{
+    for (std::size_t i = 0; i < _publishPriorityList.size(); i++)
+    {
+        if (ThingsCloudTopicTrie::filterMatches(_publishPriorityList[i].topicFilter.c_str(), topic))
+            return _publishPriorityList[i].priority;
+    }
+    for (std::size_t i = 0; i < sizeof(defaultPublishPriorities) / sizeof(defaultPublishPriorities[0]); i++)
+    {
+        if (ThingsCloudTopicTrie::filterMatches(defaultPublishPriorities[i].topicFilter, topic))
+            return defaultPublishPriorities[i].priority;
+    }
+    return PRIORITY_BULK;
+}
+
+void ThingsCloudMQTT::setPublishRateLimit(const float messagesPerSecond, const uint16_t burst, const RateLimitPolicy policy)
+{
+    _publishRateLimit = {messagesPerSecond, (float)burst, (float)burst, millis()};
+    _publishRateLimitPolicy = policy;
+}
+
+void ThingsCloudMQTT::setTopicRateLimit(const String &topicFilter, const float messagesPerSecond, const uint16_t burst, const RateLimitPolicy policy)
+{
+    TokenBucket bucket = {messagesPerSecond, (float)burst, (float)burst, millis()};
+    for (std::size_t i = 0; i < _topicRateLimitList.size(); i++)
+    {
+        if (_topicRateLimitList[i].topicFilter.equals(topicFilter))
+        {
+            _topicRateLimitList[i].bucket = bucket;
+            _topicRateLimitList[i].policy = policy;
+            return;
+        }
+    }
+    _topicRateLimitList.push_back({topicFilter, bucket, policy});
+}
+
 bool ThingsCloudMQTT::fetchDeviceAccessToken()
 {
     HTTPClient http;
     if (_enableSerialLogs)
         Serial.println("Request device AccessToken by DeviceKey " + _deviceKey);
-    String serverPath = String(_apiEndpoint) + "/device/v1/certificate";
+    String serverPath = String(_apiEndpoint);
+    while (serverPath.endsWith("/"))
+        serverPath.remove(serverPath.length() - 1);
+    serverPath += "/device/v1/certificate";
 #ifdef ESP32
     http.begin(serverPath.c_str());
 #else
@@ -97,6 +442,70 @@ bool ThingsCloudMQTT::fetchDeviceAccessToken()
 #endif
     http.addHeader("Content-Type", "application/json");
     http.addHeader("Project-Key", _projectKey);
+
+    bool granted = false;
+    int httpResponseCode = http.POST(accessTokenRequestBody());
+    if (httpResponseCode >= 200 && httpResponseCode <= 299)
+        granted = parseAccessTokenResponse(http.getString().c_str());
+    else if (_enableSerialLogs)
+        Serial.printf("AccessToken request failed, error code: %d\n", httpResponseCode);
+    http.end();
+    return granted;
+}
+
+bool ThingsCloudMQTT::enableAccessTokenCache(const char *path)
+{
+    if (!LittleFS.begin())
+    {
+        if (_enableSerialLogs)
+            Serial.println("AccessToken cache unavailable, LittleFS is not mounted");
+        return false;
+    }
+    _accessTokenCachePath = path;
+    if (!_needFetchAccessToken || _accessTokenFetched)
+        return true;
+
+    // Device key, project key and AccessToken, one per line
+    File file = LittleFS.open(path, "r");
+    if (!file)
+        return true;
+    std::vector<char> content(file.size() + 1, '\0');
+    file.read((uint8_t *)content.data(), content.size() - 1);
+    file.close();
+
+    char *deviceKey = content.data();
+    char *projectKey = strchr(deviceKey, '\n');
+    char *accessToken = projectKey != nullptr ? strchr(projectKey + 1, '\n') : nullptr;
+    char *end = accessToken != nullptr ? strchr(accessToken + 1, '\n') : nullptr;
+    if (end == nullptr)
+        return true;
+    *projectKey++ = '\0';
+    *accessToken++ = '\0';
+    *end = '\0';
+
+    if (_deviceKey.equals(deviceKey) && strcmp(_projectKey, projectKey) == 0 && strlen(accessToken) > 0)
+    {
+        _accessToken = accessToken;
+        _accessTokenFetched = true;
+        if (_enableSerialLogs)
+            Serial.println("AccessToken loaded from cache -> " + _accessToken);
+    }
+    return true;
+}
+
+bool ThingsCloudMQTT::enableDnsCacheFile(const char *path)
+{
+    if (!_dnsCache.enableFile(path))
+    {
+        if (_enableSerialLogs)
+            Serial.println("DNS cache file unavailable, LittleFS is not mounted");
+        return false;
+    }
+    return true;
+}
+
+String ThingsCloudMQTT::accessTokenRequestBody()
+{
     StaticJsonDocument<1024> postObject;
     postObject["device_key"] = _deviceKey;
     if (_typeKey != "")
@@ -109,136 +518,391 @@ bool ThingsCloudMQTT::fetchDeviceAccessToken()
     }
     String postData;
     serializeJson(postObject, postData);
+    return postData;
+}
 
-    int httpResponseCode = http.POST(postData);
-    if (httpResponseCode > 0)
+// Keep the granted AccessToken, true when the certificate API granted one
+bool ThingsCloudMQTT::parseAccessTokenResponse(const char *body)
+{
+    StaticJsonDocument<256> doc;
+    DeserializationError error = deserializeJson(doc, body);
+    if (error)
     {
-        StaticJsonDocument<256> doc;
-        DeserializationError error = deserializeJson(doc, http.getString().c_str());
-        if (error)
-        {
-            if (_enableSerialLogs)
-                Serial.println("AccessToken parse failed");
-            return false;
-        }
-        int result = doc["result"];
-        const char *message = doc["message"];
-        JsonObject device = doc["device"];
-        const char *deviceId = device["id"];
-        const char *deviceName = device["name"];
-        const char *deviceAccessToken = device["access_token"];
-        if (result == 1)
-        {
-            _accessToken = String(deviceAccessToken);
-            if (_enableSerialLogs)
-                Serial.println("AccessToken granted -> " + _accessToken);
-        }
-        else
-        {
-            http.end();
-            if (_enableSerialLogs)
-                Serial.printf("AccessToken refused message: %s\n", message);
-            return false;
-        }
+        if (_enableSerialLogs)
+            Serial.println("AccessToken parse failed");
+        return false;
     }
-    else
+    int result = doc["result"];
+    const char *message = doc["message"];
+    JsonObject device = doc["device"];
+    const char *deviceAccessToken = device["access_token"];
+    if (result != 1 || deviceAccessToken == nullptr)
     {
         if (_enableSerialLogs)
-            Serial.println("Error code: " + httpResponseCode);
+            Serial.printf("AccessToken refused message: %s\n", message != nullptr ? message : "");
+        return false;
     }
-    http.end();
-    return true;
-}
 
-void ThingsCloudMQTT::setCustomerId(const String customerId)
-{
-    _customerId = customerId;
+    _accessToken = String(deviceAccessToken);
+    _accessTokenFetched = true;
+    _failedAccessTokenFetchCount = 0;
     if (_enableSerialLogs)
-        Serial.printf("Set customerId -> %s\n", _customerId.c_str());
+        Serial.println("AccessToken granted -> " + _accessToken);
+    saveAccessToken();
+    return true;
 }
 
-// =============== Main loop / connection state handling =================
-
-void ThingsCloudMQTT::loop()
+void ThingsCloudMQTT::saveAccessToken()
 {
-    // WIFI handling
-    bool wifiStateChanged = handleWiFi();
-
-    // If there is a change in the wifi connection state, don't handle the mqtt connection state right away.
-    // We will wait at least one lopp() call. This prevent the library from doing too much thing in the same loop() call.
-    if (wifiStateChanged)
+    if (_accessTokenCachePath == nullptr)
         return;
 
-    // Fetch AccessToken
-    if (!isWifiConnected())
+    File file = LittleFS.open(_accessTokenCachePath, "w");
+    if (!file)
         return;
-    if (_needFetchAccessToken && !_accessTokenFetched)
-    {
-        if (_nextAccessTokenFetchAttemptMillis > 0 && millis() < _nextAccessTokenFetchAttemptMillis)
-            return;
-
-        bool ret = fetchDeviceAccessToken();
-        if (ret)
-        {
-            _accessTokenFetched = true;
-        }
-        else
-        {
-            _nextAccessTokenFetchAttemptMillis = millis() + _accessTokenFetchAttemptDelay;
-            return;
-        }
-    }
+    file.print(_deviceKey + "\n" + _projectKey + "\n" + _accessToken + "\n");
+    file.close();
+}
 
-    // MQTT Handling
-    bool mqttStateChanged = handleMQTT();
-    if (mqttStateChanged)
-        return;
+// The broker rejected the AccessToken, request it again before the next connection
+void ThingsCloudMQTT::invalidateAccessToken()
+{
+    _accessTokenFetched = false;
+    _nextAccessTokenFetchAttemptMillis = 0;
+    if (_accessTokenCachePath != nullptr)
+        LittleFS.remove(_accessTokenCachePath);
 
-    // Procewss the delayed execution commands
-    processDelayedExecutionRequests();
+    if (_enableSerialLogs)
+        Serial.println("AccessToken rejected by the broker, requesting a new one");
 }
 
-bool ThingsCloudMQTT::handleWiFi()
+// "http://host[:port][/path]", false when the host or the port is missing or invalid
+static bool splitHttpUrl(const char *url, String &host, uint16_t &port, String &path)
 {
-    // When it's the first call, reset the wifi radio and schedule the wifi connection
-    static bool firstLoopCall = true;
-    if (_handleWiFi && firstLoopCall)
+    String rest(url + strlen("http://"));
+    int pathStart = rest.indexOf('/');
+    host = pathStart < 0 ? rest : rest.substring(0, pathStart);
+    path = pathStart < 0 ? String() : rest.substring(pathStart);
+
+    port = 80;
+    int portStart = host.indexOf(':');
+    if (portStart >= 0)
     {
-        WiFi.disconnect(true);
-        _nextWifiConnectionAttemptMillis = millis() + 500;
-        firstLoopCall = false;
-        return true;
+        long value = host.substring(portStart + 1).toInt();
+        if (value <= 0 || value > 0xFFFF)
+            return false;
+        port = value;
+        host = host.substring(0, portStart);
     }
+    return host.length() > 0;
+}
 
-    // Get the current connextion status
-    bool isWifiConnected = (WiFi.status() == WL_CONNECTED);
+// Start the AccessToken request, carried on by processAccessTokenFetch() (non-blocking)
+bool ThingsCloudMQTT::beginAccessTokenFetch()
+{
+    // Parsed once, the request steps reuse the parts
+    if (!splitHttpUrl(_apiEndpoint, _accessTokenHost, _accessTokenPort, _accessTokenPath))
+    {
+        onAccessTokenFetchFailed("INVALID_URL");
+        return false;
+    }
+    // The request path is appended with its own '/'
+    while (_accessTokenPath.endsWith("/"))
+        _accessTokenPath.remove(_accessTokenPath.length() - 1);
 
-    /***** Detect ans handle the current WiFi handling state *****/
+    if (_enableSerialLogs)
+        Serial.println("Request device AccessToken by DeviceKey " + _deviceKey);
 
-    // Connection established
-    if (isWifiConnected && !_wifiConnected)
-    {
-        onWiFiConnectionEstablished();
-        _connectingToWifi = false;
+    _accessTokenFetchState = TOKEN_FETCH_RESOLVING;
+    _accessTokenFetchStepMillis = millis();
+    return true;
+}
 
-        // At least 500 miliseconds of waiting before an mqtt connection attempt.
-        // Some people have reported instabilities when trying to connect to
-        // the mqtt broker right after being connected to wifi.
-        // This delay prevent these instabilities.
-        _nextMqttConnectionAttemptMillis = millis() + 500;
-        _nextAccessTokenFetchAttemptMillis = millis() + 500;
-    }
+// Same steps as the MQTT connection, the HTTP/1.0 response is read until the server closes the connection
+void ThingsCloudMQTT::processAccessTokenFetch()
+{
+    unsigned long elapsed = millis() - _accessTokenFetchStepMillis;
+    ClientStepStatus status;
 
-    // Connection in progress
-    else if (_connectingToWifi)
+    switch (_accessTokenFetchState)
     {
-        if (WiFi.status() == WL_CONNECT_FAILED || millis() - _lastWifiConnectiomAttemptMillis >= _wifiReconnectionAttemptDelay)
+    case TOKEN_FETCH_RESOLVING:
+    {
+        IPAddress ip;
+        status = _dnsCache.resolve(_accessTokenHost.c_str(), ip);
+        if (status == CLIENT_STEP_FAILED)
+            onAccessTokenFetchFailed("DNS_FAILED");
+        else if (status == CLIENT_STEP_PENDING)
+        {
+            if (elapsed >= _mqttResolveTimeout)
+                onAccessTokenFetchFailed("DNS_TIMEOUT");
+        }
+        else
+        {
+            _accessTokenFetchState = TOKEN_FETCH_CONNECTING;
+            _accessTokenFetchStepMillis = millis();
+            if (!_httpTransport.beginConnect(ip, _accessTokenPort, _mqttTcpConnectTimeout))
+                onAccessTokenFetchFailed("CONNECT_FAILED");
+        }
+        break;
+    }
+
+    case TOKEN_FETCH_CONNECTING:
+    {
+        status = _httpTransport.pollConnect();
+        if (status == CLIENT_STEP_FAILED)
+        {
+            // The cached address may be outdated, the next attempt resolves the name again
+            _dnsCache.invalidate(_accessTokenHost.c_str());
+            onAccessTokenFetchFailed("CONNECT_FAILED");
+        }
+        else if (status == CLIENT_STEP_PENDING)
+        {
+            if (elapsed >= _mqttTcpConnectTimeout)
+            {
+                _dnsCache.invalidate(_accessTokenHost.c_str());
+                onAccessTokenFetchFailed("TCP_TIMEOUT");
+            }
+        }
+        else
+        {
+            // HTTP/1.0, so that the response is neither chunked nor kept alive
+            String body = accessTokenRequestBody();
+            String request = "POST " + _accessTokenPath + "/device/v1/certificate HTTP/1.0\r\n" +
+                             "Host: " + _accessTokenHost + (_accessTokenPort != 80 ? ":" + String(_accessTokenPort) : String()) + "\r\n" +
+                             "Content-Type: application/json\r\n" +
+                             "Project-Key: " + _projectKey + "\r\n" +
+                             "Content-Length: " + String(body.length()) + "\r\n\r\n" + body;
+            if (_httpTransport.write((const uint8_t *)request.c_str(), request.length()) != request.length())
+            {
+                onAccessTokenFetchFailed("CONNECTION_LOST");
+                break;
+            }
+            _accessTokenResponse.clear();
+            _accessTokenHeadersRead = false;
+            _accessTokenFetchState = TOKEN_FETCH_RESPONSE;
+            _accessTokenFetchStepMillis = millis();
+        }
+        break;
+    }
+
+    case TOKEN_FETCH_RESPONSE:
+    {
+        int available;
+        while ((available = _httpTransport.available()) > 0)
+        {
+            uint8_t buffer[64];
+            int count = _httpTransport.read(buffer, available < (int)sizeof(buffer) ? available : sizeof(buffer));
+            if (count <= 0)
+                break;
+            _accessTokenResponse.insert(_accessTokenResponse.end(), buffer, buffer + count);
+
+            // The headers are dropped once complete, then the limit applies to the body alone
+            if (!_accessTokenHeadersRead && !readAccessTokenResponseHeaders())
+                return;
+            if (_accessTokenResponse.size() > (_accessTokenHeadersRead ? ACCESS_TOKEN_RESPONSE_MAX_SIZE : ACCESS_TOKEN_HEADERS_MAX_SIZE))
+            {
+                onAccessTokenFetchFailed("RESPONSE_TOO_LARGE");
+                return;
+            }
+        }
+
+        if (_httpTransport.connected())
+        {
+            if (elapsed >= ACCESS_TOKEN_RESPONSE_TIMEOUT)
+                onAccessTokenFetchFailed("RESPONSE_TIMEOUT");
+            break;
+        }
+
+        if (!_accessTokenHeadersRead)
+        {
+            onAccessTokenFetchFailed("BAD_RESPONSE");
+            break;
+        }
+        _accessTokenResponse.push_back('\0');
+        if (!parseAccessTokenResponse(_accessTokenResponse.data()))
+        {
+            onAccessTokenFetchFailed("REFUSED");
+            break;
+        }
+
+        _accessTokenFetchState = TOKEN_FETCH_IDLE;
+        _httpTransport.stop();
+        std::vector<char>().swap(_accessTokenResponse);
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+// Once the headers of the AccessToken response are complete, check the status code then keep only the body.
+// Return false if the request failed, it is then already reported.
+bool ThingsCloudMQTT::readAccessTokenResponseHeaders()
+{
+    static const char headersEnd[] = "\r\n\r\n";
+    std::vector<char>::iterator body = std::search(_accessTokenResponse.begin(), _accessTokenResponse.end(), headersEnd, headersEnd + 4);
+    if (body == _accessTokenResponse.end())
+        return true;
+
+    // "HTTP/1.x 200 OK"
+    const char *response = _accessTokenResponse.data();
+    int statusCode = 0;
+    if (body - _accessTokenResponse.begin() >= 12 && strncmp(response, "HTTP/1.", 7) == 0 && response[8] == ' ')
+    {
+        for (int i = 9; i < 12 && isdigit((unsigned char)response[i]); i++)
+            statusCode = statusCode * 10 + (response[i] - '0');
+    }
+    if (statusCode < 100)
+    {
+        onAccessTokenFetchFailed("BAD_RESPONSE");
+        return false;
+    }
+    if (statusCode < 200 || statusCode > 299)
+    {
+        String reason = "HTTP_STATUS_" + String(statusCode);
+        onAccessTokenFetchFailed(reason.c_str());
+        return false;
+    }
+
+    _accessTokenResponse.erase(_accessTokenResponse.begin(), body + 4);
+    _accessTokenHeadersRead = true;
+    return true;
+}
+
+void ThingsCloudMQTT::onAccessTokenFetchFailed(const char *reason)
+{
+    _accessTokenFetchState = TOKEN_FETCH_IDLE;
+    _httpTransport.stop();
+    std::vector<char>().swap(_accessTokenResponse);
+
+    unsigned long retryDelay = getRetryDelay(RECONNECT_ACCESS_TOKEN, ++_failedAccessTokenFetchCount);
+    _nextAccessTokenFetchAttemptMillis = millis() + retryDelay;
+    if (_enableSerialLogs)
+        Serial.printf("AccessToken request failed (%fs), reason: %s, retrying in %.1f seconds.\n", millis() / 1000.0, reason, retryDelay / 1000.0);
+}
+
+void ThingsCloudMQTT::setCustomerId(const String customerId)
+{
+    _customerId = customerId;
+    if (_enableSerialLogs)
+        Serial.printf("Set customerId -> %s\n", _customerId.c_str());
+}
+
+// =============== Main loop / connection state handling =================
+
+void ThingsCloudMQTT::loop()
+{
+    // WIFI handling
+    bool wifiStateChanged = handleWiFi();
+
+    // If there is a change in the wifi connection state, don't handle the mqtt connection state right away.
+    // We will wait at least one lopp() call. This prevent the library from doing too much thing in the same loop() call.
+    if (wifiStateChanged)
+        return;
+
+    // Fetch AccessToken. The MQTT connection goes on meanwhile, up to the opened socket, and sends CONNECT once it is granted.
+    if (!isWifiConnected())
+        return;
+    if (_needFetchAccessToken && !_accessTokenFetched)
+    {
+        if (_accessTokenFetchState != TOKEN_FETCH_IDLE)
+            processAccessTokenFetch();
+        else if (_nextAccessTokenFetchAttemptMillis == 0 || millis() >= _nextAccessTokenFetchAttemptMillis)
+        {
+            // Over its own connection for http endpoints, through HTTPClient for the others (blocking)
+            if (strncmp(_apiEndpoint, "http://", strlen("http://")) == 0)
+                beginAccessTokenFetch();
+            else if (!fetchDeviceAccessToken())
+                onAccessTokenFetchFailed("HTTP_FAILED");
+        }
+    }
+
+    // MQTT Handling
+    bool mqttStateChanged = handleMQTT();
+    if (mqttStateChanged)
+        return;
+
+    // Report the attributes held back by their minimum interval, and the heartbeats
+    if (!_reportedAttributeList.empty())
+        processReportedAttributes();
+
+    // Report the staged attributes once the window is over
+    if (_pendingAttributes && millis() >= _pendingAttributesFlushMillis)
+        flushAttributes();
+
+    // Complete the acknowledged QoS 1 messages, send again the others once their retry delay is over
+    if (!_inFlightList.empty() && isConnected())
+        processInFlight();
+
+    // Send the messages kept while disconnected
+    if (!_outbox.isEmpty() && isConnected() && millis() >= _nextOutboxDrainMillis)
+        processOutbox();
+
+    // Dispatch the queued inbound messages
+    if (!_inboundQueueSlots.empty())
+        processInboundQueue();
+
+    // Dispatch the coalesced attributes once the window is over
+    if (_attributesPushPending && millis() >= _attributesPushFlushMillis)
+        flushAttributesPush();
+
+    // Procewss the delayed execution commands
+    processDelayedExecutionRequests();
+}
+
+bool ThingsCloudMQTT::handleWiFi()
+{
+    // When it's the first call, reset the wifi radio and schedule the wifi connection.
+    // A connection already made by the sketch, like ThingsCloudWiFiManager::autoConnect(), is kept.
+    static bool firstLoopCall = true;
+    if (_handleWiFi && firstLoopCall)
+    {
+        firstLoopCall = false;
+        if (WiFi.status() != WL_CONNECTED)
+        {
+            // Drawn below WIFI_RETRY_BASE_DELAY, so that the devices powered on together do not join the access point in step.
+            // At least 1, as 0 means that no attempt is planned.
+            WiFi.disconnect(true);
+            _nextWifiConnectionAttemptMillis = millis() + getRetryDelay(RECONNECT_WIFI, 1) + 1;
+            return true;
+        }
+    }
+
+    // Get the current connextion status
+    bool isWifiConnected = (WiFi.status() == WL_CONNECTED);
+
+    /***** Detect ans handle the current WiFi handling state *****/
+
+    // Connection established
+    if (isWifiConnected && !_wifiConnected)
+    {
+        onWiFiConnectionEstablished();
+        _connectingToWifi = false;
+        _failedWifiConnectionAttemptCount = 0;
+        resolveHostsEarly();
+
+        // At least 500 miliseconds of waiting before an mqtt connection attempt.
+        // Some people have reported instabilities when trying to connect to
+        // the mqtt broker right after being connected to wifi.
+        // This delay prevent these instabilities. The jitter spreads the devices reconnecting to the same access point,
+        // it is left out of the first connection after power-on so that it does not delay the first publish.
+        _nextMqttConnectionAttemptMillis = millis() + 500 + (_wifiConnectedBefore ? getRetryDelay(RECONNECT_MQTT, 0) : 0);
+        _nextAccessTokenFetchAttemptMillis = millis() + 500 + (_wifiConnectedBefore ? getRetryDelay(RECONNECT_ACCESS_TOKEN, 0) : 0);
+        _wifiConnectedBefore = true;
+    }
+
+    // Connection in progress
+    else if (_connectingToWifi)
+    {
+        if (WiFi.status() == WL_CONNECT_FAILED || millis() - _lastWifiConnectiomAttemptMillis >= _wifiReconnectionAttemptDelay)
         {
             if (_enableSerialLogs)
                 Serial.printf("WiFi! Connection attempt failed, delay expired. (%fs). \n", millis() / 1000.0);
 
             WiFi.disconnect(true);
-            _nextWifiConnectionAttemptMillis = millis() + 500;
+            _nextWifiConnectionAttemptMillis = millis() + getRetryDelay(RECONNECT_WIFI, ++_failedWifiConnectionAttemptCount);
             _connectingToWifi = false;
         }
     }
@@ -249,7 +913,7 @@ bool ThingsCloudMQTT::handleWiFi()
         onWiFiConnectionLost();
 
         if (_handleWiFi)
-            _nextWifiConnectionAttemptMillis = millis() + 500;
+            _nextWifiConnectionAttemptMillis = millis() + getRetryDelay(RECONNECT_WIFI, 0);
     }
 
     // Connected since at least one loop() call
@@ -299,51 +963,26 @@ bool ThingsCloudMQTT::handleMQTT()
     else if (!isMqttConnected && _mqttConnected)
     {
         onMQTTConnectionLost();
-        _nextMqttConnectionAttemptMillis = millis() + _mqttReconnectionAttemptDelay;
     }
 
-    // It's time to  connect to the MQTT broker
-    else if (isWifiConnected() && _nextMqttConnectionAttemptMillis > 0 && millis() >= _nextMqttConnectionAttemptMillis)
+    // It's time to  connect to the MQTT broker. Not while the AccessToken request waits for its retry, the socket would only idle.
+    else if (isWifiConnected() && _nextMqttConnectionAttemptMillis > 0 && millis() >= _nextMqttConnectionAttemptMillis &&
+             (!_needFetchAccessToken || _accessTokenFetched || _accessTokenFetchState != TOKEN_FETCH_IDLE))
     {
-        // Connect to MQTT broker
-        if (connectToMqttBroker())
-        {
-            _failedMQTTConnectionAttemptCount = 0;
-            _nextMqttConnectionAttemptMillis = 0;
-        }
+        // Start the connection steps, the next loop() calls carry them on
+        _nextMqttConnectionAttemptMillis = 0;
+        connectToMqttBroker();
+    }
+
+    // Connection in progress, given up when the WiFi is lost as a new attempt is planned once reconnected
+    else if (_mqttConnectState != MQTT_CONNECT_IDLE)
+    {
+        if (isWifiConnected())
+            processMqttConnection();
         else
         {
-            // Connection failed, plan another connection attempt
-            _nextMqttConnectionAttemptMillis = millis() + _mqttReconnectionAttemptDelay;
-            _mqttClient.disconnect();
-            _failedMQTTConnectionAttemptCount++;
-
-            if (_enableSerialLogs)
-                Serial.printf("MQTT!: Failed MQTT connection count: %i \n", _failedMQTTConnectionAttemptCount);
-
-            // When there is too many failed attempt, sometimes it help to reset the WiFi connection or to restart the board.
-            if (_handleWiFi && _failedMQTTConnectionAttemptCount == 8)
-            {
-                if (_enableSerialLogs)
-                    Serial.println("MQTT!: Can't connect to broker after too many attempt, resetting WiFi ...");
-
-                WiFi.disconnect(true);
-                _nextWifiConnectionAttemptMillis = millis() + 500;
-
-                if (!_drasticResetOnConnectionFailures)
-                    _failedMQTTConnectionAttemptCount = 0;
-            }
-            else if (_drasticResetOnConnectionFailures && _failedMQTTConnectionAttemptCount == 12) // Will reset after 12 failed attempt (3 minutes of retry)
-            {
-                if (_enableSerialLogs)
-                    Serial.println("MQTT!: Can't connect to broker after too many attempt, resetting board ...");
-
-#ifdef ESP8266
-                ESP.reset();
-#else
-                ESP.restart();
-#endif
-            }
+            _mqttConnectState = MQTT_CONNECT_IDLE;
+            _mqttTransport.stop();
         }
     }
 
@@ -388,16 +1027,30 @@ void ThingsCloudMQTT::onWiFiConnectionLost()
 
 void ThingsCloudMQTT::onMQTTConnectionEstablished()
 {
+    // A new session, the broker does not acknowledge the given up messages anymore
+    _quarantinedPacketIds.clear();
     _connectionEstablishedCount++;
+    resubscribeAll();
     _onMQTTConnect();
 }
 
 void ThingsCloudMQTT::onMQTTConnectionLost()
 {
+    // A fast first retry, the drop is often transient
+    unsigned long retryDelay = getRetryDelay(RECONNECT_MQTT, 0);
+    _nextMqttConnectionAttemptMillis = millis() + retryDelay;
+
+    for (std::size_t i = 0; i < _topicSubscriptionList.size(); i++)
+        _topicSubscriptionList[i].subscribed = false;
+
+    // The QoS 1 messages waiting for their PUBACK are sent again as soon as reconnected
+    for (std::size_t i = 0; i < _inFlightList.size(); i++)
+        _inFlightList[i].sentMillis = millis() - _inFlightRetryMillis;
+
     if (_enableSerialLogs)
     {
         Serial.printf("MQTT! Lost connection (%fs). \n", millis() / 1000.0);
-        Serial.printf("MQTT: Retrying to connect in %i seconds. \n", _mqttReconnectionAttemptDelay / 1000);
+        Serial.printf("MQTT: Retrying to connect in %.1f seconds. \n", retryDelay / 1000.0);
     }
 
     if (_enableMQTTDisconnectCallback)
@@ -413,6 +1066,10 @@ bool ThingsCloudMQTT::setMaxPacketSize(const uint16_t size)
 
     bool success = _mqttClient.setBufferSize(size);
 
+    // The outbox messages are streamed, only their topic has to fit in the buffer
+    if (success)
+        _outbox.setMaxTopicLength(size > MQTT_MAX_HEADER_SIZE + 2 ? size - MQTT_MAX_HEADER_SIZE - 2 : 0);
+
     if (!success && _enableSerialLogs)
         Serial.println("MQTT! failed to set the max packet size.");
 
@@ -424,313 +1081,1442 @@ bool ThingsCloudMQTT::reportAttributes(const String attributes)
     return publish("attributes", attributes);
 }
 
-bool ThingsCloudMQTT::reportEvent(const uint16_t id, const String event)
+bool ThingsCloudMQTT::reportAttributes(const char *attributes, const size_t length)
 {
-    return publish("event/report/" + String(id), event);
+    return publishPayload("attributes", (const uint8_t *)attributes, length, false, false);
 }
 
-bool ThingsCloudMQTT::reportData(const String &topic, const String &payload)
+bool ThingsCloudMQTT::reportAttributes(const JsonDocument &attributes)
 {
-    return publish(topic, payload);
+    return publish("attributes", attributes);
 }
 
-bool ThingsCloudMQTT::reportData(const String &topic, const uint8_t *payload, unsigned int plength)
+ThingsCloudAttributesBuilder &ThingsCloudMQTT::beginAttributes()
 {
-    return publish(topic, payload, plength);
+    return beginData("attributes");
 }
 
-bool ThingsCloudMQTT::getAttributes()
+ThingsCloudAttributesBuilder &ThingsCloudMQTT::beginAttributes(char *buffer, const size_t size)
 {
-    return publish("attributes/get/1000", "{}");
+    return beginData("attributes", buffer, size);
 }
 
-bool ThingsCloudMQTT::onAttributesGetResponse(MessageReceivedCallbackWithTopic messageReceivedCallbackWithTopic)
+ThingsCloudAttributesBuilder &ThingsCloudMQTT::beginData(const char *topic)
 {
-    return subscribe("attributes/get/response/+", messageReceivedCallbackWithTopic);
+    char *buffer = reportBuilderBuffer();
+    return beginData(topic, buffer, _attributesBuilderBuffer.size());
 }
 
-bool ThingsCloudMQTT::onAttributesGetResponse(MessageReceivedCallbackJSONWithTopic messageReceivedCallbackWithTopic)
+ThingsCloudAttributesBuilder &ThingsCloudMQTT::beginData(const char *topic, char *buffer, const size_t size)
 {
-    return subscribe("attributes/get/response/+", messageReceivedCallbackWithTopic);
+    _attributesBuilder.begin(this, buffer, size, topic);
+    return _attributesBuilder;
 }
 
-bool ThingsCloudMQTT::onAttributesResponse(MessageReceivedCallback messageReceivedCallback)
+// Defined with the client, so that the builder itself does not depend on it
+bool ThingsCloudAttributesBuilder::send()
 {
-    return subscribe("attributes/response", messageReceivedCallback);
-}
+    if (_client == nullptr)
+        return false;
 
-bool ThingsCloudMQTT::onAttributesPush(MessageReceivedCallback messageReceivedCallback)
-{
-    return subscribe("attributes/push", messageReceivedCallback);
-}
+    close();
+    if (_overflowed)
+    {
+        if (_client->_enableSerialLogs)
+            Serial.printf("MQTT! [%s] payload larger than the %u bytes buffer, skipping.\n", _topic, (unsigned int)_size);
+        return false;
+    }
 
-bool ThingsCloudMQTT::onAttributesPush(MessageReceivedCallbackJSON messageReceivedCallback)
-{
-    return subscribe("attributes/push", messageReceivedCallback);
+    return _client->publishPayload(_topic, (const uint8_t *)_buffer, _length, false, false);
 }
 
-bool ThingsCloudMQTT::onCommandSend(MessageReceivedCallbackWithTopic messageReceivedCallbackWithTopic)
+ThingsCloudMsgPackBuilder &ThingsCloudMQTT::beginDataMsgPack(const char *topic)
 {
-    return subscribe("command/send/+", messageReceivedCallbackWithTopic);
+    uint8_t *buffer = (uint8_t *)reportBuilderBuffer();
+    return beginDataMsgPack(topic, buffer, _attributesBuilderBuffer.size());
 }
 
-bool ThingsCloudMQTT::onCommandSend(MessageReceivedCallbackJSONWithTopic messageReceivedCallbackWithTopic)
+ThingsCloudMsgPackBuilder &ThingsCloudMQTT::beginDataMsgPack(const char *topic, uint8_t *buffer, const size_t size)
 {
-    return subscribe("command/send/+", messageReceivedCallbackWithTopic);
+    _msgPackBuilder.begin(this, buffer, size, topic);
+    return _msgPackBuilder;
 }
 
-bool ThingsCloudMQTT::publish(const String &topic, const String &payload, bool retain)
+// Defined with the client, so that the builder itself does not depend on it
+bool ThingsCloudMsgPackBuilder::send()
 {
-    // Do not try to publish if MQTT is not connected.
-    if (!isConnected())
-    {
-        if (_enableSerialLogs)
-            Serial.println("MQTT! Trying to publish when disconnected, skipping.");
-
+    if (_client == nullptr)
         return false;
-    }
 
-    bool success = _mqttClient.publish(topic.c_str(), payload.c_str(), retain);
-
-    if (_enableSerialLogs)
+    close();
+    if (_overflowed)
     {
-        if (success)
-            Serial.printf("MQTT << [%s] %s\n", topic.c_str(), payload.c_str());
-        else
-            Serial.println("MQTT! publish failed, is the message too long ? (see setMaxPacketSize())"); // This can occurs if the message is too long according to the maximum defined in PubsubClient.h
+        if (_client->_enableSerialLogs)
+            Serial.printf("MQTT! [%s] payload larger than the %u bytes buffer, skipping.\n", _topic, (unsigned int)_size);
+        return false;
     }
 
-    return success;
+    return _client->publishPayload(_topic, _buffer, _length, false, true);
 }
 
-bool ThingsCloudMQTT::publish(const String &topic, const uint8_t *payload, unsigned int plength)
+void ThingsCloudMQTT::setAttributesBufferSize(const size_t size)
 {
-    // Do not try to publish if MQTT is not connected.
-    if (!isConnected())
-    {
-        if (_enableSerialLogs)
-            Serial.println("MQTT! Trying to publish when disconnected, skipping.");
-
-        return false;
-    }
-
-    bool success = _mqttClient.publish(topic.c_str(), payload, plength);
+    _attributesBuilderBufferSize = size;
+}
 
-    if (_enableSerialLogs)
-    {
-        if (success)
-            Serial.printf("MQTT << [%s] (HEX)0x%s\n", topic.c_str(), bytesToHex(payload, plength).c_str());
-        else
-            Serial.println("MQTT! publish failed, is the message too long ? (see setMaxPacketSize())"); // This can occurs if the message is too long according to the maximum defined in PubsubClient.h
-    }
+void ThingsCloudMQTT::enableAttributesCoalescing(const unsigned long windowMillis, const size_t maxBytes, const size_t capacity)
+{
+    if (_pendingAttributes)
+        flushAttributes();
 
-    return success;
+    _pendingAttributesDoc = DynamicJsonDocument(capacity);
+    _pendingAttributesWindow = windowMillis;
+    _pendingAttributesMaxBytes = maxBytes;
 }
 
-bool ThingsCloudMQTT::subscribe(const String &topic, MessageReceivedCallback messageReceivedCallback, uint8_t qos)
+bool ThingsCloudMQTT::flushAttributes()
 {
-    // Do not try to subscribe if MQTT is not connected.
-    if (!isConnected())
-    {
-        if (_enableSerialLogs)
-            Serial.println("MQTT! Trying to subscribe when disconnected, skipping.");
-
-        return false;
-    }
+    if (!_pendingAttributes)
+        return true;
 
-    bool success = _mqttClient.subscribe(topic.c_str(), qos);
+    String attributes;
+    serializeJson(_pendingAttributesDoc, attributes);
+    bool success = reportAttributes(attributes);
 
+    // Kept staged when the report failed, another attempt is made at the end of the next window
     if (success)
     {
-        // Add the record to the subscription list only if it does not exists.
-        bool found = false;
-        for (std::size_t i = 0; i < _topicSubscriptionList.size() && !found; i++)
-            found = _topicSubscriptionList[i].topic.equals(topic);
-
-        if (!found)
-            _topicSubscriptionList.push_back({topic, messageReceivedCallback, NULL});
-    }
-
-    if (_enableSerialLogs)
-    {
-        if (success)
-            Serial.printf("MQTT: Subscribed to [%s]\n", topic.c_str());
-        else
-            Serial.println("MQTT! subscribe failed");
+        _pendingAttributesDoc.clear();
+        _pendingAttributes = false;
     }
+    else
+        _pendingAttributesFlushMillis = millis() + _pendingAttributesWindow;
 
     return success;
 }
 
-bool ThingsCloudMQTT::subscribe(const String &topic, MessageReceivedCallbackJSON messageReceivedCallback, uint8_t qos)
+void ThingsCloudMQTT::setAttributeReporting(const char *key, const double deadband, const DeadbandType deadbandType, const unsigned long minIntervalMillis, const unsigned long maxSilenceMillis)
 {
-    if (subscribe(topic, (MessageReceivedCallback)NULL, qos))
+    ReportedAttributeRecord record;
+    record.keyHash = hashKey(key, strlen(key));
+    record.key = key;
+    record.deadband = deadband;
+    record.deadbandType = deadbandType;
+    record.minIntervalMillis = minIntervalMillis;
+    record.maxSilenceMillis = maxSilenceMillis;
+    record.value = 0;
+    record.reportedValue = 0;
+    record.reportedMillis = 0;
+    record.hasValue = false;
+    record.reported = false;
+
+    int i = findKeyedHandler(_reportedAttributeList, key, strlen(key));
+    if (i >= 0 && _reportedAttributeList[i].hasValue)
     {
-        _topicSubscriptionList[_topicSubscriptionList.size() - 1].callbackJSON = messageReceivedCallback;
-        return true;
+        // Keep the reporting state when the settings are changed
+        record.value = _reportedAttributeList[i].value;
+        record.reportedValue = _reportedAttributeList[i].reportedValue;
+        record.reportedMillis = _reportedAttributeList[i].reportedMillis;
+        record.hasValue = true;
+        record.reported = _reportedAttributeList[i].reported;
     }
-    return false;
+    insertKeyedHandler(_reportedAttributeList, record);
 }
 
-bool ThingsCloudMQTT::subscribe(const String &topic, MessageReceivedCallbackWithTopic messageReceivedCallback, uint8_t qos)
+bool ThingsCloudMQTT::updateAttribute(const char *key, const double value)
 {
-    if (subscribe(topic, (MessageReceivedCallback)NULL, qos))
+    int i = findKeyedHandler(_reportedAttributeList, key, strlen(key));
+    if (i < 0)
     {
-        _topicSubscriptionList[_topicSubscriptionList.size() - 1].callbackWithTopic = messageReceivedCallback;
-        return true;
+        if (_enableSerialLogs)
+            Serial.printf("MQTT! updateAttribute(): no reporting set for [%s] (see setAttributeReporting())\n", key);
+        return false;
     }
-    return false;
+
+    ReportedAttributeRecord &record = _reportedAttributeList[i];
+    record.value = value;
+    record.hasValue = true;
+
+    if (!isAttributeReportDue(record, millis()))
+        return true;
+
+    record.reportedValue = value;
+    record.reportedMillis = millis();
+    record.reported = true;
+    stageAttribute(record.key.c_str(), value);
+    return onAttributeStaged();
+}
+
+bool ThingsCloudMQTT::reportEvent(const uint16_t id, const String event)
+{
+    return publish("event/report/" + String(id), event);
+}
+
+bool ThingsCloudMQTT::reportEvent(const uint16_t id, const String event, PublishCompleteCallback callback)
+{
+    return publishQoS1("event/report/" + String(id), event, callback) != 0;
+}
+
+bool ThingsCloudMQTT::reportData(const String &topic, const String &payload)
+{
+    return publish(topic, payload);
+}
+
+bool ThingsCloudMQTT::reportData(const String &topic, const uint8_t *payload, unsigned int plength)
+{
+    return publish(topic, payload, plength);
+}
+
+bool ThingsCloudMQTT::getAttributes()
+{
+    return publish("attributes/get/1000", "{}");
+}
+
+bool ThingsCloudMQTT::onAttributesGetResponse(MessageReceivedCallbackWithTopic messageReceivedCallbackWithTopic)
+{
+    return subscribe("attributes/get/response/+", messageReceivedCallbackWithTopic);
+}
+
+bool ThingsCloudMQTT::onAttributesGetResponse(MessageReceivedCallbackJSONWithTopic messageReceivedCallbackWithTopic)
+{
+    return subscribe("attributes/get/response/+", messageReceivedCallbackWithTopic);
+}
+
+bool ThingsCloudMQTT::onAttributesResponse(MessageReceivedCallback messageReceivedCallback)
+{
+    return subscribe("attributes/response", messageReceivedCallback);
+}
+
+bool ThingsCloudMQTT::onAttributesPush(MessageReceivedCallback messageReceivedCallback)
+{
+    return subscribe("attributes/push", messageReceivedCallback);
+}
+
+bool ThingsCloudMQTT::onAttributesPush(MessageReceivedCallbackJSON messageReceivedCallback)
+{
+    return subscribe("attributes/push", messageReceivedCallback);
+}
+
+bool ThingsCloudMQTT::onCommandSend(MessageReceivedCallbackWithTopic messageReceivedCallbackWithTopic)
+{
+    return subscribe("command/send/+", messageReceivedCallbackWithTopic);
+}
+
+bool ThingsCloudMQTT::onCommandSend(MessageReceivedCallbackJSONWithTopic messageReceivedCallbackWithTopic)
+{
+    return subscribe("command/send/+", messageReceivedCallbackWithTopic);
+}
+
+bool ThingsCloudMQTT::onCommand(const String &method, CommandReceivedCallback commandReceivedCallback)
+{
+    insertKeyedHandler(_commandHandlerList, {hashKey(method.c_str(), method.length()), method, commandReceivedCallback});
+
+    // A single subscription serves every method
+    return subscribeDecoder("command/send/+", DECODER_COMMAND_ROUTER, [this](const char *topic, const uint8_t *payload, size_t length)
+                            { this->dispatchCommand(topic, payload, length); });
+}
+
+bool ThingsCloudMQTT::onAttribute(const String &key, AttributeReceivedCallback attributeReceivedCallback)
+{
+    insertKeyedHandler(_attributeHandlerList, {hashKey(key.c_str(), key.length()), key, attributeReceivedCallback});
+
+    // A single subscription serves every attribute, also route the replies to getAttributes()
+    return subscribeDecoder("attributes/push", DECODER_ATTRIBUTE_ROUTER, [this](const char *topic, const uint8_t *payload, size_t length)
+                            { this->dispatchAttributes((const char *)payload, length); }) &&
+           subscribeDecoder("attributes/get/response/+", DECODER_ATTRIBUTE_ROUTER, [this](const char *topic, const uint8_t *payload, size_t length)
+                            { this->dispatchAttributesGetResponse((const char *)payload, length); });
+}
+
+bool ThingsCloudMQTT::publish(const String &topic, const String &payload, bool retain)
+{
+    return publishPayload(topic.c_str(), (const uint8_t *)payload.c_str(), payload.length(), retain, false);
+}
+
+bool ThingsCloudMQTT::publish(const String &topic, const uint8_t *payload, unsigned int plength)
+{
+    return publishPayload(topic.c_str(), payload, plength, false, true);
+}
+
+bool ThingsCloudMQTT::publishCompressed(const String &topic, const uint8_t *payload, unsigned int plength, bool retain)
+{
+    size_t size = ThingsCloudLZSS::maxCompressedSize(plength);
+    if (_compressBuffer.size() < size)
+        _compressBuffer.resize(size);
+
+    size_t length = ThingsCloudLZSS::compress(payload, plength, _compressBuffer.data(), _compressBuffer.size());
+    if (length == 0)
+    {
+        if (_enableSerialLogs)
+            Serial.printf("MQTT! [%s] payload too large to compress (%u bytes), skipping.\n", topic.c_str(), plength);
+        return false;
+    }
+
+    if (_enableSerialLogs)
+        Serial.printf("MQTT: [%s] compressed %u bytes to %u bytes.\n", topic.c_str(), plength, (unsigned int)length);
+    return publishPayload(topic.c_str(), _compressBuffer.data(), length, retain, true);
+}
+
+bool ThingsCloudMQTT::publishCompressed(const String &topic, const String &payload, bool retain)
+{
+    return publishCompressed(topic, (const uint8_t *)payload.c_str(), payload.length(), retain);
+}
+
+uint16_t ThingsCloudMQTT::publishQoS1(const String &topic, const uint8_t *payload, unsigned int plength, PublishCompleteCallback callback, bool retain)
+{
+    if (_inFlightList.size() >= _inFlightWindow)
+    {
+        if (_enableSerialLogs)
+            Serial.printf("MQTT! [%s] QoS 1 in-flight window full (%u messages), skipping.\n", topic.c_str(), _inFlightWindow);
+        return 0;
+    }
+
+    // Sent right away when connected, unless older messages of the same or a higher class are still waiting
+    PublishPriority priority = getPublishPriority(topic.c_str());
+    bool sendNow = isConnected() && _outbox.getCount(priority) == 0 && (_inFlightList.empty() || _inFlightList.back().attempts > 0);
+    RateLimitPolicy policy;
+    if (sendNow && !takePublishToken(topic.c_str(), policy))
+    {
+        if (policy == RATE_LIMIT_DROP)
+        {
+            onRateLimited(topic.c_str(), nullptr, 0, retain, RATE_LIMIT_DROP);
+            return 0;
+        }
+
+        // Each QoS 1 message has its own packet id and callback, coalescing queues it as well
+        _rateLimitQueuedCount++;
+        sendNow = false;
+    }
+
+    // PUBLISH fixed header, topic, packet id and payload
+    size_t remainingLength = 2 + topic.length() + 2 + plength;
+    InFlightMessage message;
+    message.packetId = nextPacketId();
+    message.topic = topic;
+    message.priority = priority;
+    message.packet.reserve(5 + remainingLength);
+    message.packet.push_back(0x32 | (retain ? 0x01 : 0x00));
+    do
+    {
+        uint8_t digit = remainingLength % 128;
+        remainingLength /= 128;
+        message.packet.push_back(remainingLength > 0 ? digit | 0x80 : digit);
+    } while (remainingLength > 0);
+    message.packet.push_back(topic.length() >> 8);
+    message.packet.push_back(topic.length() & 0xFF);
+    message.packet.insert(message.packet.end(), topic.c_str(), topic.c_str() + topic.length());
+    message.packet.push_back(message.packetId >> 8);
+    message.packet.push_back(message.packetId & 0xFF);
+    message.packet.insert(message.packet.end(), payload, payload + plength);
+    message.sentMillis = 0;
+    message.attempts = 0;
+    message.callback = callback;
+
+    // Otherwise sent by processInFlight()
+    if (sendNow && _mqttClient.write(message.packet.data(), message.packet.size()) == message.packet.size())
+    {
+        message.attempts = 1;
+        message.sentMillis = millis();
+        if (_enableSerialLogs)
+            Serial.printf("MQTT << [%s] QoS 1 #%u %u bytes\n", topic.c_str(), message.packetId, plength);
+    }
+
+    _inFlightList.push_back(message);
+    return message.packetId;
+}
+
+uint16_t ThingsCloudMQTT::publishQoS1(const String &topic, const String &payload, PublishCompleteCallback callback, bool retain)
+{
+    return publishQoS1(topic, (const uint8_t *)payload.c_str(), payload.length(), callback, retain);
+}
+
+void ThingsCloudMQTT::setInFlightWindow(const uint8_t window, const unsigned long retryMillis, const uint8_t maxAttempts)
+{
+    _inFlightWindow = window;
+    _inFlightRetryMillis = retryMillis;
+    _inFlightMaxAttempts = maxAttempts;
+}
+
+bool ThingsCloudMQTT::publish(const String &topic, const JsonDocument &doc, bool retain)
+{
+    size_t length = measureJson(doc);
+
+    // The outbox keeps a serialized copy of the message
+    if (_outbox.isEnabled() && (!isConnected() || _outbox.getCount(getPublishPriority(topic.c_str())) > 0))
+    {
+        std::vector<uint8_t> payload(length + 1);
+        serializeJson(doc, (char *)payload.data(), payload.size());
+        return pushOutbox(topic.c_str(), payload.data(), length, retain);
+    }
+
+    if (!isConnected())
+    {
+        if (_enableSerialLogs)
+            Serial.println("MQTT! Trying to publish when disconnected, skipping.");
+
+        return false;
+    }
+
+    RateLimitPolicy policy;
+    if (!takePublishToken(topic.c_str(), policy))
+    {
+        if (policy == RATE_LIMIT_DROP || !_outbox.isEnabled())
+            return onRateLimited(topic.c_str(), nullptr, 0, retain, RATE_LIMIT_DROP);
+
+        std::vector<uint8_t> payload(length + 1);
+        serializeJson(doc, (char *)payload.data(), payload.size());
+        return onRateLimited(topic.c_str(), payload.data(), length, retain, policy);
+    }
+
+    if (!_mqttClient.beginPublish(topic.c_str(), length, retain))
+    {
+        if (_enableSerialLogs)
+            Serial.println("MQTT! publish failed, unable to write the message header.");
+        return false;
+    }
+
+    MqttChunkWriter writer(_mqttClient);
+    serializeJson(doc, writer);
+
+    // The broker still waits for the rest of the message, the connection can not be used anymore
+    if (!writer.flushChunk() || writer.written() != length)
+    {
+        if (_enableSerialLogs)
+            Serial.printf("MQTT! publish aborted after %u of %u bytes, closing the connection.\n", (unsigned int)writer.written(), (unsigned int)length);
+        _mqttClient.disconnect();
+        return false;
+    }
+
+    bool success = _mqttClient.endPublish() > 0;
+
+    if (_enableSerialLogs && success)
+    {
+        Serial.printf("MQTT << [%s] ", topic.c_str());
+        serializeJson(doc, Serial);
+        Serial.println();
+    }
+
+    return success;
+}
+
+bool ThingsCloudMQTT::publish(const String &topic, Stream &stream, const size_t length, bool retain)
+{
+    return publish(topic, length, [&stream](uint8_t *buffer, size_t size)
+                   { return stream.readBytes(buffer, size); },
+                   retain);
+}
+
+bool ThingsCloudMQTT::publish(const String &topic, const size_t length, PublishChunkCallback chunkCallback, bool retain)
+{
+    if (!isConnected())
+    {
+        if (_enableSerialLogs)
+            Serial.println("MQTT! Trying to publish when disconnected, skipping.");
+
+        return false;
+    }
+
+    // A streamed payload can not wait in the outbox
+    RateLimitPolicy policy;
+    if (!takePublishToken(topic.c_str(), policy))
+        return onRateLimited(topic.c_str(), nullptr, 0, retain, RATE_LIMIT_DROP);
+
+    if (!_mqttClient.beginPublish(topic.c_str(), length, retain))
+    {
+        if (_enableSerialLogs)
+            Serial.println("MQTT! publish failed, unable to write the message header.");
+        return false;
+    }
+
+    uint8_t chunk[PUBLISH_STREAM_CHUNK_SIZE];
+    size_t sent = 0;
+    while (sent < length)
+    {
+        size_t size = std::min(length - sent, (size_t)PUBLISH_STREAM_CHUNK_SIZE);
+        size_t read = chunkCallback(chunk, size);
+        if (read == 0 || read > size || _mqttClient.write(chunk, read) != read)
+            break;
+        sent += read;
+    }
+
+    // The broker still waits for the rest of the message, the connection can not be used anymore
+    if (sent < length)
+    {
+        if (_enableSerialLogs)
+            Serial.printf("MQTT! publish aborted after %u of %u bytes, closing the connection.\n", (unsigned int)sent, (unsigned int)length);
+        _mqttClient.disconnect();
+        return false;
+    }
+
+    bool success = _mqttClient.endPublish() > 0;
+
+    if (_enableSerialLogs && success)
+        Serial.printf("MQTT << [%s] (STREAM) %u bytes\n", topic.c_str(), (unsigned int)length);
+
+    return success;
+}
+
+bool ThingsCloudMQTT::subscribe(const String &topic, MessageReceivedCallback messageReceivedCallback, uint8_t qos)
+{
+    TopicSubscriptionRecord *record = subscribeTopic(topic, qos);
+    if (record == nullptr)
+        return false;
+
+    record->callback = messageReceivedCallback;
+    return true;
+}
+
+bool ThingsCloudMQTT::subscribe(const String &topic, MessageReceivedCallbackJSON messageReceivedCallback, uint8_t qos)
+{
+    TopicSubscriptionRecord *record = subscribeTopic(topic, qos);
+    if (record == nullptr)
+        return false;
+
+    record->callbackJSON = messageReceivedCallback;
+    return true;
+}
+
+bool ThingsCloudMQTT::subscribe(const String &topic, MessageReceivedCallbackWithTopic messageReceivedCallback, uint8_t qos)
+{
+    TopicSubscriptionRecord *record = subscribeTopic(topic, qos);
+    if (record == nullptr)
+        return false;
+
+    record->callbackWithTopic = messageReceivedCallback;
+    return true;
+}
+
+bool ThingsCloudMQTT::subscribe(const String &topic, MessageReceivedCallbackJSONWithTopic messageReceivedCallback, uint8_t qos)
+{
+    TopicSubscriptionRecord *record = subscribeTopic(topic, qos);
+    if (record == nullptr)
+        return false;
+
+    record->callbackJSONWithTopic = messageReceivedCallback;
+    return true;
+}
+
+bool ThingsCloudMQTT::subscribe(const String &topic, MessageReceivedCallbackView messageReceivedCallback, uint8_t qos)
+{
+    TopicSubscriptionRecord *record = subscribeTopic(topic, qos);
+    if (record == nullptr)
+        return false;
+
+    record->callbackView = messageReceivedCallback;
+    return true;
+}
+
+bool ThingsCloudMQTT::subscribeMsgPack(const String &topic, MessageReceivedCallbackJSON messageReceivedCallback, uint8_t qos)
+{
+    return subscribeDecoder(topic, DECODER_MSGPACK, [this, messageReceivedCallback](const char *topic, const uint8_t *payload, size_t length)
+                            {
+                                if (this->parseInboundJson(payload, length, true))
+                                    messageReceivedCallback(this->_inboundJsonDoc.as<JsonObject>()); },
+                            qos);
+}
+
+bool ThingsCloudMQTT::subscribeCompressed(const String &topic, MessageReceivedCallbackView messageReceivedCallback, uint8_t qos)
+{
+    return subscribeDecoder(topic, DECODER_COMPRESSED, [this, messageReceivedCallback](const char *topic, const uint8_t *payload, size_t length)
+                            {
+                                // Every payload of the subscription is compressed, the header is never taken as a hint
+                                if (!ThingsCloudLZSS::isCompressed(payload, length))
+                                {
+                                    if (this->_enableSerialLogs)
+                                        Serial.printf("MQTT! [%s] payload without compression header, skipping.\n", topic);
+                                    return;
+                                }
+
+                                // The size comes from the network, it is checked before the buffer is grown
+                                size_t size = ThingsCloudLZSS::decompressedSize(payload, length);
+                                size_t maxSize = this->_maxDecompressedSize > 0 ? this->_maxDecompressedSize : this->_mqttClient.getBufferSize();
+                                if (size > maxSize)
+                                {
+                                    if (this->_enableSerialLogs)
+                                        Serial.printf("MQTT! [%s] decompressed payload larger than %u bytes, skipping.\n", topic, (unsigned int)maxSize);
+                                    return;
+                                }
+                                if (this->_decompressBuffer.size() < size + 1)
+                                    this->_decompressBuffer.resize(size + 1);
+
+                                size_t decompressedLength = 0;
+                                if (!ThingsCloudLZSS::decompress(payload, length, this->_decompressBuffer.data(), size, decompressedLength))
+                                {
+                                    if (this->_enableSerialLogs)
+                                        Serial.printf("MQTT! [%s] corrupted compressed payload, skipping.\n", topic);
+                                    return;
+                                }
+
+                                // Terminated like the other inbound payloads, for the callbacks reading it as a string
+                                this->_decompressBuffer[decompressedLength] = '\0';
+                                messageReceivedCallback(topic, this->_decompressBuffer.data(), decompressedLength); },
+                            qos);
+}
+
+bool ThingsCloudMQTT::unsubscribe(const String &topic)
+{
+    // When disconnected, only forget the subscription, it will not be restored on the next connection.
+    if (!isConnected())
+    {
+        for (std::size_t i = 0; i < _topicSubscriptionList.size(); i++)
+        {
+            if (_topicSubscriptionList[i].topic.equals(topic))
+                _topicSubscriptionList[i].removed = true;
+        }
+        eraseRemovedSubscriptions();
+        return true;
+    }
+
+    for (std::size_t i = 0; i < _topicSubscriptionList.size(); i++)
+    {
+        if (_topicSubscriptionList[i].topic.equals(topic) && !_topicSubscriptionList[i].removed)
+        {
+            std::vector<uint8_t> topicFilter;
+            topicFilter.push_back(topic.length() >> 8);
+            topicFilter.push_back(topic.length() & 0xFF);
+            topicFilter.insert(topicFilter.end(), topic.c_str(), topic.c_str() + topic.length());
+            if (writeTopicFiltersPacket(MQTT_PACKET_UNSUBSCRIBE, topicFilter))
+            {
+                _topicSubscriptionList[i].removed = true;
+
+                if (_enableSerialLogs)
+                    Serial.printf("MQTT: Unsubscribed from %s\n", topic.c_str());
+            }
+            else
+            {
+                if (_enableSerialLogs)
+                    Serial.println("MQTT! unsubscribe failed");
+
+                eraseRemovedSubscriptions();
+                return false;
+            }
+        }
+    }
+
+    eraseRemovedSubscriptions();
+    return true;
+}
+
+void ThingsCloudMQTT::setWifiCredentials(const char *wifiSsid, const char *wifiPassword)
+{
+    _wifiSsid = wifiSsid;
+    _wifiPassword = wifiPassword;
+    _handleWiFi = true;
+}
+
+void ThingsCloudMQTT::executeDelayed(const unsigned long delay, DelayedExecutionCallback callback)
+{
+    DelayedExecutionRecord delayedExecutionRecord;
+    delayedExecutionRecord.targetMillis = millis() + delay;
+    delayedExecutionRecord.callback = callback;
+
+    _delayedExecutionList.push_back(delayedExecutionRecord);
+}
+
+// ================== Private functions ====================-
+
+// The decoder has its own slot in the record, so a user callback on the same topic never replaces it.
+// A topic that already has a decoder of another kind is refused, instead of one decoder silently replacing the other.
+bool ThingsCloudMQTT::subscribeDecoder(const String &topic, SubscriptionDecoder decoder, MessageReceivedCallbackView callback, uint8_t qos)
+{
+    for (std::size_t i = 0; i < _topicSubscriptionList.size(); i++)
+    {
+        if (_topicSubscriptionList[i].topic.equals(topic) && !_topicSubscriptionList[i].removed &&
+            _topicSubscriptionList[i].decoder != DECODER_NONE && _topicSubscriptionList[i].decoder != decoder)
+        {
+            if (_enableSerialLogs)
+                Serial.printf("MQTT! [%s] already decoded by another SDK subscription, skipping.\n", topic.c_str());
+            return false;
+        }
+    }
+
+    TopicSubscriptionRecord *record = subscribeTopic(topic, qos);
+    if (record == nullptr)
+        return false;
+
+    record->decoder = decoder;
+    record->callbackDecoder = callback;
+    return true;
+}
+
+// Send the SUBSCRIBE packet and return the subscription record of the topic, creating it if needed.
+// Return nullptr if the subscription failed.
+ThingsCloudMQTT::TopicSubscriptionRecord *ThingsCloudMQTT::subscribeTopic(const String &topic, uint8_t qos)
+{
+    // Add the record to the subscription list only if it does not exists.
+    // A record unsubscribed by the message being dispatched is not reused, a new one replaces it.
+    TopicSubscriptionRecord *record = nullptr;
+    for (std::size_t i = 0; i < _topicSubscriptionList.size() && record == nullptr; i++)
+    {
+        if (_topicSubscriptionList[i].topic.equals(topic) && !_topicSubscriptionList[i].removed)
+            record = &_topicSubscriptionList[i];
+    }
+
+    if (record == nullptr)
+    {
+        TopicSubscriptionRecord newRecord;
+        newRecord.topic = topic;
+        newRecord.qos = qos;
+        newRecord.subscribed = false;
+        newRecord.removed = false;
+        newRecord.decoder = DECODER_NONE;
+        _topicSubscriptionList.push_back(newRecord);
+        _topicTrie.insert(topic, _topicSubscriptionList.size() - 1);
+        record = &_topicSubscriptionList.back();
+    }
+
+    // When disconnected, the subscription is kept and sent with the others once connected
+    if (!isConnected())
+    {
+        if (_enableSerialLogs)
+            Serial.printf("MQTT: Subscription to [%s] will be sent once connected\n", topic.c_str());
+
+        record->qos = qos;
+        return record;
+    }
+
+    // Already subscribed on this connection, typically by the automatic re-subscription
+    if (record->subscribed && record->qos == qos)
+        return record;
+
+    std::vector<uint8_t> topicFilter;
+    topicFilter.push_back(topic.length() >> 8);
+    topicFilter.push_back(topic.length() & 0xFF);
+    topicFilter.insert(topicFilter.end(), topic.c_str(), topic.c_str() + topic.length());
+    topicFilter.push_back(qos);
+    bool success = writeTopicFiltersPacket(MQTT_PACKET_SUBSCRIBE, topicFilter);
+
+    if (_enableSerialLogs)
+    {
+        if (success)
+            Serial.printf("MQTT: Subscribed to [%s]\n", topic.c_str());
+        else
+            Serial.println("MQTT! subscribe failed");
+    }
+
+    if (!success)
+        return nullptr;
+
+    record->qos = qos;
+    record->subscribed = true;
+    return record;
+}
+
+// Restore all the subscriptions on a new connection, with as few SUBSCRIBE packets as the MQTT buffer allows.
+// The packets are written directly, PubSubClient only sends one topic per SUBSCRIBE.
+void ThingsCloudMQTT::resubscribeAll()
+{
+    const std::size_t maxPacketSize = _mqttClient.getBufferSize();
+    std::vector<uint8_t> payload;
+    std::size_t first = 0;
+    std::size_t packetCount = 0;
+
+    for (std::size_t i = 0; i <= _topicSubscriptionList.size(); i++)
+    {
+        // Fixed header (up to 5 bytes) + packet identifier + topic filters
+        bool last = i == _topicSubscriptionList.size();
+        std::size_t entrySize = last ? 0 : 2 + _topicSubscriptionList[i].topic.length() + 1;
+        if (!payload.empty() && (last || 5 + 2 + payload.size() + entrySize > maxPacketSize))
+        {
+            if (!writeTopicFiltersPacket(MQTT_PACKET_SUBSCRIBE, payload))
+            {
+                if (_enableSerialLogs)
+                    Serial.println("MQTT! subscribe failed");
+                return;
+            }
+            for (std::size_t j = first; j < i; j++)
+                _topicSubscriptionList[j].subscribed = true;
+            payload.clear();
+            first = i;
+            packetCount++;
+        }
+        if (last)
+            break;
+
+        const String &topic = _topicSubscriptionList[i].topic;
+        payload.push_back(topic.length() >> 8);
+        payload.push_back(topic.length() & 0xFF);
+        payload.insert(payload.end(), topic.c_str(), topic.c_str() + topic.length());
+        payload.push_back(_topicSubscriptionList[i].qos);
+    }
+
+    if (_enableSerialLogs && packetCount > 0)
+        Serial.printf("MQTT: Subscribed to %u topics with %u packets\n", (unsigned int)_topicSubscriptionList.size(), (unsigned int)packetCount);
+}
+
+// Packet ids are all given by this client: PubSubClient would restart its own ids from 1 on every connection,
+// while a packet may still wait for its acknowledgement. The ids of the QoS 1 messages waiting for their PUBACK are skipped,
+// so a SUBACK or UNSUBACK is never taken for a PUBACK, and so are the given up ones until the next connection,
+// so their late PUBACK does not complete another message.
+uint16_t ThingsCloudMQTT::nextPacketId()
+{
+    bool used = true;
+    while (used)
+    {
+        if (++_packetId == 0)
+            _packetId = 1;
+        used = false;
+        for (std::size_t i = 0; i < _inFlightList.size() && !used; i++)
+            used = _inFlightList[i].packetId == _packetId;
+        for (std::size_t i = 0; i < _quarantinedPacketIds.size() && !used; i++)
+            used = _quarantinedPacketIds[i] == _packetId;
+    }
+    return _packetId;
+}
+
+// Write a SUBSCRIBE or UNSUBSCRIBE packet made of the given topic filters, PubSubClient only sends one topic per packet
+bool ThingsCloudMQTT::writeTopicFiltersPacket(const uint8_t packetType, const std::vector<uint8_t> &topicFilters)
+{
+    uint16_t packetId = nextPacketId();
+
+    std::size_t remainingLength = 2 + topicFilters.size();
+    uint8_t header[7];
+    std::size_t headerLength = 0;
+    header[headerLength++] = (packetType << 4) | 0x02; // QoS 1 as required by the specification
+    do
+    {
+        uint8_t digit = remainingLength % 128;
+        remainingLength /= 128;
+        header[headerLength++] = remainingLength > 0 ? (digit | 0x80) : digit;
+    } while (remainingLength > 0);
+    header[headerLength++] = packetId >> 8;
+    header[headerLength++] = packetId & 0xFF;
+
+    return _mqttClient.write(header, headerLength) == headerLength &&
+           _mqttClient.write(topicFilters.data(), topicFilters.size()) == topicFilters.size();
+}
+
+// Initiate a Wifi connection (non-blocking)
+void ThingsCloudMQTT::connectToWifi()
+{
+    WiFi.mode(WIFI_STA);
+#ifdef ESP32
+    WiFi.setHostname(_mqttClientName.c_str());
+#else
+    WiFi.hostname(_mqttClientName.c_str());
+#endif
+    WiFi.begin(_wifiSsid, _wifiPassword);
+
+    if (_enableSerialLogs)
+        Serial.printf("\nWiFi: Connecting to %s ... (%fs) \n", _wifiSsid, millis() / 1000.0);
+}
+
+static const char *mqttStateName(const int state)
+{
+    switch (state)
+    {
+    case -4:
+        return "MQTT_CONNECTION_TIMEOUT";
+    case -3:
+        return "MQTT_CONNECTION_LOST";
+    case -2:
+        return "MQTT_CONNECT_FAILED";
+    case -1:
+        return "MQTT_DISCONNECTED";
+    case 1:
+        return "MQTT_CONNECT_BAD_PROTOCOL";
+    case 2:
+        return "MQTT_CONNECT_BAD_CLIENT_ID";
+    case 3:
+        return "MQTT_CONNECT_UNAVAILABLE";
+    case 4:
+        return "MQTT_CONNECT_BAD_CREDENTIALS";
+    case 5:
+        return "MQTT_CONNECT_UNAUTHORIZED";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+// Resolve the broker and API names as soon as the IP is obtained, during the hold-off before the first connections.
+// The connection steps then get the answers from the DNS cache.
+void ThingsCloudMQTT::resolveHostsEarly()
+{
+    IPAddress ip;
+    if (_mqttHost != nullptr && strlen(_mqttHost) > 0)
+        _dnsCache.resolve(_mqttHost, ip);
+
+    if (_needFetchAccessToken && !_accessTokenFetched && strncmp(_apiEndpoint, "http://", strlen("http://")) == 0)
+    {
+        String host, path;
+        uint16_t port;
+        if (splitHttpUrl(_apiEndpoint, host, port, path))
+            _dnsCache.resolve(host.c_str(), ip);
+    }
+}
+
+// Start a connection to the MQTT broker, carried on by processMqttConnection() (non-blocking)
+bool ThingsCloudMQTT::connectToMqttBroker()
+{
+    if (_mqttHost == nullptr || strlen(_mqttHost) == 0)
+    {
+        if (_enableSerialLogs)
+            Serial.printf("MQTT: ThingsCloud options is not set, not connecting (%fs)\n", millis() / 1000.0);
+        onMQTTConnectionFailed("OPTIONS_NOT_SET");
+        return false;
+    }
+
+    if (_enableSerialLogs)
+        Serial.printf("MQTT: Connecting to ThingsCloud \"%s\" with AccessToken \"%s\" ... (%fs)\n", _mqttHost, _accessToken.c_str(), millis() / 1000.0);
+
+    // explicitly set the server/port here in case they were not provided in the constructor
+    _mqttClient.setServer(_mqttHost, _mqttServerPort);
+    _mqttClient.setKeepAlive(mqttKeepAlive);
+    _mqttClient.setSocketTimeout(socketTimeout);
+    setMaxPacketSize(1024);
+
+    _mqttConnectState = MQTT_CONNECT_RESOLVING;
+    _mqttConnectStepMillis = millis();
+    return true;
+}
+
+// Move the connection on by one step when the current one is over, each step is bounded by its own timeout
+void ThingsCloudMQTT::processMqttConnection()
+{
+    unsigned long elapsed = millis() - _mqttConnectStepMillis;
+    ClientStepStatus status;
+
+    switch (_mqttConnectState)
+    {
+    case MQTT_CONNECT_RESOLVING:
+    {
+        IPAddress ip;
+        status = _dnsCache.resolve(_mqttHost, ip);
+        if (status == CLIENT_STEP_FAILED)
+            onMQTTConnectionFailed("DNS_FAILED");
+        else if (status == CLIENT_STEP_PENDING)
+        {
+            if (elapsed >= _mqttResolveTimeout)
+                onMQTTConnectionFailed("DNS_TIMEOUT");
+        }
+        else
+        {
+            _mqttConnectState = MQTT_CONNECT_TCP;
+            _mqttConnectStepMillis = millis();
+            if (!_mqttTransport.beginConnect(ip, _mqttServerPort, _mqttTcpConnectTimeout))
+                onMQTTConnectionFailed("MQTT_CONNECT_FAILED");
+        }
+        break;
+    }
+
+    case MQTT_CONNECT_TCP:
+        status = _mqttTransport.pollConnect();
+        if (status == CLIENT_STEP_FAILED)
+        {
+            // The cached address may be outdated, the next attempt resolves the name again
+            _dnsCache.invalidate(_mqttHost);
+            onMQTTConnectionFailed("MQTT_CONNECT_FAILED");
+        }
+        else if (status == CLIENT_STEP_PENDING)
+        {
+            if (elapsed >= _mqttTcpConnectTimeout)
+            {
+                _dnsCache.invalidate(_mqttHost);
+                onMQTTConnectionFailed("TCP_TIMEOUT");
+            }
+        }
+        else if (_needFetchAccessToken && !_accessTokenFetched)
+        {
+            // Opened while the AccessToken request is in flight. Waiting for it is not a broker failure.
+            if (!_mqttTransport.connected())
+                deferMqttConnection("MQTT_CONNECTION_LOST");
+            else if (_accessTokenFetchState == TOKEN_FETCH_IDLE)
+                deferMqttConnection("ACCESS_TOKEN_FAILED");
+        }
+        else if (!writeConnectPacket())
+            onMQTTConnectionFailed("MQTT_CONNECTION_LOST");
+        else
+        {
+            _mqttConnectState = MQTT_CONNECT_CONNACK;
+            _mqttConnectStepMillis = millis();
+        }
+        break;
+
+    case MQTT_CONNECT_CONNACK:
+        // Once the whole CONNACK is received, PubSubClient reads it right away. Its own CONNECT is skipped by the transport.
+        if (_mqttTransport.available() >= 4)
+        {
+            _mqttConnectState = MQTT_CONNECT_IDLE;
+            _mqttTransport.skipNextConnectPacket();
+            if (_mqttClient.connect(_mqttClientName.c_str(), _accessToken.c_str(), _projectKey, _mqttLastWillTopic, 0, _mqttLastWillRetain, _mqttLastWillMessage, _mqttCleanSession))
+            {
+                _failedMQTTConnectionAttemptCount = 0;
+                if (_enableSerialLogs)
+                    Serial.printf("MQTT: Connected to ThingsCloud. (%fs) \n", millis() / 1000.0);
+            }
+            else
+            {
+                // The AccessToken may have been revoked since it was cached
+                int state = _mqttClient.state();
+                if (_needFetchAccessToken && (state == MQTT_CONNECT_BAD_CREDENTIALS || state == MQTT_CONNECT_UNAUTHORIZED))
+                    invalidateAccessToken();
+                onMQTTConnectionFailed(mqttStateName(state));
+            }
+        }
+        else if (!_mqttTransport.connected())
+            onMQTTConnectionFailed("MQTT_CONNECTION_LOST");
+        else if (elapsed >= _mqttConnackTimeout)
+            onMQTTConnectionFailed("MQTT_CONNECTION_TIMEOUT");
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Plan another connection attempt. When there are too many failed attempts, sometimes it helps to reset the WiFi connection or to restart the board.
+void ThingsCloudMQTT::onMQTTConnectionFailed(const char *reason)
+{
+    // DISCONNECT only follows a CONNECT already written, before it the socket is just closed
+    if (_mqttConnectState == MQTT_CONNECT_CONNACK)
+        _mqttClient.disconnect();
+    else
+        _mqttTransport.stop();
+    _mqttConnectState = MQTT_CONNECT_IDLE;
+    _failedMQTTConnectionAttemptCount++;
+    unsigned long retryDelay = getRetryDelay(RECONNECT_MQTT, _failedMQTTConnectionAttemptCount);
+    _nextMqttConnectionAttemptMillis = millis() + retryDelay;
+
+    if (_enableSerialLogs)
+    {
+        Serial.printf("MQTT! unable to connect (%fs), reason: %s\n", millis() / 1000.0, reason);
+        Serial.printf("MQTT: Retrying to connect in %.1f seconds.\n", retryDelay / 1000.0);
+        Serial.printf("MQTT!: Failed MQTT connection count: %i \n", _failedMQTTConnectionAttemptCount);
+    }
+
+    if (_handleWiFi && _wifiResetMqttFailures > 0 && _failedMQTTConnectionAttemptCount == _wifiResetMqttFailures)
+    {
+        if (_enableSerialLogs)
+            Serial.println("MQTT!: Can't connect to broker after too many attempt, resetting WiFi ...");
+
+        WiFi.disconnect(true);
+        _nextWifiConnectionAttemptMillis = millis() + getRetryDelay(RECONNECT_WIFI, 1);
+
+        if (!_drasticResetOnConnectionFailures)
+            _failedMQTTConnectionAttemptCount = 0;
+    }
+    else if (_drasticResetOnConnectionFailures && _failedMQTTConnectionAttemptCount == 12) // Will reset after 12 failed attempt
+    {
+        if (_enableSerialLogs)
+            Serial.println("MQTT!: Can't connect to broker after too many attempt, resetting board ...");
+
+#ifdef ESP8266
+        ESP.reset();
+#else
+        ESP.restart();
+#endif
+    }
+}
+
+// Close the socket opened ahead of the AccessToken, without counting a failed attempt.
+// handleMQTT() starts again once the AccessToken is granted or requested again.
+void ThingsCloudMQTT::deferMqttConnection(const char *reason)
+{
+    _mqttConnectState = MQTT_CONNECT_IDLE;
+    _mqttTransport.stop();
+    // Before the first connection since power-on, the next attempt starts as soon as the AccessToken request allows it
+    _nextMqttConnectionAttemptMillis = millis() + (_connectionEstablishedCount > 0 ? getRetryDelay(RECONNECT_MQTT, 0) : 1);
+
+    if (_enableSerialLogs)
+        Serial.printf("MQTT: Waiting for the AccessToken, connection closed (%fs), reason: %s\n", millis() / 1000.0, reason);
+}
+
+// Exponential backoff with full jitter: a random delay below base * 2^(failedAttempts - 1), capped by _reconnectMaxDelay
+unsigned long ThingsCloudMQTT::getRetryDelay(const ReconnectTarget target, const unsigned int failedAttempts)
+{
+    if (_reconnectPolicy)
+        return _reconnectPolicy(target, failedAttempts);
+
+    // xorshift32, seeded from the mixed chip id so that close ids give unrelated sequences
+    if (_jitterState == 0)
+    {
+        uint64_t chipId = ESP_getChipId();
+        uint32_t seed = (uint32_t)chipId ^ (uint32_t)(chipId >> 32);
+        seed ^= seed >> 16;
+        seed *= 0x85EBCA6B;
+        seed ^= seed >> 13;
+        seed *= 0xC2B2AE35;
+        seed ^= seed >> 16;
+        _jitterState = seed != 0 ? seed : 1;
+    }
+    _jitterState ^= _jitterState << 13;
+    _jitterState ^= _jitterState >> 17;
+    _jitterState ^= _jitterState << 5;
+
+    unsigned long ceiling = _reconnectFastRetryDelay;
+    if (failedAttempts > 0)
+    {
+        uint64_t base = target == RECONNECT_MQTT           ? _mqttReconnectionAttemptDelay
+                        : target == RECONNECT_ACCESS_TOKEN ? _accessTokenFetchAttemptDelay
+                                                           : WIFI_RETRY_BASE_DELAY;
+        uint64_t growth = base << (failedAttempts - 1 < 20 ? failedAttempts - 1 : 20);
+        ceiling = growth < _reconnectMaxDelay ? growth : _reconnectMaxDelay;
+    }
+
+    return _jitterState % (ceiling + 1);
+}
+
+// Same CONNECT packet as the one written by PubSubClient::connect(), which then waits for the CONNACK
+bool ThingsCloudMQTT::writeConnectPacket()
+{
+    std::vector<uint8_t> body = {0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x00, (uint8_t)(mqttKeepAlive >> 8), (uint8_t)(mqttKeepAlive & 0xFF)};
+    uint8_t flags = 0x80; // User name
+    if (_projectKey != nullptr)
+        flags |= 0x40;
+    if (_mqttLastWillTopic != nullptr)
+        flags |= 0x04 | (_mqttLastWillRetain ? 0x20 : 0x00);
+    if (_mqttCleanSession)
+        flags |= 0x02;
+    body[7] = flags;
+
+    auto appendString = [&body](const char *str)
+    {
+        std::size_t length = strlen(str);
+        body.push_back(length >> 8);
+        body.push_back(length & 0xFF);
+        body.insert(body.end(), str, str + length);
+    };
+    appendString(_mqttClientName.c_str());
+    if (_mqttLastWillTopic != nullptr)
+    {
+        appendString(_mqttLastWillTopic);
+        appendString(_mqttLastWillMessage);
+    }
+    appendString(_accessToken.c_str());
+    if (_projectKey != nullptr)
+        appendString(_projectKey);
+
+    std::size_t remainingLength = body.size();
+    uint8_t header[5];
+    std::size_t headerLength = 0;
+    header[headerLength++] = 0x10; // CONNECT
+    do
+    {
+        uint8_t digit = remainingLength % 128;
+        remainingLength /= 128;
+        header[headerLength++] = remainingLength > 0 ? (digit | 0x80) : digit;
+    } while (remainingLength > 0);
+
+    return _mqttTransport.write(header, headerLength) == headerLength &&
+           _mqttTransport.write(body.data(), body.size()) == body.size();
+}
+
+// Start the coalescing window on the first staged attribute, and report right away when the staged values are large enough
+bool ThingsCloudMQTT::onAttributeStaged()
+{
+    if (!_pendingAttributes)
+    {
+        _pendingAttributes = true;
+        _pendingAttributesFlushMillis = millis() + _pendingAttributesWindow;
+    }
+
+    if (_pendingAttributesWindow == 0 || measureJson(_pendingAttributesDoc) >= _pendingAttributesMaxBytes)
+        return flushAttributes();
+    return true;
+}
+
+// A value is reported when it is the first one, when the heartbeat is due, or when it moved
+// past the deadband around the last reported value once the minimum interval is over.
+bool ThingsCloudMQTT::isAttributeReportDue(const ReportedAttributeRecord &record, unsigned long currentMillis)
+{
+    if (!record.hasValue)
+        return false;
+    if (!record.reported)
+        return true;
+
+    unsigned long elapsed = currentMillis - record.reportedMillis;
+    if (record.maxSilenceMillis > 0 && elapsed >= record.maxSilenceMillis)
+        return true;
+    if (elapsed < record.minIntervalMillis)
+        return false;
+
+    double threshold = record.deadband;
+    if (record.deadbandType == DEADBAND_PERCENT)
+        threshold = fabs(record.reportedValue) * record.deadband / 100.0;
+    return fabs(record.value - record.reportedValue) > threshold;
+}
+
+// Stage every attribute due for a report, so that they are sent together
+void ThingsCloudMQTT::processReportedAttributes()
+{
+    unsigned long currentMillis = millis();
+    bool staged = false;
+
+    for (std::size_t i = 0; i < _reportedAttributeList.size(); i++)
+    {
+        ReportedAttributeRecord &record = _reportedAttributeList[i];
+        if (!isAttributeReportDue(record, currentMillis))
+            continue;
+
+        record.reportedValue = record.value;
+        record.reportedMillis = currentMillis;
+        record.reported = true;
+        stageAttribute(record.key.c_str(), record.value);
+        staged = true;
+    }
+
+    if (staged)
+        onAttributeStaged();
+}
+
+bool ThingsCloudMQTT::publishPayload(const char *topic, const uint8_t *payload, unsigned int plength, bool retain, bool binary)
+{
+    // Keep the message in the outbox while disconnected, or behind the messages of the same or a higher class already waiting there
+    if (_outbox.isEnabled() && (!isConnected() || _outbox.getCount(getPublishPriority(topic)) > 0))
+        return pushOutbox(topic, payload, plength, retain);
+
+    // Do not try to publish if MQTT is not connected.
+    if (!isConnected())
+    {
+        if (_enableSerialLogs)
+            Serial.println("MQTT! Trying to publish when disconnected, skipping.");
+
+        return false;
+    }
+
+    RateLimitPolicy policy;
+    if (!takePublishToken(topic, policy))
+        return onRateLimited(topic, payload, plength, retain, policy);
+
+    bool success = _mqttClient.publish(topic, payload, plength, retain);
+
+    if (_enableSerialLogs)
+    {
+        if (!success)
+            Serial.println("MQTT! publish failed, is the message too long ? (see setMaxPacketSize())"); // This can occurs if the message is too long according to the maximum defined in PubsubClient.h
+        else if (binary)
+            Serial.printf("MQTT << [%s] (HEX)0x%s\n", topic, bytesToHex(payload, plength).c_str());
+        else
+            Serial.printf("MQTT << [%s] %.*s\n", topic, (int)plength, (const char *)payload);
+    }
+
+    return success;
 }
 
-bool ThingsCloudMQTT::subscribe(const String &topic, MessageReceivedCallbackJSONWithTopic messageReceivedCallback, uint8_t qos)
+ThingsCloudMQTT::TopicRateLimitRecord *ThingsCloudMQTT::findTopicRateLimit(const char *topic)
 {
-    if (subscribe(topic, (MessageReceivedCallback)NULL, qos))
+    for (std::size_t i = 0; i < _topicRateLimitList.size(); i++)
     {
-        _topicSubscriptionList[_topicSubscriptionList.size() - 1].callbackJSONWithTopic = messageReceivedCallback;
-        return true;
+        if (ThingsCloudTopicTrie::filterMatches(_topicRateLimitList[i].topicFilter.c_str(), topic))
+            return &_topicRateLimitList[i];
     }
-    return false;
+    return nullptr;
 }
 
-bool ThingsCloudMQTT::unsubscribe(const String &topic)
+// Take a token from the global bucket and from the bucket of the topic, only when both have one.
+// Otherwise policy is set to the policy of the exhausted bucket.
+bool ThingsCloudMQTT::takePublishToken(const char *topic, RateLimitPolicy &policy)
 {
-    // Do not try to unsubscribe if MQTT is not connected.
-    if (!isConnected())
+    unsigned long currentMillis = millis();
+    auto refill = [currentMillis](TokenBucket &bucket)
     {
-        if (_enableSerialLogs)
-            Serial.println("MQTT! Trying to unsubscribe when disconnected, skipping.");
+        bucket.tokens = std::min(bucket.burst, bucket.tokens + (currentMillis - bucket.refillMillis) * bucket.ratePerSecond / 1000.0f);
+        bucket.refillMillis = currentMillis;
+    };
 
-        return false;
-    }
+    TokenBucket *global = _publishRateLimit.ratePerSecond > 0 ? &_publishRateLimit : nullptr;
+    TopicRateLimitRecord *topicLimit = _topicRateLimitList.empty() ? nullptr : findTopicRateLimit(topic);
+    if (topicLimit != nullptr && topicLimit->bucket.ratePerSecond <= 0)
+        topicLimit = nullptr;
 
-    for (std::size_t i = 0; i < _topicSubscriptionList.size(); i++)
+    if (topicLimit != nullptr)
     {
-        if (_topicSubscriptionList[i].topic.equals(topic))
+        refill(topicLimit->bucket);
+        if (topicLimit->bucket.tokens < 1)
         {
-            if (_mqttClient.unsubscribe(topic.c_str()))
-            {
-                _topicSubscriptionList.erase(_topicSubscriptionList.begin() + i);
-                i--;
-
-                if (_enableSerialLogs)
-                    Serial.printf("MQTT: Unsubscribed from %s\n", topic.c_str());
-            }
-            else
-            {
-                if (_enableSerialLogs)
-                    Serial.println("MQTT! unsubscribe failed");
-
-                return false;
-            }
+            policy = topicLimit->policy;
+            return false;
         }
     }
-
+    if (global != nullptr)
+    {
+        refill(*global);
+        if (global->tokens < 1)
+        {
+            policy = _publishRateLimitPolicy;
+            return false;
+        }
+        global->tokens -= 1;
+    }
+    if (topicLimit != nullptr)
+        topicLimit->bucket.tokens -= 1;
     return true;
 }
 
-void ThingsCloudMQTT::setWifiCredentials(const char *wifiSsid, const char *wifiPassword)
+bool ThingsCloudMQTT::onRateLimited(const char *topic, const uint8_t *payload, unsigned int plength, bool retain, RateLimitPolicy policy)
 {
-    _wifiSsid = wifiSsid;
-    _wifiPassword = wifiPassword;
-    _handleWiFi = true;
+    if (policy == RATE_LIMIT_DROP || !_outbox.isEnabled())
+    {
+        _rateLimitDroppedCount++;
+        if (_enableSerialLogs)
+            Serial.printf("MQTT! [%s] over the publish rate limit, dropped.\n", topic);
+        return false;
+    }
+
+    if (policy == RATE_LIMIT_COALESCE)
+        _rateLimitCoalescedCount++;
+    else
+        _rateLimitQueuedCount++;
+    return pushOutbox(topic, payload, plength, retain);
 }
 
-void ThingsCloudMQTT::executeDelayed(const unsigned long delay, DelayedExecutionCallback callback)
+void ThingsCloudMQTT::processInFlight()
 {
-    DelayedExecutionRecord delayedExecutionRecord;
-    delayedExecutionRecord.targetMillis = millis() + delay;
-    delayedExecutionRecord.callback = callback;
+    uint16_t packetId;
+    while (_mqttTransport.popPubAck(packetId))
+        completeInFlight(packetId, true);
 
-    _delayedExecutionList.push_back(delayedExecutionRecord);
-}
+    unsigned long currentMillis = millis();
+    std::size_t i = 0;
+    while (i < _inFlightList.size())
+    {
+        InFlightMessage &message = _inFlightList[i];
+        if (message.attempts > 0 && currentMillis - message.sentMillis < _inFlightRetryMillis)
+        {
+            i++;
+            continue;
+        }
 
-// ================== Private functions ====================-
+        if (message.attempts >= _inFlightMaxAttempts)
+        {
+            if (_enableSerialLogs)
+                Serial.printf("MQTT! QoS 1 #%u not acknowledged after %u attempts, giving up.\n", message.packetId, message.attempts);
+            if (_quarantinedPacketIds.size() >= QUARANTINED_PACKET_IDS_MAX)
+                _quarantinedPacketIds.erase(_quarantinedPacketIds.begin());
+            _quarantinedPacketIds.push_back(message.packetId);
+            completeInFlight(message.packetId, false);
+            continue;
+        }
 
-// Initiate a Wifi connection (non-blocking)
-void ThingsCloudMQTT::connectToWifi()
-{
-    WiFi.mode(WIFI_STA);
-#ifdef ESP32
-    WiFi.setHostname(_mqttClientName.c_str());
-#else
-    WiFi.hostname(_mqttClientName.c_str());
-#endif
-    WiFi.begin(_wifiSsid, _wifiPassword);
+        // Kept in order behind the outbox messages of the same or a higher class, and within the publish rate limit
+        RateLimitPolicy policy;
+        if ((message.attempts == 0 && _outbox.getCount(message.priority) > 0) || !takePublishToken(message.topic.c_str(), policy))
+            break;
 
-    if (_enableSerialLogs)
-        Serial.printf("\nWiFi: Connecting to %s ... (%fs) \n", _wifiSsid, millis() / 1000.0);
+        // Sent again with the DUP flag
+        if (message.attempts > 0)
+            message.packet[0] |= 0x08;
+        if (_mqttClient.write(message.packet.data(), message.packet.size()) != message.packet.size())
+            break;
+
+        if (_enableSerialLogs)
+            Serial.printf("MQTT << QoS 1 #%u %s\n", message.packetId, message.attempts > 0 ? "sent again" : "sent");
+        message.attempts++;
+        message.sentMillis = currentMillis;
+        i++;
+    }
 }
 
-// Try to connect to the MQTT broker and return True if the connection is successfull (blocking)
-bool ThingsCloudMQTT::connectToMqttBroker()
+void ThingsCloudMQTT::completeInFlight(const uint16_t packetId, const bool delivered)
+{
+    for (std::size_t i = 0; i < _inFlightList.size(); i++)
+    {
+        if (_inFlightList[i].packetId != packetId)
+            continue;
+
+        // Removed first, so the callback can publish again
+        PublishCompleteCallback callback = _inFlightList[i].callback;
+        _inFlightList.erase(_inFlightList.begin() + i);
+        if (callback)
+            callback(packetId, delivered);
+        return;
+    }
+}
+
+char *ThingsCloudMQTT::reportBuilderBuffer()
 {
-    bool success = false;
+    if (_attributesBuilderBuffer.size() != _attributesBuilderBufferSize)
+        _attributesBuilderBuffer.assign(_attributesBuilderBufferSize, '\0');
+    return _attributesBuilderBuffer.data();
+}
 
-    if (_mqttHost != nullptr && strlen(_mqttHost) > 0)
+// Keep a message in the outbox, according to the retention of its topic
+bool ThingsCloudMQTT::pushOutbox(const char *topic, const uint8_t *payload, unsigned int plength, bool retain)
+{
+    OutboxRetention retention = OUTBOX_KEEP_ALL;
+    for (std::size_t i = 0; i < _outboxRetentionList.size(); i++)
     {
-        if (_enableSerialLogs)
+        if (ThingsCloudTopicTrie::filterMatches(_outboxRetentionList[i].topicFilter.c_str(), topic))
         {
-            Serial.printf("MQTT: Connecting to ThingsCloud \"%s\" with AccessToken \"%s\" ... (%fs)", _mqttHost, _accessToken.c_str(), millis() / 1000.0);
+            retention = _outboxRetentionList[i].retention;
+            break;
         }
-
-        // explicitly set the server/port here in case they were not provided in the constructor
-        _mqttClient.setServer(_mqttHost, _mqttServerPort);
-        _mqttClient.setKeepAlive(mqttKeepAlive);
-        _mqttClient.setSocketTimeout(socketTimeout);
-        setMaxPacketSize(1024);
-        success = _mqttClient.connect(_mqttClientName.c_str(), _accessToken.c_str(), _projectKey, _mqttLastWillTopic, 0, _mqttLastWillRetain, _mqttLastWillMessage, _mqttCleanSession);
     }
-    else
+
+    if (retention == OUTBOX_DISCARD)
     {
         if (_enableSerialLogs)
-            Serial.printf("MQTT: ThingsCloud options is not set, not connecting (%fs)\n", millis() / 1000.0);
-        success = false;
+            Serial.println("MQTT! Trying to publish when disconnected, skipping.");
+        return false;
+    }
+
+    // Messages of a coalesced rate limited topic replace each other while they wait
+    bool replace = retention == OUTBOX_KEEP_LATEST;
+    if (!replace)
+    {
+        TopicRateLimitRecord *topicLimit = _topicRateLimitList.empty() ? nullptr : findTopicRateLimit(topic);
+        if (topicLimit != nullptr)
+            replace = topicLimit->policy == RATE_LIMIT_COALESCE;
+        else
+            replace = _publishRateLimit.ratePerSecond > 0 && _publishRateLimitPolicy == RATE_LIMIT_COALESCE;
     }
 
+    bool success = _outbox.push(topic, payload, plength, retain, replace, getPublishPriority(topic));
+
     if (_enableSerialLogs)
     {
         if (success)
-            Serial.printf(" - ok. (%fs) \n", millis() / 1000.0);
+            Serial.printf("MQTT: [%s] kept in outbox, %u pending messages\n", topic, _outbox.getCount());
         else
+            Serial.println("MQTT! outbox push failed, is the message larger than the outbox or its topic too long ?");
+    }
+
+    return success;
+}
+
+// Send the oldest messages of the outbox, at most _outboxDrainMaxMessages per _outboxDrainIntervalMillis
+void ThingsCloudMQTT::processOutbox()
+{
+    RateLimitPolicy policy;
+    for (unsigned int i = 0; i < _outboxDrainMaxMessages && _outbox.front(_outboxMessage); i++)
+    {
+        // The messages stay in order, the drain waits for the budget of the oldest one
+        if (!takePublishToken(_outboxMessage.topic.c_str(), policy))
+            break;
+
+        // Streamed like publish(topic, stream), so the payload is not bounded by the MQTT buffer
+        size_t length = _outboxMessage.payload.size();
+        bool success = _mqttClient.beginPublish(_outboxMessage.topic.c_str(), length, _outboxMessage.retain);
+        if (success && _mqttClient.write(_outboxMessage.payload.data(), length) != length)
         {
-            Serial.printf("unable to connect (%fs), reason: ", millis() / 1000.0);
+            // The broker still waits for the rest of the message, the connection can not be used anymore
+            _mqttClient.disconnect();
+            success = false;
+        }
+        else if (success)
+            success = _mqttClient.endPublish() > 0;
 
-            switch (_mqttClient.state())
+        if (!success)
+        {
+            // A message that keeps failing is dropped, so it does not hold back the ones behind it
+            if (++_outboxDrainFailures >= OUTBOX_DRAIN_MAX_ATTEMPTS)
             {
-            case -4:
-                Serial.println("MQTT_CONNECTION_TIMEOUT");
-                break;
-            case -3:
-                Serial.println("MQTT_CONNECTION_LOST");
-                break;
-            case -2:
-                Serial.println("MQTT_CONNECT_FAILED");
-                break;
-            case -1:
-                Serial.println("MQTT_DISCONNECTED");
-                break;
-            case 1:
-                Serial.println("MQTT_CONNECT_BAD_PROTOCOL");
-                break;
-            case 2:
-                Serial.println("MQTT_CONNECT_BAD_CLIENT_ID");
-                break;
-            case 3:
-                Serial.println("MQTT_CONNECT_UNAVAILABLE");
-                break;
-            case 4:
-                Serial.println("MQTT_CONNECT_BAD_CREDENTIALS");
-                break;
-            case 5:
-                Serial.println("MQTT_CONNECT_UNAUTHORIZED");
-                break;
+                if (_enableSerialLogs)
+                    Serial.printf("MQTT! [%s] outbox publish failed %u times, message dropped.\n", _outboxMessage.topic.c_str(), (unsigned int)_outboxDrainFailures);
+                _outboxDrainFailures = 0;
+                _outbox.drop();
             }
-
-            Serial.printf("MQTT: Retrying to connect in %i seconds.\n", _mqttReconnectionAttemptDelay / 1000);
+            else if (_enableSerialLogs)
+                Serial.printf("MQTT! [%s] outbox publish failed, retrying.\n", _outboxMessage.topic.c_str());
+            break;
         }
+
+        if (_enableSerialLogs)
+            Serial.printf("MQTT << [%s] from outbox\n", _outboxMessage.topic.c_str());
+        _outboxDrainFailures = 0;
+        _outbox.pop();
     }
 
-    return success;
+    _nextOutboxDrainMillis = millis() + _outboxDrainIntervalMillis;
 }
 
 // Delayed execution handling.
@@ -753,111 +2539,392 @@ void ThingsCloudMQTT::processDelayedExecutionRequests()
     }
 }
 
+// Rebuild the subscription trie from _topicSubscriptionList, required after a record has been removed.
+void ThingsCloudMQTT::rebuildTopicTrie()
+{
+    _topicTrie.clear();
+    for (std::size_t i = 0; i < _topicSubscriptionList.size(); i++)
+        _topicTrie.insert(_topicSubscriptionList[i].topic, i);
+}
+
+// Erase the unsubscribed records, unless a message is being dispatched: its callbacks may still run.
+void ThingsCloudMQTT::eraseRemovedSubscriptions()
+{
+    if (_inboundDispatchDepth > 0)
+        return;
+
+    std::size_t count = _topicSubscriptionList.size();
+    _topicSubscriptionList.erase(std::remove_if(_topicSubscriptionList.begin(), _topicSubscriptionList.end(), [](const TopicSubscriptionRecord &record)
+                                                { return record.removed; }),
+                                 _topicSubscriptionList.end());
+    if (_topicSubscriptionList.size() != count)
+        rebuildTopicTrie();
+}
+
+void ThingsCloudMQTT::mqttMessageReceivedCallback(char *topic, uint8_t *payload, unsigned int length)
+{
+    // We ensure that we dont bypass the maximum size of the PubSubClient library buffer that originated the payload
+    // This buffer has a maximum length of _mqttClient.getBufferSize() and the payload begin at "headerSize + topicLength + 1"
+    bool payloadTerminable = strlen(topic) + length + 9 < _mqttClient.getBufferSize();
+
+    if (!_inboundQueueSlots.empty())
+        enqueueInboundMessage(topic, payload, length);
+    else
+        dispatchInboundMessage(topic, payload, length, payloadTerminable);
+}
+
+// Copy an inbound message into the next free queue slot, applying the overflow policy when the queue is full
+void ThingsCloudMQTT::enqueueInboundMessage(const char *topic, const uint8_t *payload, unsigned int length)
+{
+    size_t topicLength = strlen(topic);
+
+    // The slot holds the null-terminated topic, then the payload followed by one spare byte for its termination
+    if (topicLength + length + 2 > _inboundQueueSlotSize)
+    {
+        _inboundQueueOverflowCount++;
+        if (_enableSerialLogs)
+            Serial.printf("MQTT! Inbound message on [%s] larger than the queue slots, dropped (see enableInboundQueue()).\n", topic);
+        return;
+    }
+
+    if (_inboundQueueCount == _inboundQueueSlots.size())
+    {
+        _inboundQueueOverflowCount++;
+        if (_enableSerialLogs)
+            Serial.println("MQTT! Inbound queue full, dropping a message.");
+
+        if (_inboundQueuePolicy == INBOUND_QUEUE_DROP_NEWEST)
+            return;
+
+        _inboundQueueHead = (_inboundQueueHead + 1) % _inboundQueueSlots.size();
+        _inboundQueueCount--;
+    }
+
+    std::size_t slotIndex = (_inboundQueueHead + _inboundQueueCount) % _inboundQueueSlots.size();
+    uint8_t *slot = &_inboundQueueBuffer[slotIndex * _inboundQueueSlotSize];
+    memcpy(slot, topic, topicLength + 1);
+    memcpy(slot + topicLength + 1, payload, length);
+    _inboundQueueSlots[slotIndex].topicLength = topicLength;
+    _inboundQueueSlots[slotIndex].payloadLength = length;
+    _inboundQueueCount++;
+}
+
+// Dispatch the queued messages, oldest first, until the queue is empty or the per-loop budget is spent
+void ThingsCloudMQTT::processInboundQueue()
+{
+    unsigned long startMillis = millis();
+    unsigned int dispatchedCount = 0;
+
+    while (_inboundQueueCount > 0)
+    {
+        if (_inboundDispatchMaxMessages > 0 && dispatchedCount >= _inboundDispatchMaxMessages)
+            break;
+        if (_inboundDispatchMaxMillis > 0 && dispatchedCount > 0 && millis() - startMillis >= _inboundDispatchMaxMillis)
+            break;
+
+        std::size_t slotIndex = _inboundQueueHead;
+        uint8_t *slot = &_inboundQueueBuffer[slotIndex * _inboundQueueSlotSize];
+        dispatchInboundMessage((char *)slot, slot + _inboundQueueSlots[slotIndex].topicLength + 1, _inboundQueueSlots[slotIndex].payloadLength, true);
+
+        _inboundQueueHead = (_inboundQueueHead + 1) % _inboundQueueSlots.size();
+        _inboundQueueCount--;
+        dispatchedCount++;
+    }
+}
+
 /**
- * Matching MQTT topics, handling the eventual presence of a single wildcard character
+ * Send an inbound message to the matching subscribers
  *
- * @param topic1 is the topic may contain a wildcard
- * @param topic2 must not contain wildcards
- * @return true on MQTT topic match, false otherwise
+ * @param payloadTerminable is true if the byte following the payload can be used for its null termination
  */
-bool ThingsCloudMQTT::mqttTopicMatch(const String &topic1, const String &topic2)
+void ThingsCloudMQTT::dispatchInboundMessage(char *topic, uint8_t *payload, unsigned int length, bool payloadTerminable)
 {
-    int i = 0;
+    // Logging
+    if (_enableSerialLogs)
+        Serial.printf("MQTT >> [%s] %.*s\n", topic, (int)length, (const char *)payload);
 
-    if ((i = topic1.indexOf('#')) >= 0)
+    if (_attributesPushWindow > 0 && !_attributesPushFlushing && strcmp(topic, "attributes/push") == 0)
     {
-        String t1a = topic1.substring(0, i);
-        String t1b = topic1.substring(i + 1);
-        if ((t1a.length() == 0 || topic2.startsWith(t1a)) &&
-            (t1b.length() == 0 || topic2.endsWith(t1b)))
-            return true;
+        coalesceAttributesPush(topic, payload, length, payloadTerminable);
+        return;
     }
-    else if ((i = topic1.indexOf('+')) >= 0)
+
+    // Find the matching subscribers, then call them in subscription order.
+    // The matches are copied, as a callback may subscribe or unsubscribe. The copy is swapped out of the member buffer,
+    // so that a nested dispatch gets its own, and the removed records are only erased once the message is dispatched.
+    std::vector<uint16_t> matches;
+    matches.swap(_dispatchMatches);
+    const std::vector<uint16_t> &trieMatches = _topicTrie.match(topic);
+    matches.assign(trieMatches.begin(), trieMatches.end());
+    _inboundDispatchDepth++;
+
+    // The payload is parsed on the first JSON subscriber, then shared by the following ones
+    bool jsonParsed = false;
+    bool jsonFailed = false;
+
+    // String copies of the topic and payload are only made for the first subscriber that needs them
+    bool stringsBuilt = false;
+    String payloadStr;
+    String topicStr;
+
+    // Send the message to subscribers
+    for (std::size_t m = 0; m < matches.size(); m++)
     {
-        String t1a = topic1.substring(0, i);
-        String t1b = topic1.substring(i + 1);
+        std::size_t i = matches[m];
+        if (i >= _topicSubscriptionList.size() || _topicSubscriptionList[i].removed)
+            continue;
 
-        if ((t1a.length() == 0 || topic2.startsWith(t1a)) &&
-            (t1b.length() == 0 || topic2.endsWith(t1b)))
+        // Zero-copy subscribers get pointers straight into the PubSubClient receive buffer.
+        // Only the subscribeMsgPack() decoder parses into the shared document, which is then parsed again for the next JSON subscriber.
+        if (_topicSubscriptionList[i].callbackDecoder != NULL)
         {
-            if (topic2.substring(t1a.length(), topic2.length() - t1b.length()).indexOf('/') == -1)
-                return true;
+            _topicSubscriptionList[i].callbackDecoder(topic, payload, length);
+            if (_topicSubscriptionList[i].decoder == DECODER_MSGPACK)
+                jsonParsed = false;
+        }
+        if (_topicSubscriptionList[i].callbackView != NULL)
+        {
+            _topicSubscriptionList[i].callbackView(topic, payload, length);
+        }
+        if (!stringsBuilt && (_topicSubscriptionList[i].callback != NULL || _topicSubscriptionList[i].callbackWithTopic != NULL))
+        {
+            // Convert the payload into a String
+            // First, We ensure that we dont bypass the end of the buffer that holds the payload
+            unsigned int strTerminationPos;
+            if (!payloadTerminable && length > 0)
+            {
+                strTerminationPos = length - 1;
+
+                if (_enableSerialLogs)
+                    Serial.print("MQTT! Your message may be truncated, please set setMaxPacketSize() to a higher value.\n");
+            }
+            else
+                strTerminationPos = length;
+
+            // Second, we add the string termination code at the end of the payload and we convert it to a String object.
+            // The overwritten byte is restored afterwards, so that the other subscribers still see the complete payload.
+            uint8_t overwrittenByte = payload[strTerminationPos];
+            payload[strTerminationPos] = '\0';
+            payloadStr = String((char *)payload);
+            payload[strTerminationPos] = overwrittenByte;
+            topicStr = String(topic);
+            stringsBuilt = true;
+        }
+        if (_topicSubscriptionList[i].callback != NULL)
+        {
+            _topicSubscriptionList[i].callback(payloadStr);
+        }
+        if (_topicSubscriptionList[i].callbackJSON != NULL || _topicSubscriptionList[i].callbackJSONWithTopic != NULL)
+        {
+            if (!jsonParsed && !jsonFailed)
+            {
+                jsonParsed = parseInboundJson(payload, length);
+                jsonFailed = !jsonParsed;
+            }
+            if (jsonFailed)
+                continue;
+        }
+        if (_topicSubscriptionList[i].callbackJSON != NULL)
+        {
+            JsonObject obj = _inboundJsonDoc.as<JsonObject>();
+            _topicSubscriptionList[i].callbackJSON(obj);
+        }
+        if (_topicSubscriptionList[i].callbackWithTopic != NULL)
+        {
+            _topicSubscriptionList[i].callbackWithTopic(topicStr, payloadStr);
+        }
+        if (_topicSubscriptionList[i].callbackJSONWithTopic != NULL)
+        {
+            JsonObject obj = _inboundJsonDoc.as<JsonObject>();
+            _topicSubscriptionList[i].callbackJSONWithTopic(topicStr, obj);
         }
-    }
-    else
-    {
-        return topic1.equals(topic2);
     }
 
-    return false;
+    _inboundDispatchDepth--;
+    _dispatchMatches.swap(matches);
+    eraseRemovedSubscriptions();
 }
 
-void ThingsCloudMQTT::mqttMessageReceivedCallback(char *topic, uint8_t *payload, unsigned int length)
+// Merge an attributes/push payload into the pending attributes, the last value of each attribute wins
+void ThingsCloudMQTT::coalesceAttributesPush(char *topic, uint8_t *payload, unsigned int length, bool payloadTerminable)
 {
-    // Convert the payload into a String
-    // First, We ensure that we dont bypass the maximum size of the PubSubClient library buffer that originated the payload
-    // This buffer has a maximum length of _mqttClient.getBufferSize() and the payload begin at "headerSize + topicLength + 1"
-    unsigned int strTerminationPos;
-    if (strlen(topic) + length + 9 >= _mqttClient.getBufferSize())
+    if (!parseInboundJson(payload, length))
+        return;
+
+    // Kept to dispatch the pending attributes without this push, when they do not fit together
+    if (_attributesPushPending)
+        _attributesPushSnapshot.set(_attributesPushDoc);
+
+    JsonObject attributes = _inboundJsonDoc.as<JsonObject>();
+    for (JsonPair kv : attributes)
+        _attributesPushDoc[kv.key()] = kv.value();
+
+    // The pending attributes do not fit anymore: dispatch them now, then start a new window with this push
+    if (_attributesPushPending && _attributesPushDoc.overflowed())
     {
-        strTerminationPos = length - 1;
+        if (_enableSerialLogs)
+            Serial.println("MQTT! Coalesced attributes overflow, dispatching them before the end of the window.");
+
+        _attributesPushDoc.set(_attributesPushSnapshot);
+        flushAttributesPush();
+
+        // The subscribers reuse the shared document, so the push is parsed again
+        if (!parseInboundJson(payload, length))
+            return;
+        attributes = _inboundJsonDoc.as<JsonObject>();
+        for (JsonPair kv : attributes)
+            _attributesPushDoc[kv.key()] = kv.value();
+    }
 
+    // Larger than the coalescing document on its own, dispatched as received
+    if (_attributesPushDoc.overflowed())
+    {
         if (_enableSerialLogs)
-            Serial.print("MQTT! Your message may be truncated, please set setMaxPacketSize() to a higher value.\n");
+            Serial.println("MQTT! attributes/push larger than the coalescing document, dispatching it alone.");
+
+        _attributesPushDoc.clear();
+        _attributesPushFlushing = true;
+        dispatchInboundMessage(topic, payload, length, payloadTerminable);
+        _attributesPushFlushing = false;
+        return;
     }
-    else
-        strTerminationPos = length;
 
-    // Second, we add the string termination code at the end of the payload and we convert it to a String object
-    payload[strTerminationPos] = '\0';
-    String payloadStr((char *)payload);
-    String topicStr(topic);
+    if (!_attributesPushPending)
+    {
+        _attributesPushPending = true;
+        _attributesPushFlushMillis = millis() + _attributesPushWindow;
+    }
+}
 
-    // Logging
-    if (_enableSerialLogs)
-        Serial.printf("MQTT >> [%s] %s\n", topic, payloadStr.c_str());
+// Dispatch the pending attributes to the attributes/push subscribers, as a single message
+void ThingsCloudMQTT::flushAttributesPush()
+{
+    // Serialized with one spare byte, used for the payload termination
+    size_t length = measureJson(_attributesPushDoc);
+    _attributesPushBuffer.resize(length + 1);
+    serializeJson(_attributesPushDoc, (char *)_attributesPushBuffer.data(), length + 1);
+    _attributesPushDoc.clear();
+    _attributesPushPending = false;
+
+    char topic[] = "attributes/push";
+    _attributesPushFlushing = true;
+    dispatchInboundMessage(topic, _attributesPushBuffer.data(), length, true);
+    _attributesPushFlushing = false;
+}
 
-    // Send the message to subscribers
-    for (std::size_t i = 0; i < _topicSubscriptionList.size(); i++)
+// Parse an inbound payload into the shared JSON document
+bool ThingsCloudMQTT::parseInboundJson(const uint8_t *payload, unsigned int length, const bool msgPack)
+{
+    return parseJson(_inboundJsonDoc, payload, length, msgPack);
+}
+
+// When the document is too small, it is grown to fit the payload instead of dropping the message
+bool ThingsCloudMQTT::parseJson(DynamicJsonDocument &doc, const uint8_t *payload, unsigned int length, const bool msgPack)
+{
+    auto deserialize = [&doc, payload, length, msgPack]()
+    {
+        return msgPack ? deserializeMsgPack(doc, (const char *)payload, length) : deserializeJson(doc, (const char *)payload, length);
+    };
+    DeserializationError error = deserialize();
+
+    // Each JSON value takes at least 2 bytes of payload and one 16 bytes slot, so the growth is bounded
+    size_t capacity = doc.capacity();
+    while (error == DeserializationError::NoMemory && capacity < length * 16)
     {
-        if (mqttTopicMatch(_topicSubscriptionList[i].topic, String(topic)))
+        capacity = capacity > 0 ? capacity * 2 : DEFAULT_JSON_DOCUMENT_CAPACITY;
+        if (_enableSerialLogs && &doc == &_inboundJsonDoc)
+            Serial.printf("MQTT! JSON document too small, growing it to %u bytes (see setJsonDocumentCapacity())\n", (unsigned int)capacity);
+
+        doc = DynamicJsonDocument(capacity);
+        error = deserialize();
+    }
+
+    if (error)
+    {
+        Serial.printf("%s deserialize error: %s\n", msgPack ? "MessagePack" : "JSON", error.f_str());
+        return false;
+    }
+    return true;
+}
+
+// Route a command to the handler of its method.
+// The method is found by scanning the payload, then only the "params" member is parsed, for the matching handler only.
+void ThingsCloudMQTT::dispatchCommand(const char *topic, const uint8_t *payload, size_t length)
+{
+    const char *method = nullptr;
+    size_t methodLength = 0;
+    const char *params = nullptr;
+    size_t paramsLength = 0;
+
+    scanJsonObject((const char *)payload, length, [&](const char *key, size_t keyLength, const char *value, size_t valueLength)
+                   {
+        if (keyLength == 6 && memcmp(key, "method", 6) == 0 && value[0] == '"')
         {
-            if (_topicSubscriptionList[i].callback != NULL)
-            {
-                _topicSubscriptionList[i].callback(payloadStr);
-            }
-            if (_topicSubscriptionList[i].callbackJSON != NULL)
-            {
-                DynamicJsonDocument doc(512);
-                DeserializationError error = deserializeJson(doc, payloadStr);
-                if (error)
-                {
-                    Serial.printf("JSON deserialize error: %s\n", error.f_str());
-                    continue;
-                }
-                JsonObject obj = doc.as<JsonObject>();
-                _topicSubscriptionList[i].callbackJSON(obj);
-            }
-            if (_topicSubscriptionList[i].callbackWithTopic != NULL)
-            {
-                _topicSubscriptionList[i].callbackWithTopic(topicStr, payloadStr);
-            }
-            if (_topicSubscriptionList[i].callbackJSONWithTopic != NULL)
-            {
-                DynamicJsonDocument doc(512);
-                DeserializationError error = deserializeJson(doc, payloadStr);
-                if (error)
-                {
-                    Serial.printf("JSON deserialize error: %s\n", error.f_str());
-                    continue;
-                }
-                JsonObject obj = doc.as<JsonObject>();
-                _topicSubscriptionList[i].callbackJSONWithTopic(topicStr, obj);
-            }
+            method = value + 1;
+            methodLength = valueLength - 2;
+        }
+        else if (keyLength == 6 && memcmp(key, "params", 6) == 0)
+        {
+            params = value;
+            paramsLength = valueLength;
         }
+        return method == nullptr || params == nullptr; });
+
+    if (method == nullptr)
+        return;
+
+    int i = findKeyedHandler(_commandHandlerList, method, methodLength);
+    if (i >= 0)
+    {
+        JsonObject paramsObj;
+        if (params != nullptr && parseJson(_routerJsonDoc, (const uint8_t *)params, paramsLength))
+            paramsObj = _routerJsonDoc.as<JsonObject>();
+
+        // Copy the callback, the handler may register other methods
+        CommandReceivedCallback callback = _commandHandlerList[i].callback;
+        callback(String(topic), paramsObj);
+        return;
+    }
+
+    // Unknown method, answered without any JSON parsing
+    if (_onUnknownCommand != NULL)
+    {
+        char methodStr[64];
+        size_t n = methodLength < sizeof(methodStr) - 1 ? methodLength : sizeof(methodStr) - 1;
+        memcpy(methodStr, method, n);
+        methodStr[n] = '\0';
+        _onUnknownCommand(String(topic), String(methodStr));
     }
 }
 
+// Call the handlers of the attributes present in a JSON object.
+// Members without handler are skipped by the scan, only the values of the handled ones are parsed.
+void ThingsCloudMQTT::dispatchAttributes(const char *payload, size_t length)
+{
+    scanJsonObject(payload, length, [this](const char *key, size_t keyLength, const char *value, size_t valueLength)
+                   {
+        int i = findKeyedHandler(_attributeHandlerList, key, keyLength);
+        if (i >= 0 && parseJson(_routerJsonDoc, (const uint8_t *)value, valueLength))
+        {
+            AttributeReceivedCallback callback = _attributeHandlerList[i].callback;
+            callback(_routerJsonDoc.as<JsonVariant>());
+        }
+        return true; });
+}
+
+// Replies to getAttributes() carry the attributes in their "attributes" member
+void ThingsCloudMQTT::dispatchAttributesGetResponse(const char *payload, size_t length)
+{
+    scanJsonObject(payload, length, [this](const char *key, size_t keyLength, const char *value, size_t valueLength)
+                   {
+        if (keyLength == 10 && memcmp(key, "attributes", 10) == 0)
+        {
+            this->dispatchAttributes(value, valueLength);
+            return false;
+        }
+        return true; });
+}
+
 String ThingsCloudMQTT::getEspChipUniqueId()
 {
     uint32_t chipId = 0;
@@ -9,7 +9,16 @@
 // #include <HTTPUpdate.h>
 #include <ArduinoJson.h>
 #include <PubSubClient.h>
+#include "ThingsCloudOutbox.h"
+#include "ThingsCloudAttributesBuilder.h"
+#include "ThingsCloudMsgPackBuilder.h"
+#include "ThingsCloudClient.h"
+#include "ThingsCloudDNSCache.h"
+#include "ThingsCloudLZSS.h"
+#include "ThingsCloudTopicTrie.h"
 #include <vector>
+#include <deque>
+#include <algorithm>
 
 #ifdef ESP8266
 
@@ -31,10 +40,66 @@
 #endif
 
 #define DEFAULT_MQTT_CLIENT_NAME "THINGSCLOUD_ESP32_ARDUINO_LIB"
+#define DEFAULT_JSON_DOCUMENT_CAPACITY 1024
+#define PUBLISH_STREAM_CHUNK_SIZE 128
+#define OUTBOX_DRAIN_MAX_ATTEMPTS 3
+#define QUARANTINED_PACKET_IDS_MAX 64 // Given up QoS 1 packet ids kept out of use until the next connection
+#define WIFI_RETRY_BASE_DELAY 500
+#define ACCESS_TOKEN_RESPONSE_TIMEOUT 10000
+#define ACCESS_TOKEN_RESPONSE_MAX_SIZE 1024 // Body of the AccessToken response
+#define ACCESS_TOKEN_HEADERS_MAX_SIZE 2048  // Status line and headers of the AccessToken response
 
 const unsigned int mqttKeepAlive = 120;
 const unsigned int socketTimeout = 300;
 
+// What a retry delay is computed for
+typedef enum
+{
+    RECONNECT_WIFI = 0,
+    RECONNECT_MQTT = 1,
+    RECONNECT_ACCESS_TOKEN = 2
+} ReconnectTarget;
+
+// Steps of the AccessToken request, driven by loop() like the MQTT connection
+typedef enum
+{
+    TOKEN_FETCH_IDLE = 0,
+    TOKEN_FETCH_RESOLVING = 1,
+    TOKEN_FETCH_CONNECTING = 2,
+    TOKEN_FETCH_RESPONSE = 3 // Request sent, reading the response until the server closes the connection
+} AccessTokenFetchState;
+
+// Steps of the MQTT connection, each one driven by loop() and bounded by its own timeout
+typedef enum
+{
+    MQTT_CONNECT_IDLE = 0,
+    MQTT_CONNECT_RESOLVING = 1, // Broker name resolution
+    MQTT_CONNECT_TCP = 2,       // TCP handshake
+    MQTT_CONNECT_CONNACK = 3    // CONNECT sent, waiting for the CONNACK
+} MqttConnectState;
+
+// What to do when a message is received while the inbound queue is full
+typedef enum
+{
+    INBOUND_QUEUE_DROP_OLDEST = 0,
+    INBOUND_QUEUE_DROP_NEWEST = 1
+} InboundQueuePolicy;
+
+// What happens to a message published over its rate budget
+typedef enum
+{
+    RATE_LIMIT_QUEUE = 0,    // Kept in the outbox and sent in order once the budget allows it
+    RATE_LIMIT_DROP = 1,     // Dropped
+    RATE_LIMIT_COALESCE = 2  // Kept in the outbox, replacing the previous message of the same topic
+} RateLimitPolicy;
+
+// How the change of an attribute value is compared to its deadband
+typedef enum
+{
+    DEADBAND_ABSOLUTE = 0, // Deadband in the unit of the value
+    DEADBAND_PERCENT = 1   // Deadband in percent of the last reported value
+} DeadbandType;
+
 // MUST be implemented in your sketch. Called once device is connected to ThingsCloud.
 void onMQTTConnect();
 
@@ -43,14 +108,29 @@ typedef std::function<void(const String &message)> MessageReceivedCallback;
 typedef std::function<void(const JsonObject &obj)> MessageReceivedCallbackJSON;
 typedef std::function<void(const String &topicStr, const String &message)> MessageReceivedCallbackWithTopic;
 typedef std::function<void(const String &topicStr, const JsonObject &obj)> MessageReceivedCallbackJSONWithTopic;
+// Zero-copy view of an inbound message, the pointers are only valid during the call. The payload is not null-terminated.
+typedef std::function<void(const char *topic, const uint8_t *payload, size_t length)> MessageReceivedCallbackView;
+// Delay in milliseconds before the next attempt, failedAttempts is 0 for the first retry after a lost connection
+typedef std::function<unsigned long(ReconnectTarget target, unsigned int failedAttempts)> ReconnectPolicyCallback;
+typedef std::function<void(const String &topicStr, const JsonObject &params)> CommandReceivedCallback;
+typedef std::function<void(const String &topicStr, const String &method)> UnknownCommandReceivedCallback;
+typedef std::function<void(const JsonVariant &value)> AttributeReceivedCallback;
 typedef std::function<void()> DelayedExecutionCallback;
+// Fill the buffer with the next chunk of a streamed payload, return the number of bytes written, 0 to abort.
+typedef std::function<size_t(uint8_t *buffer, size_t size)> PublishChunkCallback;
+// Outcome of a QoS 1 publish: delivered once acknowledged by the broker, false when it was given up.
+typedef std::function<void(uint16_t packetId, bool delivered)> PublishCompleteCallback;
 
 class ThingsCloudMQTT
 {
+    friend class ThingsCloudAttributesBuilder;
+    friend class ThingsCloudMsgPackBuilder;
+
 private:
     // Wifi related
     bool _handleWiFi;
     bool _wifiConnected;
+    bool _wifiConnectedBefore = false; // WiFi was already up since power-on, the next connections are reconnections
     bool _connectingToWifi;
     unsigned long _lastWifiConnectiomAttemptMillis;
     unsigned long _nextWifiConnectionAttemptMillis;
@@ -58,6 +138,7 @@ private:
     const char *_wifiSsid;
     const char *_wifiPassword;
     WiFiClient _wifiClient;
+    ThingsCloudClient _mqttTransport; // Wraps _wifiClient for PubSubClient
 
     // MQTT related
     bool _mqttConnected;
@@ -79,20 +160,212 @@ private:
     char *_mqttLastWillMessage;
     bool _mqttLastWillRetain;
     unsigned int _failedMQTTConnectionAttemptCount;
+    MqttConnectState _mqttConnectState = MQTT_CONNECT_IDLE;
+    unsigned long _mqttConnectStepMillis = 0;
+    unsigned int _mqttResolveTimeout = 5000;
+    unsigned int _mqttTcpConnectTimeout = 5000;
+    unsigned int _mqttConnackTimeout = 10000;
+    ThingsCloudDNSCache _dnsCache; // Broker and API addresses
+
+    // Retry backoff related, the jitter is seeded from the chip id so that devices do not retry in step
+    ReconnectPolicyCallback _reconnectPolicy;
+    unsigned long _reconnectMaxDelay = 5 * 60 * 1000;
+    unsigned long _reconnectFastRetryDelay = 1000;
+    unsigned int _wifiResetMqttFailures = 8; // Failed MQTT attempts before the WiFi is reset, 0 never resets it
+    uint32_t _jitterState = 0;
+    unsigned int _failedWifiConnectionAttemptCount = 0;
+    unsigned int _failedAccessTokenFetchCount = 0;
     bool _needFetchAccessToken = false;
     bool _accessTokenFetched = false;
 
+    // AccessToken request related, over its own connection
+    WiFiClient _httpClient;
+    ThingsCloudClient _httpTransport; // Connection steps only, the response is not followed as MQTT packets
+    AccessTokenFetchState _accessTokenFetchState = TOKEN_FETCH_IDLE;
+    unsigned long _accessTokenFetchStepMillis = 0;
+    std::vector<char> _accessTokenResponse; // Headers until they are complete, then only the body
+    bool _accessTokenHeadersRead = false;
+    String _accessTokenHost; // Parts of the http endpoint, parsed by beginAccessTokenFetch()
+    uint16_t _accessTokenPort = 80;
+    String _accessTokenPath;
+    const char *_accessTokenCachePath = nullptr; // Token kept in LittleFS with the keys it was granted for
+
     PubSubClient _mqttClient;
 
+    // Decoder installed on a subscription by the SDK, kept apart from the user callbacks. A topic has at most one.
+    typedef enum
+    {
+        DECODER_NONE = 0,
+        DECODER_COMMAND_ROUTER = 1,   // onCommand()
+        DECODER_ATTRIBUTE_ROUTER = 2, // onAttribute()
+        DECODER_MSGPACK = 3,          // subscribeMsgPack()
+        DECODER_COMPRESSED = 4        // subscribeCompressed()
+    } SubscriptionDecoder;
+
+    // Subscriptions are kept across connections, and restored on each new connection
     struct TopicSubscriptionRecord
     {
         String topic;
+        uint8_t qos;
+        bool subscribed; // SUBSCRIBE sent on the current connection
+        bool removed;    // Unsubscribed while a message was dispatched, erased once it is done
         MessageReceivedCallback callback;
         MessageReceivedCallbackJSON callbackJSON;
         MessageReceivedCallbackWithTopic callbackWithTopic;
         MessageReceivedCallbackJSONWithTopic callbackJSONWithTopic;
+        MessageReceivedCallbackView callbackView;
+        uint8_t decoder; // SubscriptionDecoder of callbackDecoder
+        MessageReceivedCallbackView callbackDecoder;
+    };
+    // A deque, so that the records do not move when a callback subscribes while a message is dispatched
+    std::deque<TopicSubscriptionRecord> _topicSubscriptionList;
+    uint16_t _packetId = 0; // Last id given to a SUBSCRIBE, UNSUBSCRIBE or QoS 1 PUBLISH packet
+
+    ThingsCloudTopicTrie _topicTrie; // Filters of _topicSubscriptionList, rebuilt whenever a record is removed
+    std::vector<uint16_t> _dispatchMatches; // Snapshot of the trie matches, reused by dispatchInboundMessage()
+    uint8_t _inboundDispatchDepth = 0;      // Messages being dispatched, the unsubscribed records are erased at 0
+
+    // Inbound payloads are parsed at most once per message into this document, shared by every JSON subscriber
+    DynamicJsonDocument _inboundJsonDoc;
+    // Command params and attribute values routed by onCommand() and onAttribute(), kept apart from the shared document.
+    // Allocated by the first routed value.
+    DynamicJsonDocument _routerJsonDoc;
+
+    // Inbound queue related, messages are copied into pre-allocated slots and dispatched from loop()
+    struct InboundQueueSlot
+    {
+        uint16_t topicLength;
+        uint16_t payloadLength;
+    };
+    std::vector<uint8_t> _inboundQueueBuffer; // Slots content, allocated once by enableInboundQueue()
+    std::vector<InboundQueueSlot> _inboundQueueSlots;
+    uint16_t _inboundQueueSlotSize = 0;
+    uint8_t _inboundQueueHead = 0; // Oldest queued message
+    uint8_t _inboundQueueCount = 0;
+    InboundQueuePolicy _inboundQueuePolicy = INBOUND_QUEUE_DROP_OLDEST;
+    uint8_t _inboundDispatchMaxMessages = 4;
+    unsigned long _inboundDispatchMaxMillis = 20;
+    unsigned long _inboundQueueOverflowCount = 0;
+
+    // Attributes push coalescing related, pushes are merged per key and dispatched once the window is over
+    DynamicJsonDocument _attributesPushDoc;
+    DynamicJsonDocument _attributesPushSnapshot; // Pending attributes before the last merge
+    std::vector<uint8_t> _attributesPushBuffer;
+    unsigned long _attributesPushWindow = 0;
+    unsigned long _attributesPushFlushMillis = 0;
+    bool _attributesPushPending = false;
+    bool _attributesPushFlushing = false;
+
+    // Attributes coalescing related, values set by setAttribute() are reported together once the window is over
+    DynamicJsonDocument _pendingAttributesDoc;
+    unsigned long _pendingAttributesWindow = 0;
+    size_t _pendingAttributesMaxBytes = 512;
+    unsigned long _pendingAttributesFlushMillis = 0;
+    bool _pendingAttributes = false;
+
+    // Report builders related, they share the SDK buffer allocated once by the first begin call
+    ThingsCloudAttributesBuilder _attributesBuilder;
+    ThingsCloudMsgPackBuilder _msgPackBuilder;
+    std::vector<char> _attributesBuilderBuffer;
+    size_t _attributesBuilderBufferSize = 512;
+
+    // Compressed payloads related, grown to the largest message and then reused
+    std::vector<uint8_t> _compressBuffer;
+    std::vector<uint8_t> _decompressBuffer;
+    size_t _maxDecompressedSize = 0; // 0 for the MQTT buffer size
+
+    // Send-on-delta reporting related, sorted by key hash
+    struct ReportedAttributeRecord
+    {
+        uint32_t keyHash;
+        String key;
+        double deadband;
+        DeadbandType deadbandType;
+        unsigned long minIntervalMillis;
+        unsigned long maxSilenceMillis;
+        double value;
+        double reportedValue;
+        unsigned long reportedMillis;
+        bool hasValue;
+        bool reported;
+    };
+    std::vector<ReportedAttributeRecord> _reportedAttributeList;
+
+    // Outbox related, messages published while disconnected are sent once connected again
+    ThingsCloudOutbox _outbox;
+    ThingsCloudOutboxMessage _outboxMessage; // Reused by every sent message
+    struct OutboxRetentionRecord
+    {
+        String topicFilter;
+        OutboxRetention retention;
     };
-    std::vector<TopicSubscriptionRecord> _topicSubscriptionList;
+    std::vector<OutboxRetentionRecord> _outboxRetentionList;
+    uint8_t _outboxDrainMaxMessages = 5;
+    unsigned long _outboxDrainIntervalMillis = 100;
+    unsigned long _nextOutboxDrainMillis = 0;
+    uint8_t _outboxDrainFailures = 0; // Failed attempts to send the oldest message
+    struct PublishPriorityRecord
+    {
+        String topicFilter;
+        PublishPriority priority;
+    };
+    std::vector<PublishPriorityRecord> _publishPriorityList;
+
+    // QoS 1 publish related, messages are kept until their PUBACK
+    struct InFlightMessage
+    {
+        uint16_t packetId;
+        String topic;
+        PublishPriority priority;    // Not sent ahead of the outbox messages of this class or higher
+        std::vector<uint8_t> packet; // Complete PUBLISH packet, sent again with the DUP flag
+        unsigned long sentMillis;
+        uint8_t attempts; // 0 until first sent
+        PublishCompleteCallback callback;
+    };
+    std::vector<InFlightMessage> _inFlightList;
+    uint8_t _inFlightWindow = 4;
+    unsigned long _inFlightRetryMillis = 10000;
+    uint8_t _inFlightMaxAttempts = 5;
+    std::vector<uint16_t> _quarantinedPacketIds; // A late PUBACK may still come for them
+
+    // Publish rate limiting related, token buckets refilled at ratePerSecond up to burst tokens
+    struct TokenBucket
+    {
+        float ratePerSecond;
+        float burst;
+        float tokens;
+        unsigned long refillMillis;
+    };
+    struct TopicRateLimitRecord
+    {
+        String topicFilter;
+        TokenBucket bucket;
+        RateLimitPolicy policy;
+    };
+    TokenBucket _publishRateLimit = {0, 0, 0, 0}; // Disabled while ratePerSecond is 0
+    RateLimitPolicy _publishRateLimitPolicy = RATE_LIMIT_QUEUE;
+    std::vector<TopicRateLimitRecord> _topicRateLimitList;
+    unsigned long _rateLimitQueuedCount = 0;
+    unsigned long _rateLimitCoalescedCount = 0;
+    unsigned long _rateLimitDroppedCount = 0;
+
+    // Command and attribute routers related, handlers are sorted by key hash
+    struct CommandHandlerRecord
+    {
+        uint32_t keyHash;
+        String key;
+        CommandReceivedCallback callback;
+    };
+    std::vector<CommandHandlerRecord> _commandHandlerList;
+    UnknownCommandReceivedCallback _onUnknownCommand;
+
+    struct AttributeHandlerRecord
+    {
+        uint32_t keyHash;
+        String key;
+        AttributeReceivedCallback callback;
+    };
+    std::vector<AttributeHandlerRecord> _attributeHandlerList;
 
     // Delayed execution related
     struct DelayedExecutionRecord
@@ -135,16 +408,77 @@ public:
     // Optional functionality
     void enableDebuggingMessages(const bool enabled = true);                                    // Allow to display useful debugging messages. Can be set to false to disable them during program execution
     void enableDrasticResetOnConnectionFailures() { _drasticResetOnConnectionFailures = true; } // Can be usefull in special cases where the ESP board hang and need resetting (#59)
+    void setJsonDocumentCapacity(const size_t capacity);                                       // Capacity of the document shared by JSON subscribers, grown automatically when a payload does not fit
+
+    // Queue the inbound messages instead of dispatching them from inside the MQTT client, they are then dispatched by loop()
+    void enableInboundQueue(const uint8_t slotCount = 8, const uint16_t slotSize = 1024, const InboundQueuePolicy policy = INBOUND_QUEUE_DROP_OLDEST);
+    void setInboundDispatchBudget(const uint8_t maxMessages, const unsigned long maxMillis); // Maximum messages and time spent dispatching the queue per loop() call, 0 for no limit. 4 messages and 20ms by default.
+    inline unsigned long getInboundOverflowCount() const { return _inboundQueueOverflowCount; }; // Return the number of inbound messages dropped by the queue
+
+    // Keep the messages published while disconnected, and send them in order once connected again
+    bool enableOutbox(const size_t ramCapacity = 4096);
+    bool enableOutboxSpill(const char *path = "/thingscloud_outbox.bin", const size_t maxBytes = 64 * 1024); // Move the oldest messages to LittleFS when the RAM is full
+    void setOutboxRetention(const String &topicFilter, const OutboxRetention retention);                    // OUTBOX_KEEP_ALL for the topics without retention
+    void setOutboxDrainRate(const uint8_t maxMessages, const unsigned long intervalMillis);                  // 5 messages every 100ms by default
+    // The outbox sends the higher priority classes first, and a message skips the outbox when it only holds lower classes.
+    // By default events are critical, command replies come next, then attributes, and the other topics are bulk data.
+    void setPublishPriority(const String &topicFilter, const PublishPriority priority);
+    PublishPriority getPublishPriority(const char *topic) const;
+    inline unsigned int getOutboxCount() const { return _outbox.getCount(); };
+    inline unsigned long getOutboxDroppedCount() const { return _outbox.getDroppedCount(); };
+
+    // Limit the publish rate, globally and for the topics matching a filter (first matching filter wins), with a burst allowance.
+    // Queued and coalesced messages wait in the outbox, they are dropped when the outbox is not enabled.
+    void setPublishRateLimit(const float messagesPerSecond, const uint16_t burst = 1, const RateLimitPolicy policy = RATE_LIMIT_QUEUE); // 0 to disable
+    void setTopicRateLimit(const String &topicFilter, const float messagesPerSecond, const uint16_t burst = 1, const RateLimitPolicy policy = RATE_LIMIT_QUEUE);
+    inline unsigned long getRateLimitQueuedCount() const { return _rateLimitQueuedCount; };
+    inline unsigned long getRateLimitCoalescedCount() const { return _rateLimitCoalescedCount; };
+    inline unsigned long getRateLimitDroppedCount() const { return _rateLimitDroppedCount; };
+
+    // Merge the attributes/push messages received within the window, the subscribers only get the last value of each attribute
+    // Two documents of capacity bytes are allocated: the pending attributes, and their copy before each merge
+    void enableAttributesPushCoalescing(const unsigned long windowMillis, const size_t capacity = DEFAULT_JSON_DOCUMENT_CAPACITY);
 
     /// Main loop, to call at each sketch loop()
     void loop();
 
-    // Get ThingsCloud device accessToken by deviceKey
+    // Get ThingsCloud device accessToken by deviceKey (blocking). loop() fetches it without blocking for http endpoints.
     bool fetchDeviceAccessToken();
+    // Keep the AccessToken in LittleFS, so the next boots connect right away without requesting it.
+    // It is requested again when the broker rejects it, or when the device key or project key changed.
+    bool enableAccessTokenCache(const char *path = "/thingscloud_token.txt");
     void setCustomerId(const String customerId);
 
     bool reportAttributes(const String attributes);
+    bool reportAttributes(const char *attributes, const size_t length);
+    bool reportAttributes(const JsonDocument &attributes);
+
+    // Build an attributes report in place, without heap allocation: beginAttributes().add("temperature", 31.2).add("humidity", 62).send()
+    ThingsCloudAttributesBuilder &beginAttributes();                                   // Write into the SDK buffer
+    ThingsCloudAttributesBuilder &beginAttributes(char *buffer, const size_t size);    // Write into the caller buffer
+    void setAttributesBufferSize(const size_t size);                                   // Size of the SDK buffer, 512 bytes by default
+    // Same builders for a data topic, as JSON or as MessagePack. Only one report is built at a time in the SDK buffer.
+    ThingsCloudAttributesBuilder &beginData(const char *topic);
+    ThingsCloudAttributesBuilder &beginData(const char *topic, char *buffer, const size_t size);
+    ThingsCloudMsgPackBuilder &beginDataMsgPack(const char *topic);
+    ThingsCloudMsgPackBuilder &beginDataMsgPack(const char *topic, uint8_t *buffer, const size_t size);
+
+    // Stage an attribute value, the staged values are reported in a single message once the window is over or the size limit is reached
+    void enableAttributesCoalescing(const unsigned long windowMillis, const size_t maxBytes = 512, const size_t capacity = DEFAULT_JSON_DOCUMENT_CAPACITY);
+    template <typename T>
+    bool setAttribute(const char *key, const T value)
+    {
+        stageAttribute(key, value);
+        return onAttributeStaged();
+    }
+    bool flushAttributes(); // Report the staged attributes now
+
+    // Send-on-delta reporting: updateAttribute() only reports a value when it moved more than the deadband from the last reported one,
+    // and not more often than minIntervalMillis. It is reported again after maxSilenceMillis without change, 0 to disable.
+    void setAttributeReporting(const char *key, const double deadband, const DeadbandType deadbandType = DEADBAND_ABSOLUTE, const unsigned long minIntervalMillis = 0, const unsigned long maxSilenceMillis = 0);
+    bool updateAttribute(const char *key, const double value);
     bool reportEvent(const uint16_t id, const String event);
+    bool reportEvent(const uint16_t id, const String event, PublishCompleteCallback callback); // Sent with QoS 1
     bool reportData(const String &topic, const String &payload);
     bool reportData(const String &topic, const uint8_t *payload, unsigned int plength);
     bool getAttributes();
@@ -155,14 +489,48 @@ public:
     bool onAttributesPush(MessageReceivedCallbackJSON messageReceivedCallback);
     bool onCommandSend(MessageReceivedCallbackWithTopic messageReceivedCallbackWithTopic);
     bool onCommandSend(MessageReceivedCallbackJSONWithTopic messageReceivedCallbackWithTopic);
+    // Call the handler with the "params" of the commands matching the method. The command router and the other SDK decoders
+    // (onAttribute(), subscribeMsgPack(), subscribeCompressed()) cannot share a topic: they return false when it already has another one.
+    bool onCommand(const String &method, CommandReceivedCallback commandReceivedCallback);
+    inline void setOnUnknownCommand(UnknownCommandReceivedCallback callback) { _onUnknownCommand = callback; };
+    bool onAttribute(const String &key, AttributeReceivedCallback attributeReceivedCallback); // Call the handler when the attribute is pushed or read with getAttributes()
 
     bool setMaxPacketSize(const uint16_t size);
     bool publish(const String &topic, const String &payload, bool retain = false);
     bool publish(const String &topic, const uint8_t *payload, unsigned int plength);
+    // Serialize the document straight into the connection, without an intermediate String or growing the MQTT buffer.
+    // When it waits in the outbox, a serialized copy is kept and streamed the same way once connected.
+    bool publish(const String &topic, const JsonDocument &doc, bool retain = false);
+    // Stream a payload of known length, in chunks, without holding it in RAM nor growing the MQTT buffer.
+    // Streamed messages are not kept in the outbox, and an aborted stream closes the connection.
+    bool publish(const String &topic, Stream &stream, const size_t length, bool retain = false);
+    bool publish(const String &topic, const size_t length, PublishChunkCallback chunkCallback, bool retain = false);
+    // LZSS compressed publish, for repetitive data like sensor batches. Each message is compressed on its own,
+    // so a lost message never breaks the next ones. Payloads that do not shrink are sent stored, with one byte of overhead.
+    bool publishCompressed(const String &topic, const uint8_t *payload, unsigned int plength, bool retain = false);
+    bool publishCompressed(const String &topic, const String &payload, bool retain = false);
+    // QoS 1 publish: the message is kept until the broker acknowledges it, and sent again with the DUP flag after retryMillis
+    // or after a reconnection. Up to window messages wait for their PUBACK together. Return the packet id, 0 when the window is full.
+    // Every send takes a publish token: over the rate limit the message waits for one, unless the policy drops it (0 is returned).
+    // It is not sent ahead of the outbox messages of its priority class or higher.
+    uint16_t publishQoS1(const String &topic, const uint8_t *payload, unsigned int plength, PublishCompleteCallback callback = nullptr, bool retain = false);
+    uint16_t publishQoS1(const String &topic, const String &payload, PublishCompleteCallback callback = nullptr, bool retain = false);
+    void setInFlightWindow(const uint8_t window, const unsigned long retryMillis = 10000, const uint8_t maxAttempts = 5); // 4 messages by default
+    inline unsigned int getInFlightCount() const { return _inFlightList.size(); };
+
+    // Subscriptions are kept by the client: made while disconnected, they are sent once connected, and they are all restored after each reconnection.
     bool subscribe(const String &topic, MessageReceivedCallback messageReceivedCallback, uint8_t qos = 0);
     bool subscribe(const String &topic, MessageReceivedCallbackJSON messageReceivedCallback, uint8_t qos = 0);
     bool subscribe(const String &topic, MessageReceivedCallbackWithTopic messageReceivedCallback, uint8_t qos = 0);
     bool subscribe(const String &topic, MessageReceivedCallbackJSONWithTopic messageReceivedCallback, uint8_t qos = 0);
+    bool subscribe(const String &topic, MessageReceivedCallbackView messageReceivedCallback, uint8_t qos = 0);
+    // MessagePack payloads, decoded like the JSON ones. Like subscribeCompressed(), it is kept apart from the subscribe() callbacks
+    // of the topic, and returns false when the topic is already decoded by onCommand(), onAttribute() or subscribeCompressed().
+    bool subscribeMsgPack(const String &topic, MessageReceivedCallbackJSON messageReceivedCallback, uint8_t qos = 0);
+    // Every payload of the topic is sent by publishCompressed(): it is decompressed before the callback, a payload without
+    // a valid header is dropped. The other subscriptions never look for a header, binary payloads are passed unchanged.
+    bool subscribeCompressed(const String &topic, MessageReceivedCallbackView messageReceivedCallback, uint8_t qos = 0);
+    inline void setMaxDecompressedSize(const size_t size) { _maxDecompressedSize = size; }; // Larger payloads are dropped, the MQTT buffer size by default
     bool unsubscribe(const String &topic); // Unsubscribes from the topic, if it exists, and removes it from the CallbackList.
 
     // Wifi related
@@ -176,6 +544,7 @@ public:
     inline bool isConnected() const { return isWifiConnected() && isMqttConnected(); };                // Return true if everything is connected
     inline bool isWifiConnected() const { return _wifiConnected; };                                    // Return true if wifi is connected
     inline bool isMqttConnected() const { return _mqttConnected; };                                    // Return true if mqtt is connected
+    inline bool isMqttConnecting() const { return _mqttConnectState != MQTT_CONNECT_IDLE; };            // Return true while a connection attempt is in progress
     inline unsigned int getConnectionEstablishedCount() const { return _connectionEstablishedCount; }; // Return the number of time onConnectionEstablished has been called since the beginning.
 
     inline void setOnMQTTConnect(ConnectionStatusCallback callback) { _onMQTTConnect = callback; };
@@ -183,9 +552,25 @@ public:
     inline void setOnWifiConnect(ConnectionStatusCallback callback) { _onWifiConnect = callback; };
     inline void setOnWifiDisconnect(ConnectionStatusCallback callback) { _onWifiDisconnect = callback; };
 
-    // Allow to set the minimum delay between each MQTT reconnection attempt. 15 seconds by default.
+    // Allow to set the base delay between MQTT reconnection attempts, doubled after each failure. 15 seconds by default.
     inline void setMqttReconnectionAttemptDelay(const unsigned int milliseconds) { _mqttReconnectionAttemptDelay = milliseconds; };
 
+    // Retry delays grow from their base delay up to maxDelayMillis, each one drawn at random below that ceiling (full jitter).
+    // The first retry after a lost connection comes within fastRetryMillis. 5 minutes and 1 second by default.
+    void setReconnectionBackoff(const unsigned long maxDelayMillis, const unsigned long fastRetryMillis = 1000);
+    inline void setReconnectPolicy(ReconnectPolicyCallback policy) { _reconnectPolicy = policy; }; // Replace the default backoff for the WiFi, MQTT and AccessToken retries
+    // When the WiFi is handled by the library, it is reset after this many consecutive failed MQTT connection attempts. 8 by default, 0 never resets it.
+    inline void setWifiResetThreshold(const unsigned int failedMqttAttempts) { _wifiResetMqttFailures = failedMqttAttempts; };
+
+    // Allow to set the timeout of each MQTT connection step. 5 seconds for the DNS and the TCP handshake, 10 seconds for the CONNACK by default.
+    void setMqttConnectionTimeouts(const unsigned int resolveMillis, const unsigned int tcpConnectMillis, const unsigned int connackMillis);
+
+    // The broker and API addresses are reused for ttlMillis without any DNS query, 5 minutes by default.
+    // Past that, the connections still use the last known good address while the name is resolved again in the background.
+    inline void setDnsCacheTTL(const unsigned long ttlMillis) { _dnsCache.setTTL(ttlMillis); };
+    // Keep the last known good addresses in LittleFS, so the first connection after a reboot does not wait for the DNS.
+    bool enableDnsCacheFile(const char *path = "/thingscloud_dns.txt");
+
     // Allow to set the minimum delay between each WiFi reconnection attempt. 60 seconds by default.
     inline void setWifiReconnectionAttemptDelay(const unsigned int milliseconds) { _wifiReconnectionAttemptDelay = milliseconds; };
 
@@ -198,10 +583,67 @@ private:
     void onMQTTConnectionLost();
 
     void connectToWifi();
+    void resolveHostsEarly();
     bool connectToMqttBroker();
+    void processMqttConnection();
+    void onMQTTConnectionFailed(const char *reason);
+    void deferMqttConnection(const char *reason);
+    bool writeConnectPacket();
+    bool beginAccessTokenFetch();
+    void processAccessTokenFetch();
+    bool readAccessTokenResponseHeaders();
+    void onAccessTokenFetchFailed(const char *reason);
+    String accessTokenRequestBody();
+    bool parseAccessTokenResponse(const char *body);
+    void saveAccessToken();
+    void invalidateAccessToken();
+    unsigned long getRetryDelay(const ReconnectTarget target, const unsigned int failedAttempts);
     void processDelayedExecutionRequests();
-    bool mqttTopicMatch(const String &topic1, const String &topic2);
+    template <typename T>
+    void stageAttribute(const char *key, const T value)
+    {
+        if (_pendingAttributesDoc.capacity() == 0)
+            enableAttributesCoalescing(0);
+
+        // When the document is full, report the staged values first
+        _pendingAttributesDoc[key] = value;
+        if (_pendingAttributesDoc.overflowed())
+        {
+            _pendingAttributesDoc.remove(key);
+            flushAttributes();
+            _pendingAttributesDoc[key] = value;
+        }
+    }
+    bool onAttributeStaged();
+    bool isAttributeReportDue(const ReportedAttributeRecord &record, unsigned long currentMillis);
+    void processReportedAttributes();
+    bool publishPayload(const char *topic, const uint8_t *payload, unsigned int plength, bool retain, bool binary);
+    void processInFlight();
+    void completeInFlight(const uint16_t packetId, const bool delivered);
+    TopicRateLimitRecord *findTopicRateLimit(const char *topic);
+    bool takePublishToken(const char *topic, RateLimitPolicy &policy);
+    bool onRateLimited(const char *topic, const uint8_t *payload, unsigned int plength, bool retain, RateLimitPolicy policy);
+    bool pushOutbox(const char *topic, const uint8_t *payload, unsigned int plength, bool retain);
+    void processOutbox();
+    TopicSubscriptionRecord *subscribeTopic(const String &topic, uint8_t qos);
+    bool subscribeDecoder(const String &topic, SubscriptionDecoder decoder, MessageReceivedCallbackView callback, uint8_t qos = 0);
+    void resubscribeAll();
+    uint16_t nextPacketId();
+    bool writeTopicFiltersPacket(const uint8_t packetType, const std::vector<uint8_t> &topicFilters);
+    void rebuildTopicTrie();
+    void eraseRemovedSubscriptions();
     void mqttMessageReceivedCallback(char *topic, uint8_t *payload, unsigned int length);
+    void enqueueInboundMessage(const char *topic, const uint8_t *payload, unsigned int length);
+    void processInboundQueue();
+    void dispatchInboundMessage(char *topic, uint8_t *payload, unsigned int length, bool payloadTerminable);
+    void coalesceAttributesPush(char *topic, uint8_t *payload, unsigned int length, bool payloadTerminable);
+    void flushAttributesPush();
+    bool parseInboundJson(const uint8_t *payload, unsigned int length, const bool msgPack = false);
+    bool parseJson(DynamicJsonDocument &doc, const uint8_t *payload, unsigned int length, const bool msgPack = false);
+    char *reportBuilderBuffer();
+    void dispatchCommand(const char *topic, const uint8_t *payload, size_t length);
+    void dispatchAttributes(const char *payload, size_t length);
+    void dispatchAttributesGetResponse(const char *payload, size_t length);
     String getEspChipUniqueId();
     String bytesToHex(const uint8_t buf[], size_t size);
 };
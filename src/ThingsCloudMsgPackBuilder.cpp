@@ -0,0 +1,273 @@
+/*
+  ThingsCloudMsgPackBuilder.cpp - Fixed buffer MessagePack writer for the ThingsCloud data reports.
+  https://www.thingscloud.xyz
+*/
+
+#include "ThingsCloudMsgPackBuilder.h"
+
+void ThingsCloudMsgPackBuilder::begin(ThingsCloudMQTT *client, uint8_t *buffer, const size_t size, const char *topic)
+{
+    _client = client;
+    _length = 0;
+    _count = 0;
+    _overflowed = false;
+    _closed = false;
+
+    size_t topicSize = strlen(topic) + 1;
+    if (topicSize > size)
+    {
+        _topic = "";
+        _buffer = nullptr;
+        _size = 0;
+        _overflowed = true;
+        return;
+    }
+    memcpy(buffer, topic, topicSize);
+    _topic = (const char *)buffer;
+    _buffer = buffer + topicSize;
+    _size = size - topicSize;
+
+    // map16 header, the entry count is written by close()
+    writeByte(0xDE);
+    writeBigEndian(0, 2);
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const char *value)
+{
+    if (beginMember(key))
+        writeString(value);
+    return *this;
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const String &value)
+{
+    return add(key, value.c_str());
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const bool value)
+{
+    if (beginMember(key))
+        writeByte(value ? 0xC3 : 0xC2);
+    return *this;
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const int value)
+{
+    if (beginMember(key))
+        writeSigned(value);
+    return *this;
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const long value)
+{
+    if (beginMember(key))
+        writeSigned(value);
+    return *this;
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const unsigned int value)
+{
+    if (beginMember(key))
+        writeUnsigned(value);
+    return *this;
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const unsigned long value)
+{
+    if (beginMember(key))
+        writeUnsigned(value);
+    return *this;
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const long long value)
+{
+    if (beginMember(key))
+        writeSigned(value);
+    return *this;
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const unsigned long long value)
+{
+    if (beginMember(key))
+        writeUnsigned(value);
+    return *this;
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const float value, const uint8_t decimals)
+{
+    if (beginMember(key))
+        writeReal(value, decimals, true);
+    return *this;
+}
+
+ThingsCloudMsgPackBuilder &ThingsCloudMsgPackBuilder::add(const char *key, const double value, const uint8_t decimals)
+{
+    if (beginMember(key))
+        writeReal(value, decimals, false);
+    return *this;
+}
+
+const uint8_t *ThingsCloudMsgPackBuilder::data()
+{
+    close();
+    return _overflowed ? nullptr : _buffer;
+}
+
+bool ThingsCloudMsgPackBuilder::beginMember(const char *key)
+{
+    // Members added after send() or data() are dropped
+    if (_closed || _count == 0xFFFF)
+        _overflowed = true;
+    if (_overflowed)
+        return false;
+
+    _count++;
+    writeString(key);
+    return !_overflowed;
+}
+
+void ThingsCloudMsgPackBuilder::close()
+{
+    if (_closed || _overflowed || _buffer == nullptr)
+        return;
+
+    _buffer[1] = _count >> 8;
+    _buffer[2] = _count & 0xFF;
+    _closed = true;
+}
+
+void ThingsCloudMsgPackBuilder::writeByte(const uint8_t b)
+{
+    if (_overflowed || _length >= _size)
+    {
+        _overflowed = true;
+        return;
+    }
+    _buffer[_length++] = b;
+}
+
+void ThingsCloudMsgPackBuilder::writeBigEndian(const uint64_t value, const uint8_t bytes)
+{
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8)
+        writeByte((value >> shift) & 0xFF);
+}
+
+void ThingsCloudMsgPackBuilder::writeString(const char *str)
+{
+    size_t length = strlen(str);
+    if (length < 32)
+        writeByte(0xA0 | length);
+    else if (length <= 0xFF)
+    {
+        writeByte(0xD9);
+        writeByte(length);
+    }
+    else if (length <= 0xFFFF)
+    {
+        writeByte(0xDA);
+        writeBigEndian(length, 2);
+    }
+    else
+    {
+        _overflowed = true;
+        return;
+    }
+
+    if (_overflowed || _length + length > _size)
+    {
+        _overflowed = true;
+        return;
+    }
+    memcpy(_buffer + _length, str, length);
+    _length += length;
+}
+
+void ThingsCloudMsgPackBuilder::writeUnsigned(const uint64_t value)
+{
+    if (value < 0x80)
+        writeByte(value);
+    else if (value <= 0xFF)
+    {
+        writeByte(0xCC);
+        writeByte(value);
+    }
+    else if (value <= 0xFFFF)
+    {
+        writeByte(0xCD);
+        writeBigEndian(value, 2);
+    }
+    else if (value <= 0xFFFFFFFF)
+    {
+        writeByte(0xCE);
+        writeBigEndian(value, 4);
+    }
+    else
+    {
+        writeByte(0xCF);
+        writeBigEndian(value, 8);
+    }
+}
+
+void ThingsCloudMsgPackBuilder::writeSigned(const int64_t value)
+{
+    if (value >= 0)
+        writeUnsigned(value);
+    else if (value >= -32)
+        writeByte(0xE0 | (value & 0x1F));
+    else if (value >= INT8_MIN)
+    {
+        writeByte(0xD0);
+        writeByte(value & 0xFF);
+    }
+    else if (value >= INT16_MIN)
+    {
+        writeByte(0xD1);
+        writeBigEndian((uint64_t)value, 2);
+    }
+    else if (value >= INT32_MIN)
+    {
+        writeByte(0xD2);
+        writeBigEndian((uint64_t)value, 4);
+    }
+    else
+    {
+        writeByte(0xD3);
+        writeBigEndian((uint64_t)value, 8);
+    }
+}
+
+// Rounded to the given decimals like the JSON writer, so both formats carry the same values
+void ThingsCloudMsgPackBuilder::writeReal(double value, const uint8_t decimals, const bool singlePrecision)
+{
+    if (isnan(value) || isinf(value))
+    {
+        writeByte(0xC0);
+        return;
+    }
+
+    double scale = pow(10, decimals > 9 ? 9 : decimals);
+    if (fabs(value * scale) < 9e18)
+        value = round(value * scale) / scale;
+
+    if (value == floor(value) && fabs(value) < 9e18)
+    {
+        writeSigned((int64_t)value);
+        return;
+    }
+
+    if (singlePrecision)
+    {
+        float single = value;
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        writeByte(0xCA);
+        writeBigEndian(bits, 4);
+    }
+    else
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        writeByte(0xCB);
+        writeBigEndian(bits, 8);
+    }
+}
@@ -0,0 +1,62 @@
+/*
+  ThingsCloudMsgPackBuilder.h - Fixed buffer MessagePack writer for the ThingsCloud data reports.
+  https://www.thingscloud.xyz
+*/
+
+#ifndef ThingsCloud_MsgPackBuilder_H
+#define ThingsCloud_MsgPackBuilder_H
+
+#include <Arduino.h>
+
+class ThingsCloudMQTT;
+
+// Same API as ThingsCloudAttributesBuilder, writing a flat MessagePack map:
+//   client.beginDataMsgPack("data/env").add("temperature", 31.2).add("humidity", 62).send();
+// Integers take the smallest encoding, a number rounded to an integer is written as an integer,
+// float values as float 32 and double values as float 64. NaN and infinity are written as nil.
+// The topic is copied at the start of the buffer, so a temporary String can be given. It takes its length + 1 bytes.
+class ThingsCloudMsgPackBuilder
+{
+private:
+    ThingsCloudMQTT *_client = nullptr;
+    const char *_topic = ""; // Copy at the start of the buffer given to begin()
+    uint8_t *_buffer = nullptr; // Payload, after the topic
+    size_t _size = 0;
+    size_t _length = 0;
+    uint16_t _count = 0; // Map entries, patched in the map16 header by close()
+    bool _overflowed = false;
+    bool _closed = false;
+
+public:
+    void begin(ThingsCloudMQTT *client, uint8_t *buffer, const size_t size, const char *topic);
+
+    ThingsCloudMsgPackBuilder &add(const char *key, const char *value);
+    ThingsCloudMsgPackBuilder &add(const char *key, const String &value);
+    ThingsCloudMsgPackBuilder &add(const char *key, const bool value);
+    ThingsCloudMsgPackBuilder &add(const char *key, const int value);
+    ThingsCloudMsgPackBuilder &add(const char *key, const long value);
+    ThingsCloudMsgPackBuilder &add(const char *key, const unsigned int value);
+    ThingsCloudMsgPackBuilder &add(const char *key, const unsigned long value);
+    ThingsCloudMsgPackBuilder &add(const char *key, const long long value);
+    ThingsCloudMsgPackBuilder &add(const char *key, const unsigned long long value);
+    ThingsCloudMsgPackBuilder &add(const char *key, const float value, const uint8_t decimals = 3);
+    ThingsCloudMsgPackBuilder &add(const char *key, const double value, const uint8_t decimals = 6);
+
+    bool send(); // Publish the report, false if the buffer overflowed or the publish failed. Defined with ThingsCloudMQTT.
+
+    const uint8_t *data(); // Closed MessagePack map
+    inline size_t length() const { return _length; };
+    inline bool overflowed() const { return _overflowed; };
+
+private:
+    bool beginMember(const char *key);
+    void close();
+    void writeByte(const uint8_t b);
+    void writeBigEndian(const uint64_t value, const uint8_t bytes);
+    void writeString(const char *str);
+    void writeUnsigned(const uint64_t value);
+    void writeSigned(const int64_t value);
+    void writeReal(double value, const uint8_t decimals, const bool singlePrecision);
+};
+
+#endif
@@ -0,0 +1,476 @@
+/*
+  ThingsCloudOutbox.cpp - Store-and-forward outbox for the ThingsCloud MQTT client.
+  https://www.thingscloud.xyz
+*/
+
+#include "ThingsCloudOutbox.h"
+#include <LittleFS.h>
+
+bool ThingsCloudOutbox::begin(const size_t ramCapacity)
+{
+    _ram.assign(ramCapacity, 0);
+    _ramHead = 0;
+    _ramUsed = 0;
+    _ramCount = 0;
+    memset(_ramClassCount, 0, sizeof(_ramClassCount));
+    return true;
+}
+
+bool ThingsCloudOutbox::enableSpill(const char *path, const size_t maxBytes)
+{
+    if (!LittleFS.begin())
+        return false;
+
+    _spillPath = path;
+    _spillMaxBytes = maxBytes;
+    _spillReadOffset = 0;
+    _spillSize = 0;
+    _spillCount = 0;
+    memset(_spillClassCount, 0, sizeof(_spillClassCount));
+
+    // Messages left by a previous boot are kept. Walk the file to count them.
+    File file = LittleFS.open(path, "r");
+    if (!file)
+        return true;
+
+    size_t fileSize = file.size();
+    size_t offset = 0;
+    uint8_t buffer[SPILL_HEADER_SIZE];
+    while (file.read(buffer, SPILL_HEADER_SIZE) == SPILL_HEADER_SIZE)
+    {
+        RecordHeader header;
+        decodeHeader(buffer, header, true);
+        size_t recordSize = SPILL_HEADER_SIZE + header.topicLength + header.payloadLength;
+        if (header.magic != RECORD_MAGIC || offset + recordSize > fileSize)
+            break;
+
+        if (header.flags & RECORD_LIVE)
+        {
+            _spillCount++;
+            _spillClassCount[priorityOf(header.flags)]++;
+        }
+        offset += recordSize;
+        file.seek(offset);
+    }
+    file.close();
+
+    // A partially written record means the file can not be appended anymore
+    if (offset != fileSize)
+    {
+        _droppedCount += _spillCount;
+        spillReset();
+        return true;
+    }
+
+    _spillSize = offset;
+    spillSkipDeadRecords();
+    return true;
+}
+
+bool ThingsCloudOutbox::push(const char *topic, const uint8_t *payload, const size_t length, const bool retain, const bool replaceTopic, const PublishPriority priority)
+{
+    size_t topicLength = strlen(topic);
+    size_t recordSize = RAM_HEADER_SIZE + topicLength + length;
+    // Refuse the messages that could never be sent, they would block the ones behind them
+    if (topicLength == 0 || topicLength > _maxTopicLength || topicLength > 0xFFFF || length > 0xFFFF || recordSize > _ram.size())
+    {
+        _droppedCount++;
+        return false;
+    }
+
+    // Replace the older messages of the same topic, in RAM and in the spill file
+    if (replaceTopic)
+    {
+        ramReplaceTopic(topic, topicLength);
+        if (_spillCount > 0)
+            spillReplaceTopic(topic, topicLength);
+    }
+
+    // Make room in the ring, moving the oldest messages to the spill file when enabled
+    while (_ram.size() - _ramUsed < recordSize)
+    {
+        if (_spillPath == nullptr || !spillOldest())
+            ramDropOldest();
+    }
+
+    RecordHeader header;
+    header.magic = RECORD_MAGIC;
+    header.flags = RECORD_LIVE | (retain ? RECORD_RETAIN : 0) | ((priority << RECORD_PRIORITY_SHIFT) & RECORD_PRIORITY_MASK);
+    header.topicLength = topicLength;
+    header.payloadLength = length;
+    header.crc = 0;
+
+    uint8_t buffer[RAM_HEADER_SIZE];
+    encodeHeader(header, buffer, false);
+    size_t offset = (_ramHead + _ramUsed) % _ram.size();
+    ramWrite(offset, buffer, RAM_HEADER_SIZE);
+    ramWrite((offset + RAM_HEADER_SIZE) % _ram.size(), (const uint8_t *)topic, topicLength);
+    ramWrite((offset + RAM_HEADER_SIZE + topicLength) % _ram.size(), payload, length);
+    _ramUsed += recordSize;
+    _ramCount++;
+    _ramClassCount[priorityOf(header.flags)]++;
+    return true;
+}
+
+unsigned int ThingsCloudOutbox::getCount(const PublishPriority lowestPriority) const
+{
+    unsigned int count = 0;
+    for (int i = 0; i <= lowestPriority && i < PUBLISH_PRIORITY_COUNT; i++)
+        count += _ramClassCount[i] + _spillClassCount[i];
+    return count;
+}
+
+bool ThingsCloudOutbox::front(ThingsCloudOutboxMessage &message)
+{
+    uint8_t buffer[SPILL_HEADER_SIZE];
+    RecordHeader header;
+
+    // Oldest RAM record of the highest class
+    uint8_t ramPriority = PUBLISH_PRIORITY_COUNT;
+    size_t offset = _ramHead;
+    size_t remaining = _ramCount > 0 ? _ramUsed : 0;
+    while (remaining > 0 && ramPriority > PRIORITY_CRITICAL)
+    {
+        ramRead(offset, buffer, RAM_HEADER_SIZE);
+        decodeHeader(buffer, header, false);
+        if ((header.flags & RECORD_LIVE) && priorityOf(header.flags) < ramPriority)
+        {
+            ramPriority = priorityOf(header.flags);
+            _frontOffset = offset;
+        }
+
+        size_t size = RAM_HEADER_SIZE + header.topicLength + header.payloadLength;
+        offset = (offset + size) % _ram.size();
+        remaining -= size;
+    }
+
+    // The spill file holds the oldest messages
+    if (_spillCount > 0)
+    {
+        File file = LittleFS.open(_spillPath, "r");
+        bool valid = file && file.seek(_spillReadOffset) && file.read(buffer, SPILL_HEADER_SIZE) == SPILL_HEADER_SIZE;
+        if (valid)
+        {
+            decodeHeader(buffer, header, true);
+            valid = header.magic == RECORD_MAGIC;
+        }
+
+        if (valid && priorityOf(header.flags) <= ramPriority)
+        {
+            message.payload.resize(header.topicLength + 1);
+            valid = file.read(message.payload.data(), header.topicLength) == header.topicLength;
+            if (valid)
+            {
+                message.payload[header.topicLength] = '\0';
+                message.topic = (const char *)message.payload.data();
+                uint32_t crc = crc32(0, message.payload.data(), header.topicLength);
+
+                message.payload.resize(header.payloadLength);
+                valid = file.read(message.payload.data(), header.payloadLength) == header.payloadLength &&
+                        crc32(crc, message.payload.data(), header.payloadLength) == header.crc;
+                message.retain = header.flags & RECORD_RETAIN;
+            }
+            if (valid)
+            {
+                file.close();
+                _frontFromSpill = true;
+                return true;
+            }
+        }
+        if (file)
+            file.close();
+
+        // Corrupted file, its messages are lost
+        if (!valid)
+        {
+            _droppedCount += _spillCount;
+            spillReset();
+        }
+    }
+
+    if (ramPriority == PUBLISH_PRIORITY_COUNT)
+        return false;
+
+    ramRead(_frontOffset, buffer, RAM_HEADER_SIZE);
+    decodeHeader(buffer, header, false);
+    message.payload.resize(header.topicLength + 1);
+    ramRead((_frontOffset + RAM_HEADER_SIZE) % _ram.size(), message.payload.data(), header.topicLength);
+    message.payload[header.topicLength] = '\0';
+    message.topic = (const char *)message.payload.data();
+    message.payload.resize(header.payloadLength);
+    ramRead((_frontOffset + RAM_HEADER_SIZE + header.topicLength) % _ram.size(), message.payload.data(), header.payloadLength);
+    message.retain = header.flags & RECORD_RETAIN;
+    _frontFromSpill = false;
+    return true;
+}
+
+void ThingsCloudOutbox::pop()
+{
+    uint8_t buffer[SPILL_HEADER_SIZE];
+    RecordHeader header;
+
+    if (_frontFromSpill && _spillCount > 0)
+    {
+        // The record is marked as sent in place, so it is not sent again after a reboot
+        File file = LittleFS.open(_spillPath, "r+");
+        if (file && file.seek(_spillReadOffset) && file.read(buffer, SPILL_HEADER_SIZE) == SPILL_HEADER_SIZE)
+        {
+            decodeHeader(buffer, header, true);
+            uint8_t flags = header.flags & ~RECORD_LIVE;
+            file.seek(_spillReadOffset + 1);
+            file.write(&flags, 1);
+            _spillReadOffset += SPILL_HEADER_SIZE + header.topicLength + header.payloadLength;
+            _spillCount--;
+            _spillClassCount[priorityOf(header.flags)]--;
+        }
+        if (file)
+            file.close();
+
+        spillSkipDeadRecords();
+        return;
+    }
+
+    if (_frontFromSpill || _ramCount == 0)
+        return;
+
+    // A record sent ahead of older ones is left in place as a tombstone
+    ramRead(_frontOffset, buffer, RAM_HEADER_SIZE);
+    decodeHeader(buffer, header, false);
+    if (!(header.flags & RECORD_LIVE))
+        return;
+    _ram[(_frontOffset + 1) % _ram.size()] = header.flags & ~RECORD_LIVE;
+    _ramCount--;
+    _ramClassCount[priorityOf(header.flags)]--;
+    ramSkipDeadRecords();
+}
+
+void ThingsCloudOutbox::drop()
+{
+    pop();
+    _droppedCount++;
+}
+
+// ================== Private functions ====================-
+
+// CRC-32 (IEEE 802.3), computed bitwise to avoid a lookup table in RAM
+uint32_t ThingsCloudOutbox::crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+void ThingsCloudOutbox::encodeHeader(const RecordHeader &header, uint8_t *buffer, const bool withCrc)
+{
+    buffer[0] = header.magic;
+    buffer[1] = header.flags;
+    buffer[2] = header.topicLength >> 8;
+    buffer[3] = header.topicLength & 0xFF;
+    buffer[4] = header.payloadLength >> 8;
+    buffer[5] = header.payloadLength & 0xFF;
+    if (!withCrc)
+        return;
+    buffer[6] = header.crc >> 24;
+    buffer[7] = (header.crc >> 16) & 0xFF;
+    buffer[8] = (header.crc >> 8) & 0xFF;
+    buffer[9] = header.crc & 0xFF;
+}
+
+void ThingsCloudOutbox::decodeHeader(const uint8_t *buffer, RecordHeader &header, const bool withCrc)
+{
+    header.magic = buffer[0];
+    header.flags = buffer[1];
+    header.topicLength = (buffer[2] << 8) | buffer[3];
+    header.payloadLength = (buffer[4] << 8) | buffer[5];
+    header.crc = !withCrc ? 0 : ((uint32_t)buffer[6] << 24) | ((uint32_t)buffer[7] << 16) | ((uint32_t)buffer[8] << 8) | buffer[9];
+}
+
+void ThingsCloudOutbox::ramWrite(size_t offset, const uint8_t *data, size_t length)
+{
+    size_t firstPart = _ram.size() - offset < length ? _ram.size() - offset : length;
+    memcpy(&_ram[offset], data, firstPart);
+    memcpy(&_ram[0], data + firstPart, length - firstPart);
+}
+
+void ThingsCloudOutbox::ramRead(size_t offset, uint8_t *data, size_t length) const
+{
+    size_t firstPart = _ram.size() - offset < length ? _ram.size() - offset : length;
+    memcpy(data, &_ram[offset], firstPart);
+    memcpy(data + firstPart, &_ram[0], length - firstPart);
+}
+
+// Reclaim the space of the sent or replaced records at the head of the ring
+void ThingsCloudOutbox::ramSkipDeadRecords()
+{
+    while (_ramUsed > 0 && !(_ram[(_ramHead + 1) % _ram.size()] & RECORD_LIVE))
+        ramDropOldest();
+}
+
+void ThingsCloudOutbox::ramDropOldest()
+{
+    uint8_t buffer[RAM_HEADER_SIZE];
+    RecordHeader header;
+    ramRead(_ramHead, buffer, RAM_HEADER_SIZE);
+    decodeHeader(buffer, header, false);
+
+    if (header.flags & RECORD_LIVE)
+    {
+        _ramCount--;
+        _ramClassCount[priorityOf(header.flags)]--;
+        _droppedCount++;
+    }
+
+    size_t recordSize = RAM_HEADER_SIZE + header.topicLength + header.payloadLength;
+    _ramHead = (_ramHead + recordSize) % _ram.size();
+    _ramUsed -= recordSize;
+}
+
+// Mark the live RAM records of the topic as replaced
+void ThingsCloudOutbox::ramReplaceTopic(const char *topic, const size_t topicLength)
+{
+    size_t offset = _ramHead;
+    size_t remaining = _ramUsed;
+    uint8_t buffer[RAM_HEADER_SIZE];
+    while (remaining > 0)
+    {
+        RecordHeader header;
+        ramRead(offset, buffer, RAM_HEADER_SIZE);
+        decodeHeader(buffer, header, false);
+
+        bool sameTopic = (header.flags & RECORD_LIVE) && header.topicLength == topicLength;
+        for (size_t i = 0; i < topicLength && sameTopic; i++)
+            sameTopic = _ram[(offset + RAM_HEADER_SIZE + i) % _ram.size()] == (uint8_t)topic[i];
+        if (sameTopic)
+        {
+            _ram[(offset + 1) % _ram.size()] = header.flags & ~RECORD_LIVE;
+            _ramCount--;
+            _ramClassCount[priorityOf(header.flags)]--;
+        }
+
+        size_t size = RAM_HEADER_SIZE + header.topicLength + header.payloadLength;
+        offset = (offset + size) % _ram.size();
+        remaining -= size;
+    }
+    ramSkipDeadRecords();
+}
+
+// Mark the live spill file records of the topic as replaced, in place like the sent ones
+void ThingsCloudOutbox::spillReplaceTopic(const char *topic, const size_t topicLength)
+{
+    File file = LittleFS.open(_spillPath, "r+");
+    if (!file)
+        return;
+
+    std::vector<uint8_t> fileTopic(topicLength);
+    size_t offset = _spillReadOffset;
+    uint8_t buffer[SPILL_HEADER_SIZE];
+    while (offset < _spillSize && file.seek(offset) && file.read(buffer, SPILL_HEADER_SIZE) == SPILL_HEADER_SIZE)
+    {
+        RecordHeader header;
+        decodeHeader(buffer, header, true);
+
+        bool sameTopic = (header.flags & RECORD_LIVE) && header.topicLength == topicLength &&
+                         file.read(fileTopic.data(), topicLength) == topicLength &&
+                         memcmp(fileTopic.data(), topic, topicLength) == 0;
+        if (sameTopic)
+        {
+            uint8_t flags = header.flags & ~RECORD_LIVE;
+            file.seek(offset + 1);
+            file.write(&flags, 1);
+            _spillCount--;
+            _spillClassCount[priorityOf(header.flags)]--;
+        }
+        offset += SPILL_HEADER_SIZE + header.topicLength + header.payloadLength;
+    }
+    file.close();
+    spillSkipDeadRecords();
+}
+
+// Move the oldest RAM record to the end of the spill file, return false if the file is full
+bool ThingsCloudOutbox::spillOldest()
+{
+    uint8_t buffer[SPILL_HEADER_SIZE];
+    RecordHeader header;
+    ramRead(_ramHead, buffer, RAM_HEADER_SIZE);
+    decodeHeader(buffer, header, false);
+
+    if (header.flags & RECORD_LIVE)
+    {
+        std::vector<uint8_t> content(header.topicLength + header.payloadLength + 1);
+        ramRead((_ramHead + RAM_HEADER_SIZE) % _ram.size(), content.data(), header.topicLength + header.payloadLength);
+        header.crc = crc32(0, content.data(), header.topicLength + header.payloadLength);
+        encodeHeader(header, buffer, true);
+        if (!spillAppend(buffer, content.data(), header.topicLength + header.payloadLength))
+            return false;
+        _ramCount--;
+        _ramClassCount[priorityOf(header.flags)]--;
+        _spillClassCount[priorityOf(header.flags)]++;
+    }
+
+    size_t recordSize = RAM_HEADER_SIZE + header.topicLength + header.payloadLength;
+    _ramHead = (_ramHead + recordSize) % _ram.size();
+    _ramUsed -= recordSize;
+    return true;
+}
+
+bool ThingsCloudOutbox::spillAppend(const uint8_t *header, const uint8_t *content, size_t contentLength)
+{
+    if (_spillSize + SPILL_HEADER_SIZE + contentLength > _spillMaxBytes)
+        return false;
+
+    File file = LittleFS.open(_spillPath, "a");
+    if (!file)
+        return false;
+
+    bool success = file.write(header, SPILL_HEADER_SIZE) == SPILL_HEADER_SIZE && file.write(content, contentLength) == contentLength;
+    file.close();
+
+    // A failed write leaves a partial record, the file can not be read past it
+    if (!success)
+    {
+        _droppedCount += _spillCount;
+        spillReset();
+        return false;
+    }
+
+    _spillSize += SPILL_HEADER_SIZE + contentLength;
+    _spillCount++;
+    return true;
+}
+
+// Move the read offset to the next live record of the spill file, removing the file once fully sent
+void ThingsCloudOutbox::spillSkipDeadRecords()
+{
+    if (_spillCount == 0)
+    {
+        spillReset();
+        return;
+    }
+
+    File file = LittleFS.open(_spillPath, "r");
+    uint8_t buffer[SPILL_HEADER_SIZE];
+    while (file && _spillReadOffset < _spillSize && file.seek(_spillReadOffset) && file.read(buffer, SPILL_HEADER_SIZE) == SPILL_HEADER_SIZE)
+    {
+        RecordHeader header;
+        decodeHeader(buffer, header, true);
+        if (header.flags & RECORD_LIVE)
+            break;
+        _spillReadOffset += SPILL_HEADER_SIZE + header.topicLength + header.payloadLength;
+    }
+    if (file)
+        file.close();
+}
+
+void ThingsCloudOutbox::spillReset()
+{
+    LittleFS.remove(_spillPath);
+    _spillReadOffset = 0;
+    _spillSize = 0;
+    _spillCount = 0;
+    memset(_spillClassCount, 0, sizeof(_spillClassCount));
+}
@@ -0,0 +1,122 @@
+/*
+  ThingsCloudOutbox.h - Store-and-forward outbox for the ThingsCloud MQTT client.
+  https://www.thingscloud.xyz
+*/
+
+#ifndef ThingsCloud_Outbox_H
+#define ThingsCloud_Outbox_H
+
+#include <Arduino.h>
+#include <vector>
+
+// How the messages published on a topic are kept while disconnected
+typedef enum
+{
+    OUTBOX_KEEP_ALL = 0,    // Every message is kept and sent in order
+    OUTBOX_KEEP_LATEST = 1, // Only the latest message of the topic is kept
+    OUTBOX_DISCARD = 2      // Messages are dropped, as without outbox
+} OutboxRetention;
+
+// Priority class of an outgoing message, the higher classes are sent first
+typedef enum
+{
+    PRIORITY_CRITICAL = 0,      // Alarms and events
+    PRIORITY_COMMAND_REPLY = 1, // Replies to the commands
+    PRIORITY_ATTRIBUTE = 2,     // Attributes reports
+    PRIORITY_BULK = 3           // Bulk data
+} PublishPriority;
+
+#define PUBLISH_PRIORITY_COUNT 4
+
+struct ThingsCloudOutboxMessage
+{
+    String topic;
+    std::vector<uint8_t> payload;
+    bool retain;
+};
+
+// Bounded queue of outgoing messages: a RAM ring, optionally spilled to a LittleFS file when the ring is full.
+// Messages are sent by priority class, in order within a class. The spill file is read in order, its next message
+// is only passed by the RAM messages of a higher class.
+// The spill file records are protected by a CRC32, appended to the header when a record is moved to the file and checked
+// when read back. The RAM records go without it, they can not be corrupted by a power loss.
+// Replacing the messages of a topic (OUTBOX_KEEP_LATEST) also marks its older records of the spill file as sent, at the
+// cost of reading the file on every push of such a topic while it holds messages.
+class ThingsCloudOutbox
+{
+private:
+    // Record header, followed by the topic and the payload
+    static const uint8_t RECORD_MAGIC = 0xA5;
+    static const uint8_t RECORD_LIVE = 0x01;   // Cleared once the record is sent or replaced
+    static const uint8_t RECORD_RETAIN = 0x02; // MQTT retain flag of the message
+    static const uint8_t RECORD_PRIORITY_SHIFT = 2; // Priority class in bits 2 and 3
+    static const uint8_t RECORD_PRIORITY_MASK = 0x0C;
+    static const size_t RAM_HEADER_SIZE = 6;   // magic, flags, topic length (2), payload length (2)
+    static const size_t SPILL_HEADER_SIZE = 10; // RAM header followed by the CRC32 (4) of the topic and the payload
+
+    struct RecordHeader
+    {
+        uint8_t magic;
+        uint8_t flags;
+        uint16_t topicLength;
+        uint16_t payloadLength;
+        uint32_t crc; // Spill file only
+    };
+
+    // RAM ring, records may wrap around its end
+    std::vector<uint8_t> _ram;
+    size_t _ramHead = 0; // Oldest record
+    size_t _ramUsed = 0;
+    unsigned int _ramCount = 0; // Live records
+    unsigned int _ramClassCount[PUBLISH_PRIORITY_COUNT] = {0};
+
+    // LittleFS spill file, always holds older records than the RAM ring
+    const char *_spillPath = nullptr;
+    size_t _spillMaxBytes = 0;
+    size_t _spillReadOffset = 0;
+    size_t _spillSize = 0;
+    unsigned int _spillCount = 0;
+    unsigned int _spillClassCount[PUBLISH_PRIORITY_COUNT] = {0};
+
+    // Record returned by front(), removed by pop()
+    bool _frontFromSpill = false;
+    size_t _frontOffset = 0;
+
+    unsigned long _droppedCount = 0;
+    size_t _maxTopicLength = 0xFFFF; // Longest topic the MQTT client can send
+
+public:
+    bool begin(const size_t ramCapacity);
+    bool enableSpill(const char *path, const size_t maxBytes);
+
+    bool push(const char *topic, const uint8_t *payload, const size_t length, const bool retain, const bool replaceTopic, const PublishPriority priority = PRIORITY_BULK);
+    bool front(ThingsCloudOutboxMessage &message); // Copy the next message to send, false if empty
+    void pop();                                    // Remove the message returned by front()
+    void drop();                                   // Remove the message returned by front(), counted as lost
+    inline void setMaxTopicLength(const size_t length) { _maxTopicLength = length; }; // Longer topics are refused by push()
+
+    inline bool isEnabled() const { return !_ram.empty(); };
+    inline bool isEmpty() const { return _ramCount == 0 && _spillCount == 0; };
+    inline unsigned int getCount() const { return _ramCount + _spillCount; };
+    unsigned int getCount(const PublishPriority lowestPriority) const; // Messages of this class or higher
+    inline unsigned long getDroppedCount() const { return _droppedCount; }; // Messages lost because the outbox was full or corrupted
+
+private:
+    static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length);
+    static void encodeHeader(const RecordHeader &header, uint8_t *buffer, const bool withCrc);
+    static void decodeHeader(const uint8_t *buffer, RecordHeader &header, const bool withCrc);
+    static inline uint8_t priorityOf(const uint8_t flags) { return (flags & RECORD_PRIORITY_MASK) >> RECORD_PRIORITY_SHIFT; };
+
+    void ramWrite(size_t offset, const uint8_t *data, size_t length);
+    void ramRead(size_t offset, uint8_t *data, size_t length) const;
+    void ramSkipDeadRecords();
+    void ramDropOldest();
+    void ramReplaceTopic(const char *topic, const size_t topicLength);
+    void spillReplaceTopic(const char *topic, const size_t topicLength);
+    bool spillOldest();
+    bool spillAppend(const uint8_t *header, const uint8_t *content, size_t contentLength);
+    void spillSkipDeadRecords();
+    void spillReset();
+};
+
+#endif
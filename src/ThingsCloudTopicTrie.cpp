@@ -0,0 +1,147 @@
+/*
+  ThingsCloudTopicTrie.cpp - Subscription filter matching for the ThingsCloud MQTT client.
+  https://www.thingscloud.xyz
+*/
+
+#include "ThingsCloudTopicTrie.h"
+#include <algorithm>
+
+void ThingsCloudTopicTrie::clear()
+{
+    _nodes.clear();
+}
+
+// Add a subscription filter to the trie, one node per topic level. '+' and '#' levels get their own dedicated child.
+void ThingsCloudTopicTrie::insert(const String &filter, uint16_t recordIndex)
+{
+    if (_nodes.empty())
+        _nodes.push_back({String(), {}, -1, -1, {}});
+
+    uint16_t nodeIndex = 0;
+    int segmentStart = 0;
+    while (true)
+    {
+        int segmentEnd = filter.indexOf('/', segmentStart);
+        if (segmentEnd < 0)
+            segmentEnd = filter.length();
+        String segment = filter.substring(segmentStart, segmentEnd);
+
+        int childIndex = -1;
+        if (segment.equals("+"))
+            childIndex = _nodes[nodeIndex].plusChild;
+        else if (segment.equals("#"))
+            childIndex = _nodes[nodeIndex].hashChild;
+        else
+        {
+            for (std::size_t i = 0; i < _nodes[nodeIndex].children.size() && childIndex < 0; i++)
+            {
+                if (_nodes[_nodes[nodeIndex].children[i]].segment.equals(segment))
+                    childIndex = _nodes[nodeIndex].children[i];
+            }
+        }
+
+        if (childIndex < 0)
+        {
+            childIndex = _nodes.size();
+            _nodes.push_back({segment, {}, -1, -1, {}});
+            if (segment.equals("+"))
+                _nodes[nodeIndex].plusChild = childIndex;
+            else if (segment.equals("#"))
+                _nodes[nodeIndex].hashChild = childIndex;
+            else
+                _nodes[nodeIndex].children.push_back(childIndex);
+        }
+        nodeIndex = childIndex;
+
+        if (segmentEnd >= (int)filter.length())
+            break;
+        segmentStart = segmentEnd + 1;
+    }
+
+    _nodes[nodeIndex].records.push_back(recordIndex);
+}
+
+const std::vector<uint16_t> &ThingsCloudTopicTrie::match(const char *topic)
+{
+    _matches.clear();
+    if (!_nodes.empty())
+        matchNode(0, topic, topic);
+    std::sort(_matches.begin(), _matches.end());
+    return _matches;
+}
+
+// Walk the filter and the topic level by level, without building the trie
+bool ThingsCloudTopicTrie::filterMatches(const char *filter, const char *topic)
+{
+    // Wildcards at the first level must not match topics beginning with '$'
+    if ((filter[0] == '+' || filter[0] == '#') && topic[0] == '$')
+        return false;
+
+    const char *segment = topic;
+    while (true)
+    {
+        const char *filterEnd = strchr(filter, '/');
+        size_t filterLength = filterEnd != nullptr ? filterEnd - filter : strlen(filter);
+
+        // '#' matches the parent level and any number of child levels
+        if (filterLength == 1 && filter[0] == '#')
+            return true;
+        if (segment == nullptr)
+            return false;
+
+        const char *segmentEnd = strchr(segment, '/');
+        size_t segmentLength = segmentEnd != nullptr ? segmentEnd - segment : strlen(segment);
+        bool plus = filterLength == 1 && filter[0] == '+';
+        if (!plus && (filterLength != segmentLength || memcmp(filter, segment, segmentLength) != 0))
+            return false;
+
+        segment = segmentEnd != nullptr ? segmentEnd + 1 : nullptr;
+        if (filterEnd == nullptr)
+            return segment == nullptr;
+        filter = filterEnd + 1;
+    }
+}
+
+// ================== Private functions ====================-
+
+/**
+ * Collect in _matches the records matching an inbound topic, without any allocation.
+ *
+ * @param nodeIndex is the trie node already matched by the previous topic levels
+ * @param topic is the full inbound topic, it must not contain wildcards
+ * @param segment is the start of the next topic level, nullptr once every level has been consumed
+ */
+void ThingsCloudTopicTrie::matchNode(uint16_t nodeIndex, const char *topic, const char *segment)
+{
+    const Node &node = _nodes[nodeIndex];
+
+    // Wildcards at the first level must not match topics beginning with '$'
+    bool wildcardAllowed = !(nodeIndex == 0 && topic[0] == '$');
+
+    // '#' matches the parent level and any number of child levels
+    if (node.hashChild >= 0 && wildcardAllowed)
+    {
+        const Node &hashNode = _nodes[node.hashChild];
+        _matches.insert(_matches.end(), hashNode.records.begin(), hashNode.records.end());
+    }
+
+    if (segment == nullptr)
+    {
+        _matches.insert(_matches.end(), node.records.begin(), node.records.end());
+        return;
+    }
+
+    const char *segmentEnd = strchr(segment, '/');
+    size_t segmentLength = segmentEnd != nullptr ? segmentEnd - segment : strlen(segment);
+    const char *nextSegment = segmentEnd != nullptr ? segmentEnd + 1 : nullptr;
+
+    for (std::size_t i = 0; i < node.children.size(); i++)
+    {
+        const String &childSegment = _nodes[node.children[i]].segment;
+        if (childSegment.length() == segmentLength && memcmp(childSegment.c_str(), segment, segmentLength) == 0)
+            matchNode(node.children[i], topic, nextSegment);
+    }
+
+    if (node.plusChild >= 0 && wildcardAllowed)
+        matchNode(node.plusChild, topic, nextSegment);
+}
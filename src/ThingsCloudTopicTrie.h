@@ -0,0 +1,44 @@
+/*
+  ThingsCloudTopicTrie.h - Subscription filter matching for the ThingsCloud MQTT client.
+  https://www.thingscloud.xyz
+*/
+
+#ifndef ThingsCloud_TopicTrie_H
+#define ThingsCloud_TopicTrie_H
+
+#include <Arduino.h>
+#include <vector>
+
+// Subscription filters compiled into a segment trie, so that an inbound topic is matched in one pass.
+// Each filter is stored with the index of its subscription record, several filters may share an index.
+// '+' matches one level, '#' the parent level and any number of child levels. Wildcards at the first level
+// never match the topics beginning with '$'.
+class ThingsCloudTopicTrie
+{
+private:
+    // Node 0 is the root
+    struct Node
+    {
+        String segment;
+        std::vector<uint16_t> children; // Literal segment children
+        int16_t plusChild;              // Child for the '+' wildcard, -1 if none
+        int16_t hashChild;              // Child for the '#' wildcard, -1 if none
+        std::vector<uint16_t> records;  // Record indexes whose filter ends here
+    };
+    std::vector<Node> _nodes;
+    std::vector<uint16_t> _matches; // Reused by every match(), no allocation once warmed up
+
+public:
+    void clear();
+    void insert(const String &filter, uint16_t recordIndex);
+    // Record indexes of the filters matching the topic, in increasing order. Valid until the next call.
+    const std::vector<uint16_t> &match(const char *topic);
+
+    // True if a single filter matches the topic, with the same rules as the trie
+    static bool filterMatches(const char *filter, const char *topic);
+
+private:
+    void matchNode(uint16_t nodeIndex, const char *topic, const char *segment);
+};
+
+#endif
@@ -0,0 +1,405 @@
+/*
+  LoopbackServers.h - MQTT broker and HTTP server on the loopback interface, for the native tests.
+  They never block: the tests poll them between two loop() calls of the client, see ThingsCloudTestHarness.h.
+*/
+
+#ifndef ThingsCloud_Test_LoopbackServers_H
+#define ThingsCloud_Test_LoopbackServers_H
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+#include <errno.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Listening socket and the one connection it serves, polled by pollLoopbackServers()
+class LoopbackServer
+{
+public:
+    static std::vector<LoopbackServer *> &servers()
+    {
+        static std::vector<LoopbackServer *> list;
+        return list;
+    }
+
+    // Port 0 picks a free port
+    explicit LoopbackServer(uint16_t port)
+    {
+        _listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int enable = 1;
+        setsockopt(_listenSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        socklen_t length = sizeof(address);
+        if (bind(_listenSocket, (struct sockaddr *)&address, length) < 0 || listen(_listenSocket, 4) < 0 ||
+            getsockname(_listenSocket, (struct sockaddr *)&address, &length) < 0)
+        {
+            close(_listenSocket);
+            _listenSocket = -1;
+        }
+        else
+        {
+            _port = ntohs(address.sin_port);
+            fcntl(_listenSocket, F_SETFL, fcntl(_listenSocket, F_GETFL, 0) | O_NONBLOCK);
+        }
+        servers().push_back(this);
+    }
+
+    virtual ~LoopbackServer()
+    {
+        shutdown();
+        std::vector<LoopbackServer *>::iterator it = std::find(servers().begin(), servers().end(), this);
+        if (it != servers().end())
+            servers().erase(it);
+    }
+
+    // Close the sockets of every server. A failed assertion leaves its test with a longjmp,
+    // skipping the destructors of the servers on its stack: tearDown() releases their ports.
+    static void shutdownAll()
+    {
+        for (LoopbackServer *server : servers())
+            server->shutdown();
+        servers().clear();
+    }
+
+    void shutdown()
+    {
+        closeClient();
+        if (_listenSocket >= 0)
+            close(_listenSocket);
+        _listenSocket = -1;
+    }
+
+    inline bool listening() const { return _listenSocket >= 0; }
+    inline uint16_t port() const { return _port; }
+    inline bool clientConnected() const { return _client >= 0; }
+    inline unsigned int acceptCount() const { return _acceptCount; }
+
+    // Drop the connection, like a broker restart or a network outage
+    void closeClient()
+    {
+        if (_client >= 0)
+            close(_client);
+        _client = -1;
+        _received.clear();
+    }
+
+    // Accept the new connection, a new one replaces the previous, then read what was received
+    void poll()
+    {
+        if (_listenSocket < 0)
+            return;
+        int client = accept(_listenSocket, nullptr, nullptr);
+        if (client >= 0)
+        {
+            closeClient();
+            _client = client;
+            _acceptCount++;
+            fcntl(_client, F_SETFL, fcntl(_client, F_GETFL, 0) | O_NONBLOCK);
+            // No Nagle delay: the clock is virtual, a packet held until the peer ACKs would miss the loop() calls
+            int noDelay = 1;
+            setsockopt(_client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            onAccepted();
+        }
+        if (_client < 0)
+            return;
+
+        uint8_t buffer[512];
+        ssize_t count;
+        while ((count = recv(_client, buffer, sizeof(buffer), 0)) > 0)
+            _received.insert(_received.end(), buffer, buffer + count);
+        if (count == 0)
+        {
+            onReceived();
+            closeClient();
+            return;
+        }
+        onReceived();
+    }
+
+protected:
+    std::vector<uint8_t> _received; // Received bytes not consumed yet
+
+    void send(const std::vector<uint8_t> &bytes)
+    {
+        if (_client >= 0)
+            ::send(_client, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+    }
+    virtual void onAccepted() {}
+    virtual void onReceived() = 0;
+
+private:
+    int _listenSocket = -1;
+    int _client = -1;
+    uint16_t _port = 0;
+    unsigned int _acceptCount = 0;
+};
+
+inline void pollLoopbackServers()
+{
+    for (LoopbackServer *server : LoopbackServer::servers())
+        server->poll();
+}
+
+// MQTT 3.1.1 broker for one client: CONNECT, SUBSCRIBE, UNSUBSCRIBE, PUBLISH QoS 0 and 1, PINGREQ and DISCONNECT.
+// It records what the client sends, and publishes to it on demand.
+class LoopbackBroker : public LoopbackServer
+{
+public:
+    struct Publish
+    {
+        std::string topic;
+        std::string payload;
+        uint8_t qos;
+        bool retain;
+        bool dup;
+        uint16_t packetId;
+    };
+
+    // Behaviour, set by the tests
+    uint8_t connackCode = 0;      // CONNACK return code, 0 accepts the connection
+    bool answerConnect = true;    // No CONNACK at all when false
+    bool acknowledgePublish = true; // PUBACK the QoS 1 messages right away
+
+    // Seen from the client
+    unsigned int connectCount = 0;
+    unsigned int disconnectCount = 0; // DISCONNECT packets, not closed connections
+    unsigned int pingCount = 0;
+    std::string clientId;
+    std::string username;
+    std::string password;
+    std::vector<Publish> published;
+    std::vector<std::string> subscriptions; // Current filters, in subscription order
+    std::vector<std::string> unsubscribed;
+
+    explicit LoopbackBroker(uint16_t port = 1883) : LoopbackServer(port) {}
+
+    // Deliver a message to the client
+    void publish(const std::string &topic, const std::string &payload, uint8_t qos = 0, uint16_t packetId = 1)
+    {
+        std::vector<uint8_t> body;
+        appendString(body, topic);
+        if (qos > 0)
+        {
+            body.push_back(packetId >> 8);
+            body.push_back(packetId & 0xFF);
+        }
+        body.insert(body.end(), payload.begin(), payload.end());
+        sendPacket(0x30 | (qos << 1), body);
+    }
+
+    void sendPubAck(uint16_t packetId) { sendPacket(0x40, {(uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xFF)}); }
+
+    // Published messages on a topic
+    std::vector<Publish> publishedOn(const std::string &topic) const
+    {
+        std::vector<Publish> messages;
+        for (const Publish &message : published)
+            if (message.topic == topic)
+                messages.push_back(message);
+        return messages;
+    }
+
+    bool subscribed(const std::string &filter) const { return std::find(subscriptions.begin(), subscriptions.end(), filter) != subscriptions.end(); }
+
+protected:
+    void onReceived() override
+    {
+        size_t offset = 0;
+        while (true)
+        {
+            // Fixed header: type and flags, then the remaining length on up to 4 bytes
+            size_t position = offset + 1;
+            uint32_t length = 0;
+            uint8_t shift = 0;
+            bool complete = false;
+            while (position < _received.size() && shift <= 21)
+            {
+                uint8_t b = _received[position++];
+                length |= (uint32_t)(b & 0x7F) << shift;
+                shift += 7;
+                if ((b & 0x80) == 0)
+                {
+                    complete = true;
+                    break;
+                }
+            }
+            if (!complete || _received.size() - position < length)
+                break;
+
+            handlePacket(_received[offset], std::vector<uint8_t>(_received.begin() + position, _received.begin() + position + length));
+            offset = position + length;
+        }
+        _received.erase(_received.begin(), _received.begin() + std::min(offset, _received.size()));
+    }
+
+private:
+    static void appendString(std::vector<uint8_t> &bytes, const std::string &str)
+    {
+        bytes.push_back(str.size() >> 8);
+        bytes.push_back(str.size() & 0xFF);
+        bytes.insert(bytes.end(), str.begin(), str.end());
+    }
+
+    static std::string readString(const std::vector<uint8_t> &bytes, size_t &position)
+    {
+        if (position + 2 > bytes.size())
+            return "";
+        size_t length = (bytes[position] << 8) | bytes[position + 1];
+        position += 2;
+        length = std::min(length, bytes.size() - position);
+        std::string str(bytes.begin() + position, bytes.begin() + position + length);
+        position += length;
+        return str;
+    }
+
+    void sendPacket(uint8_t header, const std::vector<uint8_t> &body)
+    {
+        std::vector<uint8_t> packet = {header};
+        size_t length = body.size();
+        do
+        {
+            uint8_t b = length & 0x7F;
+            length >>= 7;
+            packet.push_back(length > 0 ? (b | 0x80) : b);
+        } while (length > 0);
+        packet.insert(packet.end(), body.begin(), body.end());
+        send(packet);
+    }
+
+    void handlePacket(uint8_t header, const std::vector<uint8_t> &body)
+    {
+        size_t position = 0;
+        switch (header >> 4)
+        {
+        case 1: // CONNECT
+        {
+            readString(body, position); // Protocol name
+            position += 1;              // Level
+            uint8_t flags = position < body.size() ? body[position] : 0;
+            position += 3; // Flags and keep alive
+            clientId = readString(body, position);
+            if (flags & 0x04)
+            {
+                readString(body, position);
+                readString(body, position);
+            }
+            username = (flags & 0x80) ? readString(body, position) : "";
+            password = (flags & 0x40) ? readString(body, position) : "";
+            connectCount++;
+            subscriptions.clear();
+            if (answerConnect)
+                sendPacket(0x20, {0x00, connackCode});
+            break;
+        }
+
+        case 3: // PUBLISH
+        {
+            Publish message;
+            message.qos = (header >> 1) & 0x03;
+            message.retain = header & 0x01;
+            message.dup = header & 0x08;
+            message.topic = readString(body, position);
+            message.packetId = 0;
+            if (message.qos > 0 && position + 2 <= body.size())
+            {
+                message.packetId = (body[position] << 8) | body[position + 1];
+                position += 2;
+            }
+            message.payload.assign(body.begin() + std::min(position, body.size()), body.end());
+            published.push_back(message);
+            if (message.qos == 1 && acknowledgePublish)
+                sendPubAck(message.packetId);
+            break;
+        }
+
+        case 8: // SUBSCRIBE
+        {
+            if (body.size() < 2)
+                break;
+            std::vector<uint8_t> suback = {body[0], body[1]};
+            position = 2;
+            while (position < body.size())
+            {
+                std::string filter = readString(body, position);
+                uint8_t qos = position < body.size() ? body[position++] : 0;
+                if (!subscribed(filter))
+                    subscriptions.push_back(filter);
+                suback.push_back(qos > 1 ? 1 : qos);
+            }
+            sendPacket(0x90, suback);
+            break;
+        }
+
+        case 10: // UNSUBSCRIBE
+        {
+            if (body.size() < 2)
+                break;
+            position = 2;
+            while (position < body.size())
+            {
+                std::string filter = readString(body, position);
+                unsubscribed.push_back(filter);
+                subscriptions.erase(std::remove(subscriptions.begin(), subscriptions.end(), filter), subscriptions.end());
+            }
+            sendPacket(0xB0, {body[0], body[1]});
+            break;
+        }
+
+        case 12: // PINGREQ
+            pingCount++;
+            sendPacket(0xD0, {});
+            break;
+
+        case 14: // DISCONNECT
+            disconnectCount++;
+            break;
+
+        default:
+            break;
+        }
+    }
+};
+
+// HTTP server answering each request with the same response, then closing the connection (HTTP/1.0)
+class LoopbackHttpServer : public LoopbackServer
+{
+public:
+    std::string response = "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\n\r\n{}";
+    std::vector<std::string> requests; // Whole requests, headers and body
+
+    explicit LoopbackHttpServer(uint16_t port = 0) : LoopbackServer(port) {}
+
+    // Answer with the status line and the body
+    void respond(const std::string &status, const std::string &body)
+    {
+        response = "HTTP/1.0 " + status + "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    }
+
+protected:
+    void onReceived() override
+    {
+        std::string received(_received.begin(), _received.end());
+        size_t headersEnd = received.find("\r\n\r\n");
+        if (headersEnd == std::string::npos)
+            return;
+        size_t contentLength = 0;
+        size_t header = received.find("Content-Length: ");
+        if (header != std::string::npos && header < headersEnd)
+            contentLength = strtoul(received.c_str() + header + strlen("Content-Length: "), nullptr, 10);
+        if (received.size() < headersEnd + 4 + contentLength)
+            return;
+
+        requests.push_back(received);
+        std::vector<uint8_t> bytes(response.begin(), response.end());
+        send(bytes);
+        closeClient();
+    }
+};
+
+#endif
@@ -0,0 +1,100 @@
+/*
+  ThingsCloudTestHarness.h - Shared scaffolding of the native test suites, included once by each suite.
+  setUp() and tearDown() give every test a fresh host: clock at 0, WiFi connected, no file, the loopback hosts in the DNS.
+*/
+
+#ifndef ThingsCloud_Test_Harness_H
+#define ThingsCloud_Test_Harness_H
+
+#include <unity.h>
+#include <Arduino.h>
+#include <WiFi.h>
+#include <LittleFS.h>
+#include <lwip/dns.h>
+#include <ThingsCloudMQTT.h>
+#include "LoopbackServers.h"
+#include <filesystem>
+
+// Names answered by the DNS stub, on the loopback interface
+#define TEST_BROKER_HOST "mqtt.loopback.test"
+#define TEST_API_HOST "api.loopback.test"
+
+// Called by ThingsCloudMQTT when no other handler is set, normally defined by the sketch
+void onMQTTConnect()
+{
+}
+
+// Remove the files written by the tests, see LittleFSStub::hostPath()
+inline void removeTestFiles()
+{
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(std::filesystem::temp_directory_path(), error))
+    {
+        if (entry.path().filename().string().rfind("thingscloud_test_", 0) == 0)
+            std::filesystem::remove(entry.path(), error);
+    }
+}
+
+inline void resetHost()
+{
+    hostMillis = 0;
+    WiFi = WiFiClass();
+    WiFi.hostStatus = WL_CONNECTED;
+    WiFiGenericClass::hostMode = WIFI_MODE_STA;
+    hostDnsTable.clear();
+    hostDnsTable[TEST_BROKER_HOST] = htonl(INADDR_LOOPBACK);
+    hostDnsTable[TEST_API_HOST] = htonl(INADDR_LOOPBACK);
+    hostDnsQueryCount = 0;
+    ESP.restartCount = 0;
+    removeTestFiles();
+}
+
+// Defined by the suites that prepare their own state before each test
+void setUpTest(void) __attribute__((weak));
+
+void setUp(void)
+{
+    resetHost();
+    if (setUpTest)
+        setUpTest();
+}
+
+void tearDown(void)
+{
+    LoopbackServer::shutdownAll();
+    removeTestFiles();
+}
+
+// Advance the clock by step milliseconds per loop() call, serving the loopback servers in between.
+// Stop as soon as done() returns true, return false if it did not within maxMillis.
+template <typename Done>
+bool loopUntil(ThingsCloudMQTT &client, const unsigned long maxMillis, Done done, const unsigned long step = 10)
+{
+    unsigned long start = millis();
+    while (true)
+    {
+        pollLoopbackServers();
+        client.loop();
+        pollLoopbackServers();
+        if (done())
+            return true;
+        if (millis() - start >= maxMillis)
+            return false;
+        hostMillis += step;
+    }
+}
+
+inline void loopFor(ThingsCloudMQTT &client, const unsigned long millis, const unsigned long step = 10)
+{
+    loopUntil(client, millis, []
+              { return false; }, step);
+}
+
+// Connect to the loopback broker, false if not connected within maxMillis
+inline bool connectClient(ThingsCloudMQTT &client, const unsigned long maxMillis = 120000)
+{
+    return loopUntil(client, maxMillis, [&client]
+                     { return client.isMqttConnected(); });
+}
+
+#endif
@@ -0,0 +1,507 @@
+/*
+  Arduino.h - Host stub of the Arduino core, for the native unit tests.
+  String, Print, Stream, IPAddress, Serial and the ESP object, with a clock moved by the tests.
+*/
+
+#ifndef ThingsCloud_Test_Arduino_H
+#define ThingsCloud_Test_Arduino_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include <functional>
+
+using std::max;
+using std::min;
+
+// Arduino-ESP32 2.x, the WiFi manager then uses the Arduino events
+#define ESP_ARDUINO_VERSION_VAL(major, minor, patch) ((major << 16) | (minor << 8) | (patch))
+#define ESP_ARDUINO_VERSION ESP_ARDUINO_VERSION_VAL(2, 0, 14)
+
+inline const char *esp_get_idf_version() { return "host"; }
+
+// Heap of the board, a fixed healthy one
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+typedef struct
+{
+    size_t total_free_bytes;
+    size_t total_allocated_bytes;
+    size_t largest_free_block;
+    size_t minimum_free_bytes;
+    size_t allocated_blocks;
+    size_t free_blocks;
+    size_t total_blocks;
+} multi_heap_info_t;
+
+inline void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps)
+{
+    (void)caps;
+    *info = {200000, 100000, 110000, 180000, 100, 10, 110};
+}
+
+inline float temperatureRead() { return 45.0f; }
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// No flash address space on the host
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define F(s) (s)
+#define FPSTR(p) ((const char *)(p))
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define memcpy_P memcpy
+
+// Virtual clock: only delay() and the tests move it, so that timeouts and backoffs are deterministic
+inline unsigned long hostMillis = 0;
+
+inline unsigned long millis() { return hostMillis; }
+inline unsigned long micros() { return hostMillis * 1000; }
+inline void delay(unsigned long ms) { hostMillis += ms; }
+inline void yield() {}
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax)
+{
+    return inMax == inMin ? outMin : (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+#define constrain(amount, low, high) ((amount) < (low) ? (low) : ((amount) > (high) ? (high) : (amount)))
+
+inline long random(long howbig) { return howbig > 0 ? ::random() % howbig : 0; }
+inline long random(long howsmall, long howbig) { return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall); }
+inline void randomSeed(unsigned long seed) { srandom(seed); }
+
+class String
+{
+private:
+    std::string _str;
+
+    // Safe bool of the Arduino core: true for any string, even empty
+    typedef void (String::*StringIfHelperType)() const;
+    void StringIfHelper() const {}
+
+    static std::string number(unsigned long long value, unsigned char base)
+    {
+        if (base < 2 || base > 36)
+            base = 10;
+        std::string digits;
+        do
+        {
+            digits.insert(digits.begin(), "0123456789abcdefghijklmnopqrstuvwxyz"[value % base]);
+            value /= base;
+        } while (value > 0);
+        return digits;
+    }
+    static std::string number(long long value, unsigned char base)
+    {
+        if (value < 0 && base == 10)
+            return "-" + number((unsigned long long)-value, base);
+        return number((unsigned long long)value, base);
+    }
+
+public:
+    String() {}
+    String(const char *str) : _str(str != nullptr ? str : "") {}
+    String(const std::string &str) : _str(str) {}
+    explicit String(char c) : _str(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10) : _str(number((unsigned long long)value, base)) {}
+    explicit String(int value, unsigned char base = 10) : _str(number((long long)value, base)) {}
+    explicit String(unsigned int value, unsigned char base = 10) : _str(number((unsigned long long)value, base)) {}
+    explicit String(long value, unsigned char base = 10) : _str(number((long long)value, base)) {}
+    explicit String(unsigned long value, unsigned char base = 10) : _str(number((unsigned long long)value, base)) {}
+    explicit String(long long value, unsigned char base = 10) : _str(number(value, base)) {}
+    explicit String(unsigned long long value, unsigned char base = 10) : _str(number(value, base)) {}
+    explicit String(float value, unsigned int decimals = 2) : String((double)value, decimals) {}
+    explicit String(double value, unsigned int decimals = 2)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+        _str = buffer;
+    }
+
+    inline operator StringIfHelperType() const { return &String::StringIfHelper; }
+
+    inline const char *c_str() const { return _str.c_str(); }
+    inline unsigned int length() const { return _str.length(); }
+    inline bool isEmpty() const { return _str.empty(); }
+    inline bool reserve(unsigned int size)
+    {
+        _str.reserve(size);
+        return true;
+    }
+
+    inline bool concat(const String &other)
+    {
+        _str += other._str;
+        return true;
+    }
+    inline bool concat(const char *str)
+    {
+        if (str == nullptr)
+            return false;
+        _str += str;
+        return true;
+    }
+    inline bool concat(const char *str, unsigned int length)
+    {
+        if (str == nullptr)
+            return false;
+        _str.append(str, length);
+        return true;
+    }
+    inline bool concat(char c)
+    {
+        _str += c;
+        return true;
+    }
+    template <typename T>
+    inline bool concat(T value) { return concat(String(value)); }
+
+    inline String &operator+=(const String &other)
+    {
+        concat(other);
+        return *this;
+    }
+    inline String &operator+=(const char *str)
+    {
+        concat(str);
+        return *this;
+    }
+    inline String &operator+=(char c)
+    {
+        concat(c);
+        return *this;
+    }
+    template <typename T>
+    inline String &operator+=(T value)
+    {
+        concat(value);
+        return *this;
+    }
+
+    inline bool equals(const String &other) const { return _str == other._str; }
+    inline bool equals(const char *other) const { return other != nullptr && _str == other; }
+    inline bool equalsIgnoreCase(const String &other) const
+    {
+        return _str.size() == other._str.size() && strcasecmp(_str.c_str(), other._str.c_str()) == 0;
+    }
+    inline bool operator==(const String &other) const { return equals(other); }
+    inline bool operator==(const char *other) const { return equals(other); }
+    inline bool operator!=(const String &other) const { return !equals(other); }
+    inline bool operator!=(const char *other) const { return !equals(other); }
+    inline bool operator<(const String &other) const { return _str < other._str; }
+    inline int compareTo(const String &other) const { return _str.compare(other._str); }
+
+    inline char charAt(unsigned int index) const { return index < _str.size() ? _str[index] : 0; }
+    inline char operator[](unsigned int index) const { return charAt(index); }
+    inline char &operator[](unsigned int index) { return _str[index]; }
+    inline void setCharAt(unsigned int index, char c)
+    {
+        if (index < _str.size())
+            _str[index] = c;
+    }
+    inline bool startsWith(const String &prefix) const { return _str.compare(0, prefix._str.size(), prefix._str) == 0; }
+    inline bool endsWith(const String &suffix) const
+    {
+        return _str.size() >= suffix._str.size() && _str.compare(_str.size() - suffix._str.size(), suffix._str.size(), suffix._str) == 0;
+    }
+
+    int indexOf(char c, unsigned int fromIndex = 0) const
+    {
+        size_t index = _str.find(c, fromIndex);
+        return index == std::string::npos ? -1 : (int)index;
+    }
+    int indexOf(const String &str, unsigned int fromIndex = 0) const
+    {
+        size_t index = _str.find(str._str, fromIndex);
+        return index == std::string::npos ? -1 : (int)index;
+    }
+    int lastIndexOf(char c) const
+    {
+        size_t index = _str.rfind(c);
+        return index == std::string::npos ? -1 : (int)index;
+    }
+
+    String substring(unsigned int beginIndex) const { return substring(beginIndex, _str.length()); }
+    String substring(unsigned int beginIndex, unsigned int endIndex) const
+    {
+        if (beginIndex > endIndex)
+            std::swap(beginIndex, endIndex);
+        if (beginIndex > _str.length())
+            return String();
+        return String(_str.substr(beginIndex, endIndex - beginIndex));
+    }
+
+    void replace(const String &find, const String &replacement)
+    {
+        if (find._str.empty())
+            return;
+        size_t index = 0;
+        while ((index = _str.find(find._str, index)) != std::string::npos)
+        {
+            _str.replace(index, find._str.size(), replacement._str);
+            index += replacement._str.size();
+        }
+    }
+    void replace(char find, char replacement) { std::replace(_str.begin(), _str.end(), find, replacement); }
+    void remove(unsigned int index) { remove(index, (unsigned int)-1); }
+    void remove(unsigned int index, unsigned int count)
+    {
+        if (index < _str.size())
+            _str.erase(index, count);
+    }
+    void trim()
+    {
+        size_t begin = _str.find_first_not_of(" \t\r\n");
+        size_t end = _str.find_last_not_of(" \t\r\n");
+        _str = begin == std::string::npos ? "" : _str.substr(begin, end - begin + 1);
+    }
+    void toLowerCase() { std::transform(_str.begin(), _str.end(), _str.begin(), ::tolower); }
+    void toUpperCase() { std::transform(_str.begin(), _str.end(), _str.begin(), ::toupper); }
+
+    inline long toInt() const { return atol(_str.c_str()); }
+    inline float toFloat() const { return atof(_str.c_str()); }
+    void toCharArray(char *buffer, unsigned int size, unsigned int index = 0) const { getBytes((unsigned char *)buffer, size, index); }
+    void getBytes(unsigned char *buffer, unsigned int size, unsigned int index = 0) const
+    {
+        if (size == 0)
+            return;
+        size_t n = index < _str.size() ? std::min<size_t>(size - 1, _str.size() - index) : 0;
+        memcpy(buffer, _str.data() + std::min<size_t>(index, _str.size()), n);
+        buffer[n] = '\0';
+    }
+};
+
+// Result of the + operators, like the Arduino core
+class StringSumHelper : public String
+{
+public:
+    StringSumHelper(const String &str) : String(str) {}
+    StringSumHelper(const char *str) : String(str) {}
+};
+
+inline StringSumHelper operator+(const String &lhs, const String &rhs)
+{
+    StringSumHelper sum(lhs);
+    sum.concat(rhs);
+    return sum;
+}
+inline StringSumHelper operator+(const String &lhs, const char *rhs)
+{
+    StringSumHelper sum(lhs);
+    sum.concat(rhs);
+    return sum;
+}
+inline StringSumHelper operator+(const char *lhs, const String &rhs)
+{
+    StringSumHelper sum(lhs);
+    sum.concat(rhs);
+    return sum;
+}
+inline StringSumHelper operator+(const String &lhs, char rhs)
+{
+    StringSumHelper sum(lhs);
+    sum.concat(rhs);
+    return sum;
+}
+template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+inline StringSumHelper operator+(const String &lhs, T rhs)
+{
+    StringSumHelper sum(lhs);
+    sum.concat(String(rhs));
+    return sum;
+}
+inline bool operator==(const char *lhs, const String &rhs) { return rhs.equals(lhs); }
+
+#define DEC 10
+#define HEX 16
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (size-- > 0 && write(*buffer++) == 1)
+            n++;
+        return n;
+    }
+    inline size_t write(const char *str) { return str != nullptr ? write((const uint8_t *)str, strlen(str)) : 0; }
+    inline size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual void flush() {}
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(nullptr, 0, format, args);
+        va_end(args);
+        if (length <= 0)
+            return 0;
+        std::string buffer(length + 1, '\0');
+        va_start(args, format);
+        vsnprintf(&buffer[0], buffer.size(), format, args);
+        va_end(args);
+        return write((const uint8_t *)buffer.data(), length);
+    }
+
+    inline size_t print(const String &str) { return write((const uint8_t *)str.c_str(), str.length()); }
+    inline size_t print(const char *str) { return write(str); }
+    inline size_t print(char c) { return write((uint8_t)c); }
+    inline size_t print(int value, int base = DEC) { return print(String((long)value, base)); }
+    inline size_t print(unsigned int value, int base = DEC) { return print(String((unsigned long)value, base)); }
+    inline size_t print(long value, int base = DEC) { return print(String(value, base)); }
+    inline size_t print(unsigned long value, int base = DEC) { return print(String(value, base)); }
+    inline size_t print(unsigned char value, int base = DEC) { return print(String((unsigned long)value, base)); }
+    inline size_t print(long long value, int base = DEC) { return print(String(value, base)); }
+    inline size_t print(unsigned long long value, int base = DEC) { return print(String(value, base)); }
+    inline size_t print(double value, int decimals = 2) { return print(String(value, decimals)); }
+
+    inline size_t println() { return write("\r\n"); }
+    template <typename T>
+    inline size_t println(const T &value) { return print(value) + println(); }
+    template <typename T>
+    inline size_t println(const T &value, int format) { return print(value, format) + println(); }
+};
+
+class Stream : public Print
+{
+protected:
+    unsigned long _timeout = 1000;
+
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    inline void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    inline unsigned long getTimeout() const { return _timeout; }
+
+    virtual size_t readBytes(uint8_t *buffer, size_t length)
+    {
+        size_t n = 0;
+        while (n < length)
+        {
+            int c = read();
+            if (c < 0)
+                break;
+            buffer[n++] = (uint8_t)c;
+        }
+        return n;
+    }
+    inline size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+
+    String readString()
+    {
+        String str;
+        int c;
+        while ((c = read()) >= 0)
+            str += (char)c;
+        return str;
+    }
+};
+
+class IPAddress
+{
+private:
+    union
+    {
+        uint8_t bytes[4];
+        uint32_t dword;
+    } _address;
+
+public:
+    IPAddress() { _address.dword = 0; }
+    IPAddress(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3)
+    {
+        _address.bytes[0] = b0;
+        _address.bytes[1] = b1;
+        _address.bytes[2] = b2;
+        _address.bytes[3] = b3;
+    }
+    IPAddress(uint32_t address) { _address.dword = address; }
+
+    inline operator uint32_t() const { return _address.dword; }
+    inline bool operator==(const IPAddress &other) const { return _address.dword == other._address.dword; }
+    inline bool operator==(uint32_t address) const { return _address.dword == address; }
+    inline uint8_t operator[](int index) const { return _address.bytes[index]; }
+    inline uint8_t &operator[](int index) { return _address.bytes[index]; }
+
+    String toString() const
+    {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", _address.bytes[0], _address.bytes[1], _address.bytes[2], _address.bytes[3]);
+        return String(buffer);
+    }
+    bool fromString(const char *address)
+    {
+        unsigned int b[4];
+        char end;
+        if (sscanf(address, "%u.%u.%u.%u%c", &b[0], &b[1], &b[2], &b[3], &end) != 4 || b[0] > 255 || b[1] > 255 || b[2] > 255 || b[3] > 255)
+            return false;
+        *this = IPAddress(b[0], b[1], b[2], b[3]);
+        return true;
+    }
+    inline bool fromString(const String &address) { return fromString(address.c_str()); }
+};
+
+inline const IPAddress INADDR_NONE(0, 0, 0, 0);
+
+// Console of the tests, written to the standard output
+class HardwareSerial : public Stream
+{
+public:
+    inline void begin(unsigned long baud) { (void)baud; }
+    inline size_t write(uint8_t b) override { return fwrite(&b, 1, 1, stdout); }
+    inline size_t write(const uint8_t *buffer, size_t size) override { return fwrite(buffer, 1, size, stdout); }
+    inline int available() override { return 0; }
+    inline int read() override { return -1; }
+    inline int peek() override { return -1; }
+    inline void flush() override { fflush(stdout); }
+    inline operator bool() const { return true; }
+    using Print::write;
+};
+
+inline HardwareSerial Serial;
+
+// Board information, a fixed chip. The tests count the restarts.
+class EspClass
+{
+public:
+    uint64_t efuseMac = 0x24A1603C2F50ULL;
+    unsigned int restartCount = 0;
+
+    inline void restart() { restartCount++; }
+    inline void reset() { restartCount++; }
+    inline uint64_t getEfuseMac() { return efuseMac; }
+    inline uint32_t getChipId() { return (uint32_t)efuseMac; }
+    inline uint32_t getFreeHeap() { return 200000; }
+    inline uint32_t getHeapSize() { return 300000; }
+    inline uint32_t getPsramSize() { return 0; }
+    inline uint8_t getChipRevision() { return 3; }
+    inline const char *getChipModel() { return "ESP32"; }
+    inline uint32_t getCpuFreqMHz() { return 240; }
+    inline uint32_t getSketchSize() { return 1000000; }
+    inline uint32_t getFreeSketchSpace() { return 1310720; }
+    inline uint32_t getFlashChipSize() { return 4194304; }
+    inline uint32_t getFlashChipSpeed() { return 80000000; }
+    inline const char *getSdkVersion() { return "host"; }
+};
+
+inline EspClass ESP;
+
+#endif
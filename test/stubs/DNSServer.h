@@ -0,0 +1,38 @@
+/*
+  DNSServer.h - Host stub of the captive portal DNS server, which answers nothing on the host.
+*/
+
+#ifndef ThingsCloud_Test_DNSServer_H
+#define ThingsCloud_Test_DNSServer_H
+
+#include <Arduino.h>
+
+enum class DNSReplyCode
+{
+    NoError = 0,
+    FormError = 1,
+    ServerFailure = 2,
+    NonExistentDomain = 3,
+    NotImplemented = 4,
+    Refused = 5
+};
+
+class DNSServer
+{
+public:
+    bool started = false;
+
+    inline void setErrorReplyCode(const DNSReplyCode &replyCode) { (void)replyCode; }
+    inline bool start(const uint16_t port, const String &domainName, const IPAddress &resolvedIP)
+    {
+        (void)port;
+        (void)domainName;
+        (void)resolvedIP;
+        started = true;
+        return true;
+    }
+    inline void stop() { started = false; }
+    inline void processNextRequest() {}
+};
+
+#endif
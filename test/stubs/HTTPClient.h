@@ -0,0 +1,51 @@
+/*
+  HTTPClient.h - Host stub of the ESP32 HTTP client, used for the https endpoints.
+  There is no TLS on the host: every request fails to connect.
+*/
+
+#ifndef ThingsCloud_Test_HTTPClient_H
+#define ThingsCloud_Test_HTTPClient_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+class HTTPClient
+{
+public:
+    inline static unsigned int hostRequestCount = 0;
+
+    inline bool begin(const String &url)
+    {
+        _url = url;
+        return true;
+    }
+    inline bool begin(WiFiClient &client, const String &url)
+    {
+        (void)client;
+        return begin(url);
+    }
+    inline void addHeader(const String &name, const String &value)
+    {
+        (void)name;
+        (void)value;
+    }
+    inline int POST(const String &payload)
+    {
+        (void)payload;
+        hostRequestCount++;
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    inline String getString() { return String(); }
+    inline void end() {}
+    static String errorToString(int error)
+    {
+        return error == HTTPC_ERROR_CONNECTION_REFUSED ? "connection refused" : String();
+    }
+
+private:
+    String _url;
+};
+
+#endif
@@ -0,0 +1,74 @@
+/*
+  LittleFS.h - Host stub of the LittleFS file system, for the native unit tests.
+  The files are kept in the host temporary directory.
+*/
+
+#ifndef ThingsCloud_Test_LittleFS_H
+#define ThingsCloud_Test_LittleFS_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <filesystem>
+#include <memory>
+
+class File : public Stream
+{
+private:
+    std::shared_ptr<FILE> _file;
+
+public:
+    File() {}
+    explicit File(FILE *file) : _file(file, fclose) {}
+
+    inline operator bool() const { return _file != nullptr; }
+    inline size_t read(uint8_t *buffer, size_t size) { return fread(buffer, 1, size, _file.get()); }
+    inline size_t write(const uint8_t *buffer, size_t size) override { return fwrite(buffer, 1, size, _file.get()); }
+    inline size_t write(uint8_t b) override { return write(&b, 1); }
+    using Print::write;
+    inline int available() override { return _file != nullptr ? (int)(size() - ftell(_file.get())) : 0; }
+    inline int read() override { return fgetc(_file.get()); }
+    inline int peek() override
+    {
+        int c = fgetc(_file.get());
+        if (c >= 0)
+            ungetc(c, _file.get());
+        return c;
+    }
+    inline bool seek(size_t position) { return fseek(_file.get(), position, SEEK_SET) == 0; }
+    inline void close() { _file.reset(); }
+
+    size_t size()
+    {
+        long position = ftell(_file.get());
+        fseek(_file.get(), 0, SEEK_END);
+        long size = ftell(_file.get());
+        fseek(_file.get(), position, SEEK_SET);
+        return size;
+    }
+};
+
+class LittleFSStub
+{
+public:
+    inline bool begin() { return true; }
+
+    // "r", "r+", "w" and "a", like the board file system
+    File open(const char *path, const char *mode)
+    {
+        std::string hostMode = std::string(mode) + "b";
+        FILE *file = fopen(hostPath(path).c_str(), hostMode.c_str());
+        return file != nullptr ? File(file) : File();
+    }
+
+    inline bool exists(const char *path) { return std::filesystem::exists(hostPath(path)); }
+    inline bool remove(const char *path) { return ::remove(hostPath(path).c_str()) == 0; }
+
+    static std::string hostPath(const char *path)
+    {
+        return (std::filesystem::temp_directory_path() / ("thingscloud_test_" + std::string(path[0] == '/' ? path + 1 : path))).string();
+    }
+};
+
+inline LittleFSStub LittleFS;
+
+#endif
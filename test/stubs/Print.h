@@ -0,0 +1,5 @@
+/*
+  Print.h - Host stub of the Arduino core, defined with the rest in Arduino.h.
+*/
+
+#include <Arduino.h>
@@ -0,0 +1,10 @@
+/*
+  Update.h - Host stub of the ESP32 OTA update library, no update ever runs on the host.
+*/
+
+#ifndef ThingsCloud_Test_Update_H
+#define ThingsCloud_Test_Update_H
+
+#include <Arduino.h>
+
+#endif
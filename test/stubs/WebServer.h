@@ -0,0 +1,99 @@
+/*
+  WebServer.h - Host stub of the ESP32 web server.
+  It does not listen: the tests call the registered handlers with hostRequest() and read the response.
+*/
+
+#ifndef ThingsCloud_Test_WebServer_H
+#define ThingsCloud_Test_WebServer_H
+
+#include <Arduino.h>
+#include <map>
+#include <vector>
+
+#define WEBSERVER_H
+
+typedef enum
+{
+    HTTP_ANY,
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_PATCH,
+    HTTP_DELETE,
+    HTTP_OPTIONS
+} HTTPMethod;
+
+class WebServer
+{
+public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    int port;
+    bool started = false;
+    std::map<String, THandlerFunction> handlers;
+    THandlerFunction notFoundHandler;
+
+    // Request given by hostRequest() and response of its handler
+    std::map<String, String> requestArgs;
+    int responseCode = 0;
+    String responseContentType;
+    String responseContent;
+    std::vector<std::pair<String, String>> responseHeaders;
+
+    explicit WebServer(int port = 80) : port(port) {}
+
+    inline void begin() { started = true; }
+    inline void stop() { started = false; }
+    inline void close() { started = false; }
+    inline void handleClient() {}
+
+    inline void on(const String &uri, THandlerFunction handler) { handlers[uri] = handler; }
+    inline void on(const String &uri, HTTPMethod method, THandlerFunction handler)
+    {
+        (void)method;
+        on(uri, handler);
+    }
+    inline void onNotFound(THandlerFunction handler) { notFoundHandler = handler; }
+
+    inline bool hasArg(const String &name) { return requestArgs.count(name) > 0; }
+    inline String arg(const String &name) { return hasArg(name) ? requestArgs[name] : String(); }
+    inline String uri() { return _uri; }
+
+    inline void sendHeader(const String &name, const String &value, bool first = false)
+    {
+        (void)first;
+        responseHeaders.push_back({name, value});
+    }
+    inline void send(int code, const char *contentType = nullptr, const String &content = String())
+    {
+        responseCode = code;
+        responseContentType = contentType;
+        responseContent = content;
+    }
+    inline void send(int code, const String &contentType, const String &content) { send(code, contentType.c_str(), content); }
+
+    // Run the handler of uri, false when there is none
+    bool hostRequest(const String &uri, const std::map<String, String> &args = {})
+    {
+        _uri = uri;
+        requestArgs = args;
+        responseCode = 0;
+        responseContentType = String();
+        responseContent = String();
+        responseHeaders.clear();
+        auto handler = handlers.find(uri);
+        if (handler != handlers.end())
+            handler->second();
+        else if (notFoundHandler)
+            notFoundHandler();
+        else
+            return false;
+        return true;
+    }
+
+private:
+    String _uri;
+};
+
+#endif
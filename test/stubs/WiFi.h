@@ -0,0 +1,225 @@
+/*
+  WiFi.h - Host stub of the ESP32 WiFi library.
+  The station status is set by the tests, begin() connects right away unless they say otherwise.
+*/
+
+#ifndef ThingsCloud_Test_WiFi_H
+#define ThingsCloud_Test_WiFi_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <esp_wifi.h>
+#include <vector>
+
+typedef enum
+{
+    WL_NO_SHIELD = 255,
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+#define WIFI_OFF WIFI_MODE_NULL
+#define WIFI_STA WIFI_MODE_STA
+#define WIFI_AP WIFI_MODE_AP
+#define WIFI_AP_STA WIFI_MODE_APSTA
+
+typedef wifi_mode_t WiFiMode_t;
+
+typedef enum
+{
+    ARDUINO_EVENT_WIFI_READY = 0,
+    ARDUINO_EVENT_WIFI_SCAN_DONE,
+    ARDUINO_EVENT_WIFI_STA_START,
+    ARDUINO_EVENT_WIFI_STA_STOP,
+    ARDUINO_EVENT_WIFI_STA_CONNECTED,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+    ARDUINO_EVENT_WIFI_STA_AUTHMODE_CHANGE,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP6,
+    ARDUINO_EVENT_WIFI_STA_LOST_IP,
+    ARDUINO_EVENT_MAX
+} arduino_event_id_t;
+
+typedef arduino_event_id_t WiFiEvent_t;
+typedef size_t wifi_event_id_t;
+
+typedef union
+{
+    wifi_event_sta_disconnected_t wifi_sta_disconnected;
+} arduino_event_info_t;
+
+typedef std::function<void(arduino_event_id_t event, arduino_event_info_t info)> WiFiEventFuncCb;
+
+// Scan result given by the tests
+struct HostWiFiNetwork
+{
+    String ssid;
+    int32_t rssi;
+    uint8_t encryption;
+    int32_t channel;
+};
+
+class WiFiGenericClass
+{
+public:
+    static inline wifi_mode_t hostMode = WIFI_MODE_NULL;
+    static inline wifi_mode_t getMode() { return hostMode; }
+};
+
+class WiFiClass : public WiFiGenericClass
+{
+public:
+    // Controlled by the tests
+    wl_status_t hostStatus = WL_DISCONNECTED;
+    wl_status_t hostBeginStatus = WL_CONNECTED; // Status right after begin()
+    unsigned int hostBeginCount = 0;
+    unsigned int hostDisconnectCount = 0;
+    String hostSsid;
+    String hostPassword;
+    String hostHostname = "esp32-host";
+    std::vector<HostWiFiNetwork> hostNetworks;
+    std::vector<WiFiEventFuncCb> hostEventCallbacks;
+
+    inline wl_status_t status() { return hostStatus; }
+    inline bool isConnected() { return hostStatus == WL_CONNECTED; }
+    inline void persistent(bool persistent) { (void)persistent; }
+
+    inline bool mode(wifi_mode_t mode)
+    {
+        hostMode = mode;
+        return true;
+    }
+    inline bool enableSTA(bool enable)
+    {
+        hostMode = (wifi_mode_t)(enable ? (hostMode | WIFI_MODE_STA) : (hostMode & ~WIFI_MODE_STA));
+        return true;
+    }
+    inline bool enableAP(bool enable)
+    {
+        hostMode = (wifi_mode_t)(enable ? (hostMode | WIFI_MODE_AP) : (hostMode & ~WIFI_MODE_AP));
+        return true;
+    }
+
+    wl_status_t begin(const char *ssid, const char *password = nullptr, int32_t channel = 0, const uint8_t *bssid = nullptr, bool connect = true)
+    {
+        (void)channel;
+        (void)bssid;
+        hostSsid = ssid;
+        hostPassword = password;
+        if (connect)
+            return begin();
+        return hostStatus;
+    }
+    wl_status_t begin()
+    {
+        hostBeginCount++;
+        hostStatus = hostBeginStatus;
+        return hostStatus;
+    }
+    inline bool reconnect() { return begin() == WL_CONNECTED; }
+    bool disconnect(bool wifioff = false, bool eraseap = false)
+    {
+        (void)eraseap;
+        hostDisconnectCount++;
+        hostStatus = WL_DISCONNECTED;
+        if (wifioff)
+            hostMode = WIFI_MODE_NULL;
+        return true;
+    }
+    inline uint8_t waitForConnectResult(unsigned long timeout = 60000)
+    {
+        (void)timeout;
+        return hostStatus;
+    }
+    inline bool config(IPAddress, IPAddress, IPAddress, IPAddress = IPAddress(), IPAddress = IPAddress()) { return true; }
+    inline bool setAutoReconnect(bool autoReconnect)
+    {
+        (void)autoReconnect;
+        return true;
+    }
+    inline bool getAutoConnect() { return false; }
+
+    inline bool setHostname(const char *hostname)
+    {
+        hostHostname = hostname;
+        return true;
+    }
+    inline bool hostname(const String &hostname) { return setHostname(hostname.c_str()); }
+    inline const char *getHostname() { return hostHostname.c_str(); }
+
+    inline IPAddress localIP() { return hostStatus == WL_CONNECTED ? IPAddress(192, 168, 1, 50) : IPAddress(); }
+    inline IPAddress gatewayIP() { return IPAddress(192, 168, 1, 1); }
+    inline IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+    inline IPAddress dnsIP(uint8_t index = 0) { return index == 0 ? IPAddress(192, 168, 1, 1) : IPAddress(); }
+    inline String macAddress() { return "24:A1:60:3C:2F:50"; }
+    inline String SSID() { return hostStatus == WL_CONNECTED ? hostSsid : String(); }
+    inline String BSSIDstr() { return "00:11:22:33:44:55"; }
+    inline int8_t RSSI() { return hostStatus == WL_CONNECTED ? -60 : 0; }
+    inline int32_t channel() { return 6; }
+
+    inline bool softAP(const char *ssid, const char *password = nullptr, int channel = 1, int hidden = 0, int maxConnection = 4)
+    {
+        (void)ssid;
+        (void)password;
+        (void)channel;
+        (void)hidden;
+        (void)maxConnection;
+        hostMode = (wifi_mode_t)(hostMode | WIFI_MODE_AP);
+        return true;
+    }
+    inline bool softAPConfig(IPAddress, IPAddress, IPAddress) { return true; }
+    inline bool softAPdisconnect(bool wifioff = false)
+    {
+        hostMode = (wifi_mode_t)(hostMode & ~WIFI_MODE_AP);
+        if (wifioff)
+            hostMode = WIFI_MODE_NULL;
+        return true;
+    }
+    inline IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+    inline String softAPmacAddress() { return "24:A1:60:3C:2F:51"; }
+    inline uint8_t softAPgetStationNum() { return 0; }
+    inline const char *softAPgetHostname() { return hostHostname.c_str(); }
+    inline bool softAPsetHostname(const char *hostname) { return setHostname(hostname); }
+    inline String softAPSSID() { return "ThingsCloud"; }
+
+    inline int16_t scanNetworks(bool async = false, bool showHidden = false)
+    {
+        (void)async;
+        (void)showHidden;
+        return hostNetworks.size();
+    }
+    inline int16_t scanComplete() { return hostNetworks.size(); }
+    inline void scanDelete() {}
+    inline String SSID(uint8_t index) { return index < hostNetworks.size() ? hostNetworks[index].ssid : String(); }
+    inline int32_t RSSI(uint8_t index) { return index < hostNetworks.size() ? hostNetworks[index].rssi : 0; }
+    inline uint8_t encryptionType(uint8_t index) { return index < hostNetworks.size() ? hostNetworks[index].encryption : 0; }
+    inline int32_t channel(uint8_t index) { return index < hostNetworks.size() ? hostNetworks[index].channel : 0; }
+    inline String BSSIDstr(uint8_t index)
+    {
+        (void)index;
+        return BSSIDstr();
+    }
+
+    inline wifi_event_id_t onEvent(WiFiEventFuncCb callback)
+    {
+        hostEventCallbacks.push_back(callback);
+        return hostEventCallbacks.size();
+    }
+    inline void removeEvent(wifi_event_id_t id)
+    {
+        if (id > 0 && id <= hostEventCallbacks.size())
+            hostEventCallbacks[id - 1] = nullptr;
+    }
+};
+
+inline WiFiClass WiFi;
+
+#endif
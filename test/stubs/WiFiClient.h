@@ -0,0 +1,121 @@
+/*
+  WiFiClient.h - Host stub of the ESP32 WiFiClient, over the POSIX sockets.
+  Like the ESP32 client the copies share the socket, which is closed with the last one.
+*/
+
+#ifndef ThingsCloud_Test_WiFiClient_H
+#define ThingsCloud_Test_WiFiClient_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <lwip/sockets.h>
+#include <lwip/dns.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <memory>
+
+class WiFiClient : public Client
+{
+private:
+    struct Socket
+    {
+        int fd;
+        explicit Socket(int socket) : fd(socket) {}
+        ~Socket() { close(fd); }
+    };
+    std::shared_ptr<Socket> _socket;
+
+public:
+    WiFiClient() {}
+    explicit WiFiClient(int fd) : _socket(std::make_shared<Socket>(fd)) {}
+
+    inline int fd() const { return _socket != nullptr ? _socket->fd : -1; }
+
+    int connect(IPAddress ip, uint16_t port) override { return connect(ip, port, (int32_t)_timeout); }
+    int connect(IPAddress ip, uint16_t port, int32_t timeout)
+    {
+        (void)timeout;
+        stop();
+        int socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (socket < 0)
+            return 0;
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = (uint32_t)ip;
+        address.sin_port = htons(port);
+        if (::connect(socket, (struct sockaddr *)&address, sizeof(address)) < 0)
+        {
+            close(socket);
+            return 0;
+        }
+        int noDelay = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        _socket = std::make_shared<Socket>(socket);
+        return 1;
+    }
+    int connect(const char *host, uint16_t port) override { return connect(host, port, (int32_t)_timeout); }
+    int connect(const char *host, uint16_t port, int32_t timeout)
+    {
+        ip_addr_t address;
+        if (dns_gethostbyname(host, &address, [](const char *, const ip_addr_t *, void *) {}, nullptr) != ERR_OK)
+            return 0;
+        return connect(IPAddress(address.u_addr.addr), port, timeout);
+    }
+
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        if (!_socket)
+            return 0;
+        ssize_t written = send(_socket->fd, buffer, size, MSG_NOSIGNAL);
+        return written > 0 ? written : 0;
+    }
+    using Print::write;
+
+    int available() override
+    {
+        int count = 0;
+        if (!_socket || ioctl(_socket->fd, FIONREAD, &count) < 0)
+            return 0;
+        return count;
+    }
+    int read() override
+    {
+        uint8_t b;
+        return read(&b, 1) == 1 ? b : -1;
+    }
+    int read(uint8_t *buffer, size_t size) override
+    {
+        if (!_socket)
+            return -1;
+        ssize_t count = recv(_socket->fd, buffer, size, MSG_DONTWAIT);
+        return count > 0 ? count : -1;
+    }
+    int peek() override
+    {
+        uint8_t b;
+        if (!_socket || recv(_socket->fd, &b, 1, MSG_DONTWAIT | MSG_PEEK) != 1)
+            return -1;
+        return b;
+    }
+    void flush() override {}
+    void stop() override { _socket.reset(); }
+
+    // Until the peer closed the connection and every received byte was read
+    uint8_t connected() override
+    {
+        if (!_socket)
+            return 0;
+        uint8_t b;
+        ssize_t count = recv(_socket->fd, &b, 1, MSG_DONTWAIT | MSG_PEEK);
+        if (count > 0 || (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)))
+            return 1;
+        stop();
+        return 0;
+    }
+    operator bool() override { return connected(); }
+};
+
+#endif
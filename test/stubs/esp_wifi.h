@@ -0,0 +1,152 @@
+/*
+  esp_wifi.h - Host stub of the ESP-IDF WiFi driver types and calls used by the WiFi manager.
+*/
+
+#ifndef ThingsCloud_Test_EspWifi_H
+#define ThingsCloud_Test_EspWifi_H
+
+#include <stdint.h>
+#include <string.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_WIFI_NOT_INIT 0x3001
+
+#define CONFIG_ESP32_PHY_MAX_WIFI_TX_POWER 20
+
+typedef enum
+{
+    WIFI_MODE_NULL = 0,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA,
+    WIFI_MODE_MAX
+} wifi_mode_t;
+
+typedef enum
+{
+    WIFI_IF_STA = 0,
+    WIFI_IF_AP
+} wifi_interface_t;
+
+typedef enum
+{
+    WIFI_AUTH_OPEN = 0,
+    WIFI_AUTH_WEP,
+    WIFI_AUTH_WPA_PSK,
+    WIFI_AUTH_WPA2_PSK,
+    WIFI_AUTH_WPA_WPA2_PSK,
+    WIFI_AUTH_WPA2_ENTERPRISE,
+    WIFI_AUTH_WPA3_PSK,
+    WIFI_AUTH_WPA2_WPA3_PSK,
+    WIFI_AUTH_MAX
+} wifi_auth_mode_t;
+
+typedef enum
+{
+    WIFI_BW_HT20 = 1,
+    WIFI_BW_HT40
+} wifi_bandwidth_t;
+
+typedef enum
+{
+    WIFI_COUNTRY_POLICY_AUTO = 0,
+    WIFI_COUNTRY_POLICY_MANUAL
+} wifi_country_policy_t;
+
+typedef struct
+{
+    char cc[3];
+    uint8_t schan;
+    uint8_t nchan;
+    int8_t max_tx_power;
+    wifi_country_policy_t policy;
+} wifi_country_t;
+
+typedef struct
+{
+    uint8_t ssid[32];
+    uint8_t password[64];
+} wifi_sta_config_t;
+
+typedef struct
+{
+    uint8_t ssid[32];
+    uint8_t password[64];
+    uint8_t ssid_len;
+    uint8_t channel;
+    wifi_auth_mode_t authmode;
+    uint8_t ssid_hidden;
+    uint8_t max_connection;
+    uint16_t beacon_interval;
+} wifi_ap_config_t;
+
+typedef union
+{
+    wifi_ap_config_t ap;
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct
+{
+    uint8_t bssid[6];
+    uint8_t ssid[33];
+    uint8_t primary;
+    int8_t rssi;
+} wifi_ap_record_t;
+
+typedef enum
+{
+    WIFI_REASON_AUTH_EXPIRE = 2,
+    WIFI_REASON_ASSOC_FAIL = 203,
+    WIFI_REASON_NO_AP_FOUND = 201,
+    WIFI_REASON_AUTH_FAIL = 202
+} wifi_err_reason_t;
+
+typedef struct
+{
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t reason;
+} wifi_event_sta_disconnected_t;
+
+inline wifi_country_t hostWiFiCountry = {"CN", 1, 13, CONFIG_ESP32_PHY_MAX_WIFI_TX_POWER, WIFI_COUNTRY_POLICY_AUTO};
+
+inline esp_err_t esp_wifi_start() { return ESP_OK; }
+inline esp_err_t esp_wifi_set_country(const wifi_country_t *country)
+{
+    hostWiFiCountry = *country;
+    return ESP_OK;
+}
+inline esp_err_t esp_wifi_get_country(wifi_country_t *country)
+{
+    *country = hostWiFiCountry;
+    return ESP_OK;
+}
+inline esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *config)
+{
+    (void)interface;
+    memset(config, 0, sizeof(*config));
+    return ESP_OK;
+}
+inline esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *info)
+{
+    memset(info, 0, sizeof(*info));
+    return ESP_FAIL;
+}
+inline esp_err_t esp_wifi_set_max_tx_power(int8_t power)
+{
+    (void)power;
+    return ESP_OK;
+}
+inline esp_err_t esp_wifi_set_bandwidth(wifi_interface_t interface, wifi_bandwidth_t bandwidth)
+{
+    (void)interface;
+    (void)bandwidth;
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,40 @@
+/*
+  lwip/dns.h - Host stub of the lwIP resolver.
+  Answered right away from a table filled by the tests, the other names fail through the callback like a NXDOMAIN.
+*/
+
+#ifndef ThingsCloud_Test_LwipDns_H
+#define ThingsCloud_Test_LwipDns_H
+
+#include <lwip/ip_addr.h>
+#include <arpa/inet.h>
+#include <map>
+#include <string>
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+
+inline std::map<std::string, uint32_t> hostDnsTable;
+inline unsigned int hostDnsQueryCount = 0;
+
+inline err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg)
+{
+    hostDnsQueryCount++;
+    auto entry = hostDnsTable.find(hostname);
+    if (entry != hostDnsTable.end())
+    {
+        addr->u_addr.addr = entry->second;
+        return ERR_OK;
+    }
+
+    struct in_addr numeric;
+    if (inet_aton(hostname, &numeric) != 0)
+    {
+        addr->u_addr.addr = numeric.s_addr;
+        return ERR_OK;
+    }
+
+    found(hostname, nullptr, callback_arg);
+    return ERR_INPROGRESS;
+}
+
+#endif
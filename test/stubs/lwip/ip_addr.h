@@ -0,0 +1,28 @@
+/*
+  lwip/ip_addr.h - Host stub of the lwIP IPv4 address types.
+*/
+
+#ifndef ThingsCloud_Test_LwipIpAddr_H
+#define ThingsCloud_Test_LwipIpAddr_H
+
+#include <stdint.h>
+
+typedef int8_t err_t;
+
+#define ERR_OK 0
+#define ERR_INPROGRESS -5
+#define ERR_ARG -16
+
+struct ip4_addr_t
+{
+    uint32_t addr;
+};
+
+struct ip_addr_t
+{
+    ip4_addr_t u_addr;
+};
+
+#define ip_2_ip4(ipaddr) (&((ipaddr)->u_addr))
+
+#endif
@@ -0,0 +1,22 @@
+/*
+  lwip/priv/tcpip_priv.h - Host stub of the lwIP task calls, run in the calling thread.
+*/
+
+#ifndef ThingsCloud_Test_LwipTcpipPriv_H
+#define ThingsCloud_Test_LwipTcpipPriv_H
+
+#include <lwip/ip_addr.h>
+
+struct tcpip_api_call_data
+{
+    err_t err;
+};
+
+typedef err_t (*tcpip_api_call_fn)(struct tcpip_api_call_data *call);
+
+inline err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data *call)
+{
+    return fn(call);
+}
+
+#endif
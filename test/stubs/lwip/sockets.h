@@ -0,0 +1,28 @@
+/*
+  lwip/sockets.h - Host stub of the lwIP socket API, mapped onto the POSIX sockets.
+*/
+
+#ifndef ThingsCloud_Test_LwipSockets_H
+#define ThingsCloud_Test_LwipSockets_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+inline int lwip_socket(int domain, int type, int protocol) { return ::socket(domain, type, protocol); }
+inline int lwip_connect(int s, const struct sockaddr *name, socklen_t namelen) { return ::connect(s, name, namelen); }
+inline int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout)
+{
+    return ::select(maxfdp1, readset, writeset, exceptset, timeout);
+}
+inline int lwip_getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen) { return ::getsockopt(s, level, optname, optval, optlen); }
+inline int lwip_setsockopt(int s, int level, int optname, const void *optval, socklen_t optlen) { return ::setsockopt(s, level, optname, optval, optlen); }
+inline int lwip_close(int s) { return ::close(s); }
+inline int lwip_fcntl(int s, int cmd, int val) { return ::fcntl(s, cmd, val); }
+
+#endif
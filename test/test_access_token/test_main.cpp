@@ -0,0 +1,98 @@
+/*
+  AccessToken request of ThingsCloudMQTT over http, against the loopback HTTP server, then the MQTT connection with it.
+*/
+
+#include <ThingsCloudTestHarness.h>
+
+#define GRANTED_BODY "{\"result\":1,\"device\":{\"access_token\":\"granted-token\"}}"
+
+static String apiEndpoint(const LoopbackHttpServer &server, const char *path = "")
+{
+    return String("http://") + TEST_API_HOST + ":" + String(server.port()) + path;
+}
+
+void test_token_is_requested_then_used_to_connect(void)
+{
+    LoopbackBroker broker;
+    LoopbackHttpServer api;
+    api.respond("200 OK", GRANTED_BODY);
+    String endpoint = apiEndpoint(api);
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "device-key", "test-project-key", "", endpoint.c_str());
+
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_EQUAL(1, api.requests.size());
+    TEST_ASSERT_EQUAL(0, api.requests[0].rfind("POST /device/v1/certificate HTTP/1.0\r\n", 0));
+    TEST_ASSERT_TRUE(api.requests[0].find("Project-Key: test-project-key\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(api.requests[0].find("\"device_key\":\"device-key\"") != std::string::npos);
+    TEST_ASSERT_EQUAL_STRING("granted-token", broker.username.c_str());
+}
+
+void test_trailing_slash_of_the_endpoint_is_dropped(void)
+{
+    LoopbackBroker broker;
+    LoopbackHttpServer api;
+    api.respond("200 OK", GRANTED_BODY);
+    String endpoint = apiEndpoint(api, "/api/");
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "device-key", "test-project-key", "", endpoint.c_str());
+
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_EQUAL(0, api.requests[0].rfind("POST /api/device/v1/certificate HTTP/1.0\r\n", 0));
+}
+
+void test_error_status_is_refused_and_retried(void)
+{
+    LoopbackBroker broker;
+    LoopbackHttpServer api;
+    // A granted body does not make up for the status code
+    api.respond("500 Internal Server Error", GRANTED_BODY);
+    String endpoint = apiEndpoint(api);
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "device-key", "test-project-key", "", endpoint.c_str());
+
+    TEST_ASSERT_TRUE(loopUntil(client, 120000, [&api]
+                               { return api.requests.size() == 2; }));
+    TEST_ASSERT_EQUAL(0, broker.connectCount);
+
+    api.respond("200 OK", GRANTED_BODY);
+    TEST_ASSERT_TRUE(connectClient(client, 600000));
+    TEST_ASSERT_EQUAL_STRING("granted-token", broker.username.c_str());
+}
+
+void test_large_headers_do_not_count_against_the_body(void)
+{
+    LoopbackBroker broker;
+    LoopbackHttpServer api;
+    std::string body = GRANTED_BODY;
+    api.response = "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nX-Padding: " + std::string(1500, 'p') +
+                   "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    String endpoint = apiEndpoint(api);
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "device-key", "test-project-key", "", endpoint.c_str());
+
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_EQUAL_STRING("granted-token", broker.username.c_str());
+}
+
+void test_body_larger_than_the_limit_is_refused(void)
+{
+    LoopbackBroker broker;
+    LoopbackHttpServer api;
+    std::string body = "{\"result\":1,\"message\":\"" + std::string(ACCESS_TOKEN_RESPONSE_MAX_SIZE, 'm') +
+                       "\",\"device\":{\"access_token\":\"granted-token\"}}";
+    api.respond("200 OK", body);
+    String endpoint = apiEndpoint(api);
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "device-key", "test-project-key", "", endpoint.c_str());
+
+    TEST_ASSERT_TRUE(loopUntil(client, 120000, [&api]
+                               { return api.requests.size() == 2; }));
+    TEST_ASSERT_EQUAL(0, broker.connectCount);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_token_is_requested_then_used_to_connect);
+    RUN_TEST(test_trailing_slash_of_the_endpoint_is_dropped);
+    RUN_TEST(test_error_status_is_refused_and_retried);
+    RUN_TEST(test_large_headers_do_not_count_against_the_body);
+    RUN_TEST(test_body_larger_than_the_limit_is_refused);
+    return UNITY_END();
+}
@@ -0,0 +1,104 @@
+/*
+  JSON encoding and overflow of ThingsCloudAttributesBuilder.
+*/
+
+#include <ThingsCloudTestHarness.h>
+#include <ThingsCloudAttributesBuilder.h>
+
+static char buffer[256];
+static ThingsCloudAttributesBuilder builder;
+
+void setUpTest(void)
+{
+    memset(buffer, 0x55, sizeof(buffer));
+}
+
+void test_empty_object(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "attributes");
+    TEST_ASSERT_EQUAL_STRING("{}", builder.c_str());
+    TEST_ASSERT_EQUAL(2, builder.length());
+}
+
+void test_strings_are_escaped(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "attributes");
+    builder.add("s", "a\"b\\c\n\r\t").add("c", "\x01\x1f").add("k\"ey", String("utf8 \xe6\xb8\xa9"));
+    TEST_ASSERT_EQUAL_STRING("{\"s\":\"a\\\"b\\\\c\\n\\r\\t\",\"c\":\"\\u0001\\u001f\",\"k\\\"ey\":\"utf8 \xe6\xb8\xa9\"}", builder.c_str());
+}
+
+void test_integers(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "attributes");
+    builder.add("b", true).add("f", false).add("i", -42).add("l", 0L).add("u", 4000000000UL);
+    builder.add("min", (long long)INT64_MIN).add("max", (unsigned long long)UINT64_MAX).add("i64", (int64_t)-5);
+    TEST_ASSERT_EQUAL_STRING("{\"b\":true,\"f\":false,\"i\":-42,\"l\":0,\"u\":4000000000,"
+                             "\"min\":-9223372036854775808,\"max\":18446744073709551615,\"i64\":-5}",
+                             builder.c_str());
+}
+
+void test_reals_are_rounded_to_the_decimals(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "attributes");
+    builder.add("d", 0.1 + 0.2).add("n", -1.5).add("z", -0.0000001).add("r", 31.25f, 1).add("e", 2.0);
+    builder.add("nan", (double)NAN).add("inf", (float)INFINITY).add("big", 1e20);
+    TEST_ASSERT_EQUAL_STRING("{\"d\":0.3,\"n\":-1.5,\"z\":0,\"r\":31.3,\"e\":2,\"nan\":null,\"inf\":null,\"big\":1e20}", builder.c_str());
+}
+
+void test_overflow_fails_the_whole_payload(void)
+{
+    // The topic "t" takes 2 bytes, {"key":"value"} and its terminating null 16 bytes. The closing brace is written by c_str().
+    builder.begin(nullptr, buffer, 17, "t");
+    builder.add("key", "value");
+    TEST_ASSERT_EQUAL_STRING("", builder.c_str());
+    TEST_ASSERT_TRUE(builder.overflowed());
+
+    builder.begin(nullptr, buffer, 18, "t");
+    builder.add("key", "value");
+    TEST_ASSERT_EQUAL_STRING("{\"key\":\"value\"}", builder.c_str());
+    TEST_ASSERT_FALSE(builder.overflowed());
+    TEST_ASSERT_EQUAL((uint8_t)0x55, (uint8_t)buffer[18]);
+}
+
+void test_members_after_close_are_dropped(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "attributes");
+    builder.add("a", 1);
+    TEST_ASSERT_EQUAL_STRING("{\"a\":1}", builder.c_str());
+    builder.add("b", 2);
+    TEST_ASSERT_TRUE(builder.overflowed());
+}
+
+void test_topic_is_copied_into_the_buffer(void)
+{
+    char topic[16] = "data/env";
+    builder.begin(nullptr, buffer, sizeof(buffer), topic);
+    strcpy(topic, "overwritten");
+    builder.add("t", 20);
+
+    TEST_ASSERT_EQUAL_STRING("data/env", buffer);
+    TEST_ASSERT_EQUAL_STRING("{\"t\":20}", builder.c_str());
+    TEST_ASSERT_TRUE(builder.c_str() == buffer + strlen("data/env") + 1);
+}
+
+void test_topic_larger_than_the_buffer(void)
+{
+    builder.begin(nullptr, buffer, 8, "data/environment");
+    builder.add("t", 20);
+    TEST_ASSERT_TRUE(builder.overflowed());
+    TEST_ASSERT_EQUAL_STRING("", builder.c_str());
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_object);
+    RUN_TEST(test_strings_are_escaped);
+    RUN_TEST(test_integers);
+    RUN_TEST(test_reals_are_rounded_to_the_decimals);
+    RUN_TEST(test_overflow_fails_the_whole_payload);
+    RUN_TEST(test_members_after_close_are_dropped);
+    RUN_TEST(test_topic_is_copied_into_the_buffer);
+    RUN_TEST(test_topic_larger_than_the_buffer);
+    return UNITY_END();
+}
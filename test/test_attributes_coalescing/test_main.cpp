@@ -0,0 +1,105 @@
+/*
+  Last-value-wins coalescing of the attributes/push messages received by ThingsCloudMQTT.
+*/
+
+#include <ThingsCloudTestHarness.h>
+
+static void connectSubscribed(ThingsCloudMQTT &client, LoopbackBroker &broker, const char *topic)
+{
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&broker, topic]
+                               { return broker.subscribed(topic); }));
+}
+
+// Memory taken by the pushes merged the way the client does, so the tests do not depend on the ArduinoJson slot size
+static size_t mergedMemoryUsage(std::initializer_list<const char *> pushes)
+{
+    DynamicJsonDocument merged(4096);
+    DynamicJsonDocument push(4096);
+    for (const char *payload : pushes)
+    {
+        deserializeJson(push, payload);
+        for (JsonPair kv : push.as<JsonObject>())
+            merged[kv.key()] = kv.value();
+    }
+    return merged.memoryUsage();
+}
+
+void test_pushes_within_the_window_are_merged(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.enableAttributesPushCoalescing(500);
+    std::vector<std::string> received;
+    client.onAttributesPush([&received](const String &message)
+                            { received.push_back(message.c_str()); });
+    connectSubscribed(client, broker, "attributes/push");
+
+    broker.publish("attributes/push", "{\"a\":1}");
+    broker.publish("attributes/push", "{\"b\":2}");
+    broker.publish("attributes/push", "{\"a\":3}");
+    loopFor(client, 100);
+    TEST_ASSERT_EQUAL(0, received.size());
+
+    TEST_ASSERT_TRUE(loopUntil(client, 500, [&received]
+                               { return received.size() == 1; }));
+    TEST_ASSERT_EQUAL_STRING("{\"a\":3,\"b\":2}", received[0].c_str());
+
+    // The next push starts a new window
+    broker.publish("attributes/push", "{\"b\":4}");
+    TEST_ASSERT_TRUE(loopUntil(client, 600, [&received]
+                               { return received.size() == 2; }));
+    TEST_ASSERT_EQUAL_STRING("{\"b\":4}", received[1].c_str());
+}
+
+void test_merged_attributes_reach_the_attribute_handlers(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.enableAttributesPushCoalescing(500);
+    std::vector<int> levels;
+    client.onAttribute("level", [&levels](const JsonVariant &value)
+                       { levels.push_back(value.as<int>()); });
+    connectSubscribed(client, broker, "attributes/push");
+
+    for (int level = 1; level <= 5; level++)
+        broker.publish("attributes/push", "{\"level\":" + std::to_string(level) + "}");
+    loopFor(client, 1000);
+
+    TEST_ASSERT_EQUAL(1, levels.size());
+    TEST_ASSERT_EQUAL(5, levels[0]);
+}
+
+void test_pending_attributes_are_dispatched_when_they_do_not_fit(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    // Room for each push, not for both
+    client.enableAttributesPushCoalescing(500, mergedMemoryUsage({"{\"a\":1,\"b\":2}", "{\"c\":3,\"d\":4,\"e\":5}"}) - 1);
+    std::vector<std::string> received;
+    client.onAttributesPush([&received](const String &message)
+                            { received.push_back(message.c_str()); });
+    connectSubscribed(client, broker, "attributes/push");
+
+    broker.publish("attributes/push", "{\"a\":1,\"b\":2}");
+    loopFor(client, 50);
+    broker.publish("attributes/push", "{\"c\":3,\"d\":4,\"e\":5}");
+    loopFor(client, 50);
+
+    // Dispatched before the end of the window, without the push that did not fit
+    TEST_ASSERT_EQUAL(1, received.size());
+    TEST_ASSERT_EQUAL_STRING("{\"a\":1,\"b\":2}", received[0].c_str());
+
+    TEST_ASSERT_TRUE(loopUntil(client, 600, [&received]
+                               { return received.size() == 2; }));
+    TEST_ASSERT_EQUAL_STRING("{\"c\":3,\"d\":4,\"e\":5}", received[1].c_str());
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_pushes_within_the_window_are_merged);
+    RUN_TEST(test_merged_attributes_reach_the_attribute_handlers);
+    RUN_TEST(test_pending_attributes_are_dispatched_when_they_do_not_fit);
+    return UNITY_END();
+}
@@ -0,0 +1,87 @@
+/*
+  Bounded inbound queue of ThingsCloudMQTT: messages copied out of the PubSubClient buffer and dispatched by loop().
+*/
+
+#include <ThingsCloudTestHarness.h>
+
+static void connectSubscribed(ThingsCloudMQTT &client, LoopbackBroker &broker, const char *topic)
+{
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&broker, topic]
+                               { return broker.subscribed(topic); }));
+}
+
+void test_queued_messages_are_dispatched_in_order(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.enableInboundQueue(4, 128);
+    client.setInboundDispatchBudget(1, 0);
+    std::vector<std::string> received;
+    client.subscribe("data/#", [&received](const String &topic, const String &message)
+                     { received.push_back(std::string(topic.c_str()) + " " + message.c_str()); });
+    connectSubscribed(client, broker, "data/#");
+
+    broker.publish("data/a", "first");
+    broker.publish("data/b", "second");
+    broker.publish("data/a", "third");
+    loopFor(client, 100);
+
+    TEST_ASSERT_EQUAL(3, received.size());
+    TEST_ASSERT_EQUAL_STRING("data/a first", received[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("data/b second", received[1].c_str());
+    TEST_ASSERT_EQUAL_STRING("data/a third", received[2].c_str());
+    TEST_ASSERT_EQUAL(0, client.getInboundOverflowCount());
+}
+
+// The view points into the queue slot, so publishing from the handler does not overwrite it
+void test_payload_view_survives_a_publish_from_the_handler(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.enableInboundQueue(4, 128);
+    std::string before;
+    std::string after;
+    client.subscribe("data/in", [&](const char *, const uint8_t *payload, size_t length)
+                     {
+                         before.assign((const char *)payload, length);
+                         client.publish("data/reply", std::string(200, 'r').c_str());
+                         after.assign((const char *)payload, length); });
+    connectSubscribed(client, broker, "data/in");
+
+    broker.publish("data/in", "request-payload");
+    loopFor(client, 100);
+
+    TEST_ASSERT_EQUAL_STRING("request-payload", before.c_str());
+    TEST_ASSERT_EQUAL_STRING("request-payload", after.c_str());
+    TEST_ASSERT_EQUAL(1, broker.publishedOn("data/reply").size());
+}
+
+void test_message_larger_than_a_slot_is_dropped(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.enableInboundQueue(4, 32);
+    std::vector<std::string> received;
+    client.subscribe("data/in", [&received](const String &message)
+                     { received.push_back(message.c_str()); });
+    connectSubscribed(client, broker, "data/in");
+
+    // The slot holds the topic and the payload, both null-terminated
+    broker.publish("data/in", std::string(32 - strlen("data/in") - 2, 'f'));
+    broker.publish("data/in", std::string(32 - strlen("data/in") - 1, 'x'));
+    loopFor(client, 100);
+
+    TEST_ASSERT_EQUAL(1, received.size());
+    TEST_ASSERT_EQUAL(23, received[0].size());
+    TEST_ASSERT_EQUAL(1, client.getInboundOverflowCount());
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_queued_messages_are_dispatched_in_order);
+    RUN_TEST(test_payload_view_survives_a_publish_from_the_handler);
+    RUN_TEST(test_message_larger_than_a_slot_is_dropped);
+    return UNITY_END();
+}
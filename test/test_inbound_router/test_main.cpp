@@ -0,0 +1,111 @@
+/*
+  Method-keyed command router and per-key attribute handlers of ThingsCloudMQTT, fed by the loopback broker.
+*/
+
+#include <ThingsCloudTestHarness.h>
+
+// Connected client, with the subscription of the router made
+static void connectRouted(ThingsCloudMQTT &client, LoopbackBroker &broker, const char *topic)
+{
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&broker, topic]
+                               { return broker.subscribed(topic); }));
+}
+
+void test_command_is_routed_to_its_method(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    std::vector<std::string> calls;
+    TEST_ASSERT_TRUE(client.onCommand("restart", [&calls](const String &topic, const JsonObject &params)
+                                      { calls.push_back(std::string("restart ") + topic.c_str() + " " + std::to_string(params["delay"].as<int>())); }));
+    TEST_ASSERT_TRUE(client.onCommand("open", [&calls](const String &topic, const JsonObject &params)
+                                      { calls.push_back(std::string("open ") + topic.c_str()); }));
+    connectRouted(client, broker, "command/send/+");
+
+    broker.publish("command/send/7", "{\"method\":\"restart\",\"params\":{\"delay\":5}}");
+    // The params may come before the method
+    broker.publish("command/send/8", "{\"params\":{\"door\":1},\"method\":\"open\"}");
+    loopFor(client, 100);
+
+    TEST_ASSERT_EQUAL(2, calls.size());
+    TEST_ASSERT_EQUAL_STRING("restart command/send/7 5", calls[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("open command/send/8", calls[1].c_str());
+}
+
+void test_unknown_command_gets_its_method(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    bool routed = false;
+    std::string unknown;
+    client.onCommand("restart", [&routed](const String &, const JsonObject &)
+                     { routed = true; });
+    client.setOnUnknownCommand([&unknown](const String &topic, const String &method)
+                               { unknown = std::string(topic.c_str()) + " " + method.c_str(); });
+    connectRouted(client, broker, "command/send/+");
+
+    broker.publish("command/send/3", "{\"method\":\"reboot\",\"params\":{}}");
+    // No method, nothing is called
+    broker.publish("command/send/4", "{\"params\":{}}");
+    loopFor(client, 100);
+
+    TEST_ASSERT_FALSE(routed);
+    TEST_ASSERT_EQUAL_STRING("command/send/3 reboot", unknown.c_str());
+}
+
+void test_router_does_not_share_its_topic_with_another_decoder(void)
+{
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    TEST_ASSERT_TRUE(client.onCommand("restart", [](const String &, const JsonObject &) {}));
+    TEST_ASSERT_FALSE(client.subscribeCompressed("command/send/+", [](const char *, const uint8_t *, size_t) {}));
+    // The other subscribers of the topic still get the messages
+    TEST_ASSERT_TRUE(client.subscribe("command/send/+", [](const String &) {}));
+}
+
+void test_attributes_are_routed_to_their_handlers(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    std::vector<std::string> calls;
+    TEST_ASSERT_TRUE(client.onAttribute("relay", [&calls](const JsonVariant &value)
+                                        { calls.push_back(std::string("relay ") + (value.as<bool>() ? "on" : "off")); }));
+    TEST_ASSERT_TRUE(client.onAttribute("level", [&calls](const JsonVariant &value)
+                                        { calls.push_back("level " + std::to_string(value.as<int>())); }));
+    connectRouted(client, broker, "attributes/push");
+
+    // The members without handler are skipped, nested ones included
+    broker.publish("attributes/push", "{\"level\":3,\"other\":{\"relay\":false},\"relay\":true}");
+    loopFor(client, 100);
+
+    TEST_ASSERT_EQUAL(2, calls.size());
+    TEST_ASSERT_EQUAL_STRING("level 3", calls[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("relay on", calls[1].c_str());
+}
+
+void test_get_attributes_response_is_routed(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    std::vector<std::string> calls;
+    client.onAttribute("relay", [&calls](const JsonVariant &value)
+                       { calls.push_back(std::string("relay ") + (value.as<bool>() ? "on" : "off")); });
+    connectRouted(client, broker, "attributes/get/response/+");
+
+    broker.publish("attributes/get/response/1", "{\"result\":1,\"attributes\":{\"relay\":false,\"level\":2}}");
+    loopFor(client, 100);
+
+    TEST_ASSERT_EQUAL(1, calls.size());
+    TEST_ASSERT_EQUAL_STRING("relay off", calls[0].c_str());
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_command_is_routed_to_its_method);
+    RUN_TEST(test_unknown_command_gets_its_method);
+    RUN_TEST(test_router_does_not_share_its_topic_with_another_decoder);
+    RUN_TEST(test_attributes_are_routed_to_their_handlers);
+    RUN_TEST(test_get_attributes_response_is_routed);
+    return UNITY_END();
+}
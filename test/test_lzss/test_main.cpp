@@ -0,0 +1,170 @@
+/*
+  Round trips and corrupted input rejection of ThingsCloudLZSS.
+*/
+
+#include <ThingsCloudTestHarness.h>
+#include <ThingsCloudLZSS.h>
+#include <vector>
+
+// Compress then decompress, return the compressed size
+static size_t roundTrip(const std::vector<uint8_t> &input)
+{
+    std::vector<uint8_t> compressed(ThingsCloudLZSS::maxCompressedSize(input.size()));
+    size_t compressedLength = ThingsCloudLZSS::compress(input.data(), input.size(), compressed.data(), compressed.size());
+    TEST_ASSERT_TRUE(compressedLength > 0);
+    TEST_ASSERT_TRUE(compressedLength <= input.size() + 1);
+    TEST_ASSERT_TRUE(ThingsCloudLZSS::isCompressed(compressed.data(), compressedLength));
+
+    size_t size = ThingsCloudLZSS::decompressedSize(compressed.data(), compressedLength);
+    TEST_ASSERT_EQUAL(input.size(), size);
+    TEST_ASSERT_TRUE(size <= ThingsCloudLZSS::maxDecompressedSize(compressedLength) || compressed[0] == ThingsCloudLZSS::HEADER_STORED);
+
+    std::vector<uint8_t> output(size + 1);
+    size_t outputLength = 0;
+    TEST_ASSERT_TRUE(ThingsCloudLZSS::decompress(compressed.data(), compressedLength, output.data(), size, outputLength));
+    TEST_ASSERT_EQUAL(input.size(), outputLength);
+    if (input.size() > 0)
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(input.data(), output.data(), input.size());
+    return compressedLength;
+}
+
+static std::vector<uint8_t> bytes(const char *str)
+{
+    return std::vector<uint8_t>(str, str + strlen(str));
+}
+
+static std::vector<uint8_t> compress(const std::vector<uint8_t> &input)
+{
+    std::vector<uint8_t> compressed(ThingsCloudLZSS::maxCompressedSize(input.size()));
+    compressed.resize(ThingsCloudLZSS::compress(input.data(), input.size(), compressed.data(), compressed.size()));
+    return compressed;
+}
+
+static bool decompress(const std::vector<uint8_t> &input, size_t outputSize = 1024)
+{
+    std::vector<uint8_t> output(outputSize);
+    size_t outputLength = 0;
+    return ThingsCloudLZSS::decompress(input.data(), input.size(), output.data(), output.size(), outputLength);
+}
+
+void test_repetitive_payload_shrinks(void)
+{
+    std::string batch;
+    for (int i = 0; i < 40; i++)
+        batch += "{\"temperature\":" + std::to_string(20 + i % 5) + ",\"humidity\":62},";
+    std::vector<uint8_t> input(batch.begin(), batch.end());
+
+    size_t compressedLength = roundTrip(input);
+    TEST_ASSERT_TRUE(compressedLength < input.size() / 4);
+    TEST_ASSERT_EQUAL(ThingsCloudLZSS::HEADER_COMPRESSED, compress(input)[0]);
+}
+
+void test_overlapping_matches(void)
+{
+    roundTrip(std::vector<uint8_t>(1000, 'a'));
+    roundTrip(bytes("abababababababababababababababab"));
+}
+
+void test_matches_across_the_window(void)
+{
+    // Repeats farther than the window are written as literals
+    std::vector<uint8_t> input;
+    for (int i = 0; i < 3000; i++)
+        input.push_back((i * 7919) % 251 ^ (i / 600));
+    roundTrip(input);
+}
+
+void test_incompressible_payload_is_stored(void)
+{
+    std::vector<uint8_t> input;
+    uint32_t seed = 12345;
+    for (int i = 0; i < 300; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        input.push_back(seed >> 24);
+    }
+
+    TEST_ASSERT_EQUAL(input.size() + 1, roundTrip(input));
+    TEST_ASSERT_EQUAL(ThingsCloudLZSS::HEADER_STORED, compress(input)[0]);
+}
+
+void test_empty_and_tiny_payloads(void)
+{
+    roundTrip(std::vector<uint8_t>());
+    roundTrip(bytes("a"));
+    roundTrip(bytes("abc"));
+}
+
+void test_payload_longer_than_65535_bytes_is_refused(void)
+{
+    std::vector<uint8_t> input(70000, 'a');
+    std::vector<uint8_t> output(ThingsCloudLZSS::maxCompressedSize(input.size()));
+    TEST_ASSERT_EQUAL(0, ThingsCloudLZSS::compress(input.data(), input.size(), output.data(), output.size()));
+}
+
+void test_truncated_stream_is_rejected(void)
+{
+    std::vector<uint8_t> compressed = compress(std::vector<uint8_t>(500, 'x'));
+    TEST_ASSERT_EQUAL(ThingsCloudLZSS::HEADER_COMPRESSED, compressed[0]);
+    compressed.pop_back();
+    TEST_ASSERT_FALSE(decompress(compressed));
+}
+
+void test_match_before_the_start_is_rejected(void)
+{
+    // A match at distance 1 with nothing decoded yet
+    const uint8_t input[] = {ThingsCloudLZSS::HEADER_COMPRESSED, 0x00, 0x03, 0x01, 0x00, 0x00};
+    TEST_ASSERT_FALSE(decompress(std::vector<uint8_t>(input, input + sizeof(input))));
+}
+
+void test_match_past_the_announced_size_is_rejected(void)
+{
+    // 'a' then a 130 bytes match, for 4 bytes announced
+    const uint8_t input[] = {ThingsCloudLZSS::HEADER_COMPRESSED, 0x00, 0x04, 0x02, 'a', 0x00, 0x7F};
+    TEST_ASSERT_FALSE(decompress(std::vector<uint8_t>(input, input + sizeof(input))));
+}
+
+void test_size_larger_than_the_payload_can_hold_is_rejected(void)
+{
+    // 65535 bytes announced by a 5 bytes message
+    const uint8_t input[] = {ThingsCloudLZSS::HEADER_COMPRESSED, 0xFF, 0xFF, 0x01, 0x00};
+    TEST_ASSERT_EQUAL(0, ThingsCloudLZSS::decompressedSize(input, sizeof(input)));
+    TEST_ASSERT_FALSE(decompress(std::vector<uint8_t>(input, input + sizeof(input)), 0x10000));
+
+    const uint8_t header[] = {ThingsCloudLZSS::HEADER_COMPRESSED, 0x00, 0x01};
+    TEST_ASSERT_EQUAL(0, ThingsCloudLZSS::decompressedSize(header, sizeof(header)));
+    TEST_ASSERT_FALSE(decompress(std::vector<uint8_t>(header, header + sizeof(header))));
+}
+
+void test_output_too_small_is_rejected(void)
+{
+    std::vector<uint8_t> compressed = compress(std::vector<uint8_t>(500, 'x'));
+    TEST_ASSERT_FALSE(decompress(compressed, 499));
+    TEST_ASSERT_TRUE(decompress(compressed, 500));
+}
+
+void test_invalid_header_is_rejected(void)
+{
+    TEST_ASSERT_FALSE(ThingsCloudLZSS::isCompressed((const uint8_t *)"{}", 2));
+    TEST_ASSERT_FALSE(decompress(bytes("{\"a\":1}")));
+    TEST_ASSERT_FALSE(decompress(std::vector<uint8_t>(1, (uint8_t)ThingsCloudLZSS::HEADER_COMPRESSED)));
+    TEST_ASSERT_EQUAL(0, ThingsCloudLZSS::decompressedSize((const uint8_t *)"\xF5\x00", 2));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_repetitive_payload_shrinks);
+    RUN_TEST(test_overlapping_matches);
+    RUN_TEST(test_matches_across_the_window);
+    RUN_TEST(test_incompressible_payload_is_stored);
+    RUN_TEST(test_empty_and_tiny_payloads);
+    RUN_TEST(test_payload_longer_than_65535_bytes_is_refused);
+    RUN_TEST(test_truncated_stream_is_rejected);
+    RUN_TEST(test_match_before_the_start_is_rejected);
+    RUN_TEST(test_match_past_the_announced_size_is_rejected);
+    RUN_TEST(test_size_larger_than_the_payload_can_hold_is_rejected);
+    RUN_TEST(test_output_too_small_is_rejected);
+    RUN_TEST(test_invalid_header_is_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,152 @@
+/*
+  Connection, subscriptions and publishing of ThingsCloudMQTT against the loopback broker.
+*/
+
+#include <ThingsCloudTestHarness.h>
+
+void test_connects_with_the_access_token(void)
+{
+    LoopbackBroker broker;
+    TEST_ASSERT_TRUE(broker.listening());
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_EQUAL(1, broker.connectCount);
+    TEST_ASSERT_EQUAL_STRING("test-access-token", broker.username.c_str());
+    TEST_ASSERT_EQUAL_STRING("test-project-key", broker.password.c_str());
+    TEST_ASSERT_EQUAL(1, client.getConnectionEstablishedCount());
+}
+
+void test_subscription_receives_the_broker_messages(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    std::vector<std::string> received;
+    client.subscribe("data/in", [&received](const String &message)
+                     { received.push_back(message.c_str()); });
+
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&broker]
+                               { return broker.subscribed("data/in"); }));
+
+    broker.publish("data/in", "first");
+    broker.publish("data/other", "ignored");
+    broker.publish("data/in", "second");
+    loopFor(client, 100);
+    TEST_ASSERT_EQUAL(2, received.size());
+    TEST_ASSERT_EQUAL_STRING("first", received[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("second", received[1].c_str());
+}
+
+void test_callback_unsubscribes_during_dispatch(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    std::vector<std::string> received;
+    client.subscribe("data/in", [&client, &received](const String &message)
+                     {
+                         received.push_back("in " + std::string(message.c_str()));
+                         client.unsubscribe("data/in");
+                         client.subscribe("data/new", [&received](const String &message)
+                                          { received.push_back("new " + std::string(message.c_str())); });
+                     });
+    client.subscribe("data/+", [&received](const String &message)
+                     { received.push_back("plus " + std::string(message.c_str())); });
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&broker]
+                               { return broker.subscriptions.size() == 2; }));
+
+    broker.publish("data/in", "first");
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&broker]
+                               { return broker.subscribed("data/new") && !broker.subscribed("data/in"); }));
+    broker.publish("data/in", "second");
+    broker.publish("data/new", "third");
+    loopFor(client, 100);
+
+    TEST_ASSERT_EQUAL(5, received.size());
+    TEST_ASSERT_EQUAL_STRING("in first", received[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("plus first", received[1].c_str());
+    TEST_ASSERT_EQUAL_STRING("plus second", received[2].c_str());
+    TEST_ASSERT_EQUAL_STRING("plus third", received[3].c_str());
+    TEST_ASSERT_EQUAL_STRING("new third", received[4].c_str());
+}
+
+void test_publish_reaches_the_broker(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    TEST_ASSERT_TRUE(connectClient(client));
+
+    TEST_ASSERT_TRUE(client.publish("data/out", "{\"a\":1}"));
+    loopFor(client, 100);
+    std::vector<LoopbackBroker::Publish> messages = broker.publishedOn("data/out");
+    TEST_ASSERT_EQUAL(1, messages.size());
+    TEST_ASSERT_EQUAL_STRING("{\"a\":1}", messages[0].payload.c_str());
+    TEST_ASSERT_EQUAL(0, messages[0].qos);
+}
+
+void test_subscriptions_are_restored_after_a_reconnection(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.subscribe("data/a", [](const String &) {});
+    client.subscribe("data/b", [](const String &) {});
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&broker]
+                               { return broker.subscriptions.size() == 2; }));
+
+    broker.closeClient();
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&client]
+                               { return !client.isMqttConnected(); }));
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&broker]
+                               { return broker.subscribed("data/a") && broker.subscribed("data/b"); }));
+    TEST_ASSERT_EQUAL(2, broker.connectCount);
+    TEST_ASSERT_EQUAL(2, client.getConnectionEstablishedCount());
+}
+
+void test_rejected_connection_is_retried(void)
+{
+    LoopbackBroker broker;
+    broker.connackCode = 3; // Server unavailable
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+
+    loopFor(client, 60000);
+    TEST_ASSERT_FALSE(client.isMqttConnected());
+    TEST_ASSERT_TRUE(broker.connectCount >= 2);
+    TEST_ASSERT_EQUAL(0, broker.disconnectCount); // Closed by PubSubClient on the refused CONNACK
+
+    broker.connackCode = 0;
+    TEST_ASSERT_TRUE(connectClient(client, 600000));
+}
+
+void test_unanswered_connect_times_out(void)
+{
+    LoopbackBroker broker;
+    broker.answerConnect = false;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.setMqttConnectionTimeouts(1000, 1000, 2000);
+
+    TEST_ASSERT_TRUE(loopUntil(client, 60000, [&broker]
+                               { return broker.connectCount == 1; }));
+    TEST_ASSERT_TRUE(loopUntil(client, 2100, [&client]
+                               { return !client.isMqttConnecting(); }));
+    TEST_ASSERT_FALSE(client.isMqttConnected());
+
+    // CONNECT was written, so the attempt ends with a DISCONNECT
+    pollLoopbackServers();
+    TEST_ASSERT_EQUAL(1, broker.disconnectCount);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_connects_with_the_access_token);
+    RUN_TEST(test_subscription_receives_the_broker_messages);
+    RUN_TEST(test_callback_unsubscribes_during_dispatch);
+    RUN_TEST(test_publish_reaches_the_broker);
+    RUN_TEST(test_subscriptions_are_restored_after_a_reconnection);
+    RUN_TEST(test_rejected_connection_is_retried);
+    RUN_TEST(test_unanswered_connect_times_out);
+    return UNITY_END();
+}
@@ -0,0 +1,135 @@
+/*
+  Retry delays of ThingsCloudMQTT and the WiFi reset after repeated MQTT connection failures.
+*/
+
+#include <ThingsCloudTestHarness.h>
+
+// Every retry delay asked to the policy
+struct PolicyCall
+{
+    ReconnectTarget target;
+    unsigned int failedAttempts;
+};
+
+void test_policy_gets_the_failed_attempts(void)
+{
+    LoopbackBroker broker;
+    broker.connackCode = 3; // Server unavailable
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    std::vector<PolicyCall> calls;
+    client.setReconnectPolicy([&calls](ReconnectTarget target, unsigned int failedAttempts)
+                              {
+                                  calls.push_back({target, failedAttempts});
+                                  return 1000UL; });
+
+    TEST_ASSERT_TRUE(loopUntil(client, 60000, [&broker]
+                               { return broker.connectCount == 3; }));
+    TEST_ASSERT_EQUAL(2, calls.size());
+    TEST_ASSERT_EQUAL(RECONNECT_MQTT, calls[0].target);
+    TEST_ASSERT_EQUAL(1, calls[0].failedAttempts);
+    TEST_ASSERT_EQUAL(2, calls[1].failedAttempts);
+
+    broker.connackCode = 0;
+    TEST_ASSERT_TRUE(connectClient(client));
+}
+
+void test_policy_delay_spaces_the_attempts(void)
+{
+    LoopbackBroker broker;
+    broker.connackCode = 3;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.setReconnectPolicy([](ReconnectTarget, unsigned int)
+                              { return 20000UL; });
+
+    TEST_ASSERT_TRUE(loopUntil(client, 60000, [&broker]
+                               { return broker.connectCount == 1; }));
+    unsigned long firstAttempt = millis();
+    TEST_ASSERT_TRUE(loopUntil(client, 60000, [&broker]
+                               { return broker.connectCount == 2; }));
+    TEST_ASSERT_TRUE(millis() - firstAttempt >= 20000);
+    TEST_ASSERT_TRUE(millis() - firstAttempt < 21000);
+}
+
+// Full jitter: every delay stays under its exponential ceiling, and they are not all the same
+void test_default_backoff_stays_under_the_ceiling(void)
+{
+    LoopbackBroker broker;
+    broker.connackCode = 3;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.setMqttReconnectionAttemptDelay(1000);
+    client.setReconnectionBackoff(8000);
+
+    std::vector<unsigned long> attempts;
+    unsigned int seen = 0;
+    loopUntil(client, 600000, [&]
+              {
+                  if (broker.connectCount != seen)
+                  {
+                      seen = broker.connectCount;
+                      attempts.push_back(millis());
+                  }
+                  return attempts.size() == 8; });
+    TEST_ASSERT_EQUAL(8, attempts.size());
+
+    bool allEqual = true;
+    for (std::size_t i = 1; i < attempts.size(); i++)
+    {
+        unsigned long ceiling = std::min(1000UL << (i - 1), 8000UL);
+        unsigned long gap = attempts[i] - attempts[i - 1];
+        TEST_ASSERT_TRUE_MESSAGE(gap <= ceiling + 100, ("retry " + std::to_string(i) + " after " + std::to_string(gap) + " ms").c_str());
+        if (i > 1 && gap != attempts[1] - attempts[0])
+            allEqual = false;
+    }
+    TEST_ASSERT_FALSE(allEqual);
+}
+
+void test_wifi_is_reset_after_the_threshold(void)
+{
+    LoopbackBroker broker;
+    broker.connackCode = 3;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.setWifiCredentials("home", "secret");
+    client.setWifiResetThreshold(3);
+    client.setReconnectPolicy([](ReconnectTarget target, unsigned int)
+                              { return target == RECONNECT_WIFI ? 100UL : 1000UL; });
+
+    TEST_ASSERT_TRUE(loopUntil(client, 60000, [&broker]
+                               { return broker.connectCount == 2; }));
+    TEST_ASSERT_EQUAL(0, WiFi.hostDisconnectCount);
+
+    TEST_ASSERT_TRUE(loopUntil(client, 60000, []
+                               { return WiFi.hostDisconnectCount == 1; }));
+    TEST_ASSERT_EQUAL(3, broker.connectCount);
+
+    // Joined again after the delay of the policy
+    unsigned long resetMillis = millis();
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, []
+                               { return WiFi.hostBeginCount == 1; }));
+    TEST_ASSERT_TRUE(millis() - resetMillis >= 100);
+}
+
+void test_wifi_reset_can_be_disabled(void)
+{
+    LoopbackBroker broker;
+    broker.connackCode = 3;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.setWifiCredentials("home", "secret");
+    client.setWifiResetThreshold(0);
+    client.setReconnectPolicy([](ReconnectTarget, unsigned int)
+                              { return 1000UL; });
+
+    TEST_ASSERT_TRUE(loopUntil(client, 60000, [&broker]
+                               { return broker.connectCount == 12; }));
+    TEST_ASSERT_EQUAL(0, WiFi.hostDisconnectCount);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_policy_gets_the_failed_attempts);
+    RUN_TEST(test_policy_delay_spaces_the_attempts);
+    RUN_TEST(test_default_backoff_stays_under_the_ceiling);
+    RUN_TEST(test_wifi_is_reset_after_the_threshold);
+    RUN_TEST(test_wifi_reset_can_be_disabled);
+    return UNITY_END();
+}
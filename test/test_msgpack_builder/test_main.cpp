@@ -0,0 +1,141 @@
+/*
+  MessagePack encoding and overflow of ThingsCloudMsgPackBuilder.
+*/
+
+#include <ThingsCloudTestHarness.h>
+#include <ThingsCloudMsgPackBuilder.h>
+
+static uint8_t buffer[256];
+static ThingsCloudMsgPackBuilder builder;
+
+static void assertPayload(const uint8_t *expected, size_t length)
+{
+    const uint8_t *data = builder.data();
+    TEST_ASSERT_NOT_NULL(data);
+    TEST_ASSERT_EQUAL(length, builder.length());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, data, length);
+}
+
+void setUpTest(void)
+{
+    memset(buffer, 0x55, sizeof(buffer));
+}
+
+void test_empty_map(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "data/env");
+    const uint8_t expected[] = {0xDE, 0x00, 0x00};
+    assertPayload(expected, sizeof(expected));
+}
+
+void test_integers_take_the_smallest_encoding(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "data/env");
+    builder.add("a", 1).add("b", -1).add("c", -33).add("d", 200U).add("e", -200L).add("f", 70000UL);
+    const uint8_t expected[] = {
+        0xDE, 0x00, 0x06,
+        0xA1, 'a', 0x01,
+        0xA1, 'b', 0xFF,
+        0xA1, 'c', 0xD0, 0xDF,
+        0xA1, 'd', 0xCC, 0xC8,
+        0xA1, 'e', 0xD1, 0xFF, 0x38,
+        0xA1, 'f', 0xCE, 0x00, 0x01, 0x11, 0x70};
+    assertPayload(expected, sizeof(expected));
+}
+
+void test_64_bit_integers(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "data/env");
+    builder.add("min", (long long)INT64_MIN).add("max", (unsigned long long)UINT64_MAX).add("i64", (int64_t)-5);
+    const uint8_t expected[] = {
+        0xDE, 0x00, 0x03,
+        0xA3, 'm', 'i', 'n', 0xD3, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xA3, 'm', 'a', 'x', 0xCF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xA3, 'i', '6', '4', 0xFB};
+    assertPayload(expected, sizeof(expected));
+}
+
+void test_booleans_and_strings(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "data/env");
+    builder.add("t", true).add("f", false).add("s", String("abcdefghijklmnopqrstuvwxyz012345"));
+    const uint8_t expected[] = {
+        0xDE, 0x00, 0x03,
+        0xA1, 't', 0xC3,
+        0xA1, 'f', 0xC2,
+        0xA1, 's', 0xD9, 0x20,
+        'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p',
+        'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5'};
+    assertPayload(expected, sizeof(expected));
+}
+
+void test_reals(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "data/env");
+    builder.add("i", 2.0).add("f", 1.5f).add("d", 1.5).add("r", 0.1 + 0.2).add("n", (double)NAN);
+    const uint8_t expected[] = {
+        0xDE, 0x00, 0x05,
+        0xA1, 'i', 0x02,
+        0xA1, 'f', 0xCA, 0x3F, 0xC0, 0x00, 0x00,
+        0xA1, 'd', 0xCB, 0x3F, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xA1, 'r', 0xCB, 0x3F, 0xD3, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+        0xA1, 'n', 0xC0};
+    assertPayload(expected, sizeof(expected));
+}
+
+void test_overflow_fails_the_whole_payload(void)
+{
+    // The topic "t" takes 2 bytes, the map header 3 bytes and the member 3 bytes
+    builder.begin(nullptr, buffer, 7, "t");
+    builder.add("a", 1);
+    TEST_ASSERT_TRUE(builder.overflowed());
+    TEST_ASSERT_NULL(builder.data());
+
+    builder.begin(nullptr, buffer, 8, "t");
+    builder.add("a", 1);
+    TEST_ASSERT_FALSE(builder.overflowed());
+    TEST_ASSERT_NOT_NULL(builder.data());
+    TEST_ASSERT_EQUAL(6, builder.length());
+}
+
+void test_members_after_close_are_dropped(void)
+{
+    builder.begin(nullptr, buffer, sizeof(buffer), "data/env");
+    builder.add("a", 1);
+    TEST_ASSERT_NOT_NULL(builder.data());
+    builder.add("b", 2);
+    TEST_ASSERT_TRUE(builder.overflowed());
+}
+
+void test_topic_is_copied_into_the_buffer(void)
+{
+    char topic[16] = "data/env";
+    builder.begin(nullptr, buffer, sizeof(buffer), topic);
+    strcpy(topic, "overwritten");
+
+    TEST_ASSERT_EQUAL_STRING("data/env", (const char *)buffer);
+    TEST_ASSERT_TRUE(builder.data() == buffer + strlen("data/env") + 1);
+}
+
+void test_topic_larger_than_the_buffer(void)
+{
+    builder.begin(nullptr, buffer, 8, "data/environment");
+    builder.add("t", 20);
+    TEST_ASSERT_TRUE(builder.overflowed());
+    TEST_ASSERT_NULL(builder.data());
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_map);
+    RUN_TEST(test_integers_take_the_smallest_encoding);
+    RUN_TEST(test_64_bit_integers);
+    RUN_TEST(test_booleans_and_strings);
+    RUN_TEST(test_reals);
+    RUN_TEST(test_overflow_fails_the_whole_payload);
+    RUN_TEST(test_members_after_close_are_dropped);
+    RUN_TEST(test_topic_is_copied_into_the_buffer);
+    RUN_TEST(test_topic_larger_than_the_buffer);
+    return UNITY_END();
+}
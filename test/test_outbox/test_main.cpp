@@ -0,0 +1,274 @@
+/*
+  Ordering, priority classes and spill file recovery of ThingsCloudOutbox.
+*/
+
+#include <ThingsCloudTestHarness.h>
+#include <ThingsCloudOutbox.h>
+#include <LittleFS.h>
+
+#define SPILL_PATH "/outbox_test.bin"
+
+// Records of a 1 byte topic and a 5 bytes payload take 12 bytes in RAM: 6 bytes of header, the topic and the payload
+#define RECORD_SIZE 12
+// and 16 bytes in the spill file, its header has the CRC32 on top
+#define SPILL_RECORD_SIZE 16
+
+static bool pushMessage(ThingsCloudOutbox &outbox, const char *payload, const PublishPriority priority = PRIORITY_BULK, const char *topic = "t")
+{
+    return outbox.push(topic, (const uint8_t *)payload, strlen(payload), false, false, priority);
+}
+
+// Payload of the next message, removed from the outbox. "" when empty.
+static std::string popMessage(ThingsCloudOutbox &outbox)
+{
+    ThingsCloudOutboxMessage message;
+    if (!outbox.front(message))
+        return "";
+    outbox.pop();
+    return std::string(message.payload.begin(), message.payload.end());
+}
+
+void test_messages_are_sent_in_order(void)
+{
+    ThingsCloudOutbox outbox;
+    outbox.begin(256);
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+
+    TEST_ASSERT_TRUE(outbox.push("data/a", (const uint8_t *)"first", 5, true, false));
+    TEST_ASSERT_TRUE(pushMessage(outbox, "secnd"));
+    TEST_ASSERT_EQUAL(2, outbox.getCount());
+
+    ThingsCloudOutboxMessage message;
+    TEST_ASSERT_TRUE(outbox.front(message));
+    TEST_ASSERT_EQUAL_STRING("data/a", message.topic.c_str());
+    TEST_ASSERT_TRUE(message.retain);
+    outbox.pop();
+
+    TEST_ASSERT_EQUAL_STRING("secnd", popMessage(outbox).c_str());
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+    TEST_ASSERT_FALSE(outbox.front(message));
+}
+
+void test_higher_classes_are_sent_first(void)
+{
+    ThingsCloudOutbox outbox;
+    outbox.begin(256);
+    pushMessage(outbox, "bulk1", PRIORITY_BULK);
+    pushMessage(outbox, "attr1", PRIORITY_ATTRIBUTE);
+    pushMessage(outbox, "alarm", PRIORITY_CRITICAL);
+    pushMessage(outbox, "bulk2", PRIORITY_BULK);
+    pushMessage(outbox, "reply", PRIORITY_COMMAND_REPLY);
+
+    TEST_ASSERT_EQUAL(3, outbox.getCount(PRIORITY_ATTRIBUTE));
+    TEST_ASSERT_EQUAL_STRING("alarm", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("reply", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("attr1", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("bulk1", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("bulk2", popMessage(outbox).c_str());
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+}
+
+void test_tombstones_are_reclaimed_with_the_head(void)
+{
+    ThingsCloudOutbox outbox;
+    outbox.begin(3 * RECORD_SIZE);
+    pushMessage(outbox, "bulkA", PRIORITY_BULK);
+    pushMessage(outbox, "alarm", PRIORITY_CRITICAL);
+    pushMessage(outbox, "bulkC", PRIORITY_BULK);
+
+    // The alarm leaves a tombstone between the bulk messages, reclaimed once bulkA is sent
+    TEST_ASSERT_EQUAL_STRING("alarm", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("bulkA", popMessage(outbox).c_str());
+
+    // The ring wraps around its end
+    TEST_ASSERT_TRUE(pushMessage(outbox, "bulkD"));
+    TEST_ASSERT_TRUE(pushMessage(outbox, "bulkE"));
+    TEST_ASSERT_EQUAL(0, outbox.getDroppedCount());
+    TEST_ASSERT_EQUAL_STRING("bulkC", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("bulkD", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("bulkE", popMessage(outbox).c_str());
+}
+
+void test_replace_topic_keeps_the_latest_message(void)
+{
+    ThingsCloudOutbox outbox;
+    outbox.begin(256);
+    outbox.push("attributes", (const uint8_t *)"old", 3, false, true);
+    pushMessage(outbox, "other");
+    outbox.push("attributes", (const uint8_t *)"new", 3, false, true);
+
+    TEST_ASSERT_EQUAL(2, outbox.getCount());
+    TEST_ASSERT_EQUAL_STRING("other", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("new", popMessage(outbox).c_str());
+}
+
+void test_full_ring_drops_the_oldest_message(void)
+{
+    ThingsCloudOutbox outbox;
+    outbox.begin(2 * RECORD_SIZE);
+    pushMessage(outbox, "msg_0");
+    pushMessage(outbox, "msg_1");
+    pushMessage(outbox, "msg_2");
+
+    TEST_ASSERT_EQUAL(1, outbox.getDroppedCount());
+    TEST_ASSERT_EQUAL_STRING("msg_1", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("msg_2", popMessage(outbox).c_str());
+}
+
+void test_messages_that_can_never_be_sent_are_refused(void)
+{
+    ThingsCloudOutbox outbox;
+    outbox.begin(RECORD_SIZE);
+    outbox.setMaxTopicLength(4);
+
+    TEST_ASSERT_FALSE(pushMessage(outbox, "too_long"));
+    TEST_ASSERT_FALSE(pushMessage(outbox, "msg_0", PRIORITY_BULK, "topic"));
+    TEST_ASSERT_FALSE(pushMessage(outbox, "msg_0", PRIORITY_BULK, ""));
+    TEST_ASSERT_EQUAL(3, outbox.getDroppedCount());
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+}
+
+void test_spill_file_keeps_the_order(void)
+{
+    ThingsCloudOutbox outbox;
+    outbox.begin(2 * RECORD_SIZE);
+    TEST_ASSERT_TRUE(outbox.enableSpill(SPILL_PATH, 4096));
+    for (char i = '0'; i < '5'; i++)
+        pushMessage(outbox, (std::string("msg_") + i).c_str());
+
+    TEST_ASSERT_TRUE(LittleFS.exists(SPILL_PATH));
+    TEST_ASSERT_EQUAL(3 * SPILL_RECORD_SIZE, LittleFS.open(SPILL_PATH, "r").size());
+    TEST_ASSERT_EQUAL(5, outbox.getCount());
+    TEST_ASSERT_EQUAL(0, outbox.getDroppedCount());
+    for (char i = '0'; i < '5'; i++)
+        TEST_ASSERT_EQUAL_STRING((std::string("msg_") + i).c_str(), popMessage(outbox).c_str());
+
+    // Removed once every message is sent
+    TEST_ASSERT_FALSE(LittleFS.exists(SPILL_PATH));
+}
+
+void test_ram_critical_messages_pass_the_spill_file(void)
+{
+    ThingsCloudOutbox outbox;
+    outbox.begin(2 * RECORD_SIZE);
+    outbox.enableSpill(SPILL_PATH, 4096);
+    for (char i = '0'; i < '3'; i++)
+        pushMessage(outbox, (std::string("msg_") + i).c_str());
+    pushMessage(outbox, "alarm", PRIORITY_CRITICAL);
+
+    TEST_ASSERT_EQUAL_STRING("alarm", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("msg_0", popMessage(outbox).c_str());
+}
+
+void test_spill_file_is_reloaded_after_a_reboot(void)
+{
+    {
+        ThingsCloudOutbox outbox;
+        outbox.begin(2 * RECORD_SIZE);
+        outbox.enableSpill(SPILL_PATH, 4096);
+        for (char i = '0'; i < '5'; i++)
+            pushMessage(outbox, (std::string("msg_") + i).c_str());
+        TEST_ASSERT_EQUAL_STRING("msg_0", popMessage(outbox).c_str());
+    }
+
+    // The RAM messages are lost, the file ones are sent after the reboot
+    ThingsCloudOutbox outbox;
+    outbox.begin(2 * RECORD_SIZE);
+    outbox.enableSpill(SPILL_PATH, 4096);
+    TEST_ASSERT_EQUAL(2, outbox.getCount());
+    TEST_ASSERT_EQUAL_STRING("msg_1", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("msg_2", popMessage(outbox).c_str());
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+}
+
+void test_replace_topic_reaches_the_spill_file(void)
+{
+    {
+        ThingsCloudOutbox outbox;
+        outbox.begin(2 * RECORD_SIZE);
+        outbox.enableSpill(SPILL_PATH, 4096);
+        outbox.push("a", (const uint8_t *)"old_a", 5, false, true);
+        for (char i = '0'; i < '3'; i++)
+            pushMessage(outbox, (std::string("msg_") + i).c_str());
+        TEST_ASSERT_EQUAL(4, outbox.getCount());
+
+        // old_a and msg_0 are in the file
+        outbox.push("a", (const uint8_t *)"new_a", 5, false, true);
+        TEST_ASSERT_EQUAL(4, outbox.getCount());
+        TEST_ASSERT_EQUAL(0, outbox.getDroppedCount());
+    }
+
+    // Replaced in place, so it is not sent after a reboot either
+    ThingsCloudOutbox outbox;
+    outbox.begin(2 * RECORD_SIZE);
+    outbox.enableSpill(SPILL_PATH, 4096);
+    TEST_ASSERT_EQUAL(2, outbox.getCount());
+    TEST_ASSERT_EQUAL_STRING("msg_0", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL_STRING("msg_1", popMessage(outbox).c_str());
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+}
+
+void test_corrupted_spill_file_is_dropped(void)
+{
+    ThingsCloudOutbox outbox;
+    outbox.begin(2 * RECORD_SIZE);
+    outbox.enableSpill(SPILL_PATH, 4096);
+    for (char i = '0'; i < '5'; i++)
+        pushMessage(outbox, (std::string("msg_") + i).c_str());
+
+    // Flip a payload byte of the first spilled record
+    File file = LittleFS.open(SPILL_PATH, "r+");
+    uint8_t byte;
+    file.seek(SPILL_RECORD_SIZE - 1);
+    file.read(&byte, 1);
+    byte ^= 0xFF;
+    file.seek(SPILL_RECORD_SIZE - 1);
+    file.write(&byte, 1);
+    file.close();
+
+    // The CRC does not match: the file messages are lost, the RAM ones are still sent
+    TEST_ASSERT_EQUAL_STRING("msg_3", popMessage(outbox).c_str());
+    TEST_ASSERT_EQUAL(3, outbox.getDroppedCount());
+    TEST_ASSERT_EQUAL_STRING("msg_4", popMessage(outbox).c_str());
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+}
+
+void test_partial_spill_record_is_dropped_on_reload(void)
+{
+    {
+        ThingsCloudOutbox outbox;
+        outbox.begin(2 * RECORD_SIZE);
+        outbox.enableSpill(SPILL_PATH, 4096);
+        for (char i = '0'; i < '4'; i++)
+            pushMessage(outbox, (std::string("msg_") + i).c_str());
+    }
+
+    // Power lost in the middle of an append
+    File file = LittleFS.open(SPILL_PATH, "a");
+    file.write((const uint8_t *)"\xA5\x01", 2);
+    file.close();
+
+    ThingsCloudOutbox outbox;
+    outbox.begin(2 * RECORD_SIZE);
+    outbox.enableSpill(SPILL_PATH, 4096);
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+    TEST_ASSERT_EQUAL(2, outbox.getDroppedCount());
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_messages_are_sent_in_order);
+    RUN_TEST(test_higher_classes_are_sent_first);
+    RUN_TEST(test_tombstones_are_reclaimed_with_the_head);
+    RUN_TEST(test_replace_topic_keeps_the_latest_message);
+    RUN_TEST(test_full_ring_drops_the_oldest_message);
+    RUN_TEST(test_messages_that_can_never_be_sent_are_refused);
+    RUN_TEST(test_spill_file_keeps_the_order);
+    RUN_TEST(test_ram_critical_messages_pass_the_spill_file);
+    RUN_TEST(test_spill_file_is_reloaded_after_a_reboot);
+    RUN_TEST(test_replace_topic_reaches_the_spill_file);
+    RUN_TEST(test_corrupted_spill_file_is_dropped);
+    RUN_TEST(test_partial_spill_record_is_dropped_on_reload);
+    return UNITY_END();
+}
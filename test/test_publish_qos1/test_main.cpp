@@ -0,0 +1,141 @@
+/*
+  QoS 1 publish of ThingsCloudMQTT against the loopback broker: acknowledgement, rate limit, outbox order and packet ids.
+*/
+
+#include <ThingsCloudTestHarness.h>
+
+void test_acknowledged_message_is_completed(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    TEST_ASSERT_TRUE(connectClient(client));
+
+    std::vector<std::pair<uint16_t, bool>> completed;
+    uint16_t packetId = client.publishQoS1("data/out", "qos1", [&completed](uint16_t id, bool delivered)
+                                           { completed.push_back({id, delivered}); });
+    TEST_ASSERT_NOT_EQUAL(0, packetId);
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&completed]
+                               { return completed.size() == 1; }));
+    TEST_ASSERT_EQUAL(packetId, completed[0].first);
+    TEST_ASSERT_TRUE(completed[0].second);
+    TEST_ASSERT_EQUAL(0, client.getInFlightCount());
+
+    std::vector<LoopbackBroker::Publish> messages = broker.publishedOn("data/out");
+    TEST_ASSERT_EQUAL(1, messages.size());
+    TEST_ASSERT_EQUAL(1, messages[0].qos);
+    TEST_ASSERT_EQUAL(packetId, messages[0].packetId);
+}
+
+void test_message_waits_for_a_publish_token(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.setPublishRateLimit(1, 1, RATE_LIMIT_QUEUE);
+    TEST_ASSERT_TRUE(connectClient(client));
+    loopFor(client, 1000);
+
+    TEST_ASSERT_NOT_EQUAL(0, client.publishQoS1("data/out", "first"));
+    TEST_ASSERT_NOT_EQUAL(0, client.publishQoS1("data/out", "second"));
+    TEST_ASSERT_EQUAL(1, client.getRateLimitQueuedCount());
+    loopFor(client, 100);
+    TEST_ASSERT_EQUAL(1, broker.publishedOn("data/out").size());
+
+    TEST_ASSERT_TRUE(loopUntil(client, 1500, [&client]
+                               { return client.getInFlightCount() == 0; }));
+    std::vector<LoopbackBroker::Publish> messages = broker.publishedOn("data/out");
+    TEST_ASSERT_EQUAL(2, messages.size());
+    TEST_ASSERT_EQUAL_STRING("second", messages[1].payload.c_str());
+}
+
+void test_rate_limit_drop_refuses_the_message(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.setPublishRateLimit(1, 1, RATE_LIMIT_DROP);
+    TEST_ASSERT_TRUE(connectClient(client));
+    loopFor(client, 1000);
+
+    TEST_ASSERT_NOT_EQUAL(0, client.publishQoS1("data/out", "first"));
+    TEST_ASSERT_EQUAL(0, client.publishQoS1("data/out", "second"));
+    TEST_ASSERT_EQUAL(1, client.getRateLimitDroppedCount());
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&client]
+                               { return client.getInFlightCount() == 0; }));
+    TEST_ASSERT_EQUAL(1, broker.publishedOn("data/out").size());
+}
+
+void test_message_is_not_sent_ahead_of_the_outbox(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.enableOutbox();
+
+    // Both of the bulk class, kept while disconnected
+    TEST_ASSERT_TRUE(client.publish("data/a", "outbox"));
+    TEST_ASSERT_NOT_EQUAL(0, client.publishQoS1("data/b", "qos1"));
+    TEST_ASSERT_TRUE(connectClient(client));
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&client]
+                               { return client.getInFlightCount() == 0 && client.getOutboxCount() == 0; }));
+
+    std::vector<std::string> order;
+    for (std::size_t i = 0; i < broker.published.size(); i++)
+        order.push_back(broker.published[i].topic);
+    TEST_ASSERT_EQUAL(2, order.size());
+    TEST_ASSERT_EQUAL_STRING("data/a", order[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("data/b", order[1].c_str());
+}
+
+void test_given_up_packet_id_is_not_reused_before_reconnecting(void)
+{
+    LoopbackBroker broker;
+    broker.acknowledgePublish = false;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.setInFlightWindow(255, 1000, 2);
+    TEST_ASSERT_TRUE(connectClient(client));
+
+    bool delivered = true;
+    uint16_t givenUp = client.publishQoS1("data/out", "lost", [&delivered](uint16_t, bool success)
+                                          { delivered = success; });
+    TEST_ASSERT_TRUE(loopUntil(client, 5000, [&client]
+                               { return client.getInFlightCount() == 0; }));
+    TEST_ASSERT_FALSE(delivered);
+
+    // Every other packet id is given once, the given up one never
+    broker.acknowledgePublish = true;
+    for (unsigned long sent = 0; sent < 0xFFFF; sent++)
+    {
+        uint16_t packetId = client.publishQoS1("data/out", "x");
+        TEST_ASSERT_NOT_EQUAL(0, packetId);
+        TEST_ASSERT_NOT_EQUAL(givenUp, packetId);
+        if (client.getInFlightCount() >= 200)
+            TEST_ASSERT_TRUE(loopUntil(client, 1000, [&client]
+                                       { return client.getInFlightCount() == 0; }, 1));
+    }
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&client]
+                               { return client.getInFlightCount() == 0; }, 1));
+
+    // The late PUBACK of a new session can not be mistaken, the id is given again
+    broker.closeClient();
+    TEST_ASSERT_TRUE(loopUntil(client, 1000, [&client]
+                               { return !client.isMqttConnected(); }));
+    TEST_ASSERT_TRUE(connectClient(client));
+    bool reused = false;
+    for (unsigned long sent = 0; sent < 0xFFFF && !reused; sent++)
+    {
+        reused = client.publishQoS1("data/out", "x") == givenUp;
+        if (client.getInFlightCount() >= 200)
+            loopUntil(client, 1000, [&client]
+                      { return client.getInFlightCount() == 0; }, 1);
+    }
+    TEST_ASSERT_TRUE(reused);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_acknowledged_message_is_completed);
+    RUN_TEST(test_message_waits_for_a_publish_token);
+    RUN_TEST(test_rate_limit_drop_refuses_the_message);
+    RUN_TEST(test_message_is_not_sent_ahead_of_the_outbox);
+    RUN_TEST(test_given_up_packet_id_is_not_reused_before_reconnecting);
+    return UNITY_END();
+}
@@ -0,0 +1,113 @@
+/*
+  Token-bucket publish rate limiter of ThingsCloudMQTT: queue, drop and coalesce policies, global and per topic.
+*/
+
+#include <ThingsCloudTestHarness.h>
+
+static std::vector<std::string> payloadsOn(const LoopbackBroker &broker, const char *topic)
+{
+    std::vector<std::string> payloads;
+    for (const LoopbackBroker::Publish &message : broker.publishedOn(topic))
+        payloads.push_back(message.payload);
+    return payloads;
+}
+
+void test_messages_over_the_budget_are_queued_in_order(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.enableOutbox();
+    client.setPublishRateLimit(2, 2, RATE_LIMIT_QUEUE);
+    TEST_ASSERT_TRUE(connectClient(client));
+    loopFor(client, 1000);
+
+    for (int i = 0; i < 5; i++)
+        TEST_ASSERT_TRUE(client.publish("data/out", String(i)));
+    loopFor(client, 20);
+    TEST_ASSERT_EQUAL(2, payloadsOn(broker, "data/out").size());
+    // The next ones wait behind the queued one
+    TEST_ASSERT_EQUAL(1, client.getRateLimitQueuedCount());
+    TEST_ASSERT_EQUAL(3, client.getOutboxCount());
+
+    // 2 messages per second
+    unsigned long start = millis();
+    TEST_ASSERT_TRUE(loopUntil(client, 2000, [&client]
+                               { return client.getOutboxCount() == 0; }));
+    TEST_ASSERT_TRUE(millis() - start >= 1000);
+    std::vector<std::string> payloads = payloadsOn(broker, "data/out");
+    TEST_ASSERT_EQUAL(5, payloads.size());
+    for (int i = 0; i < 5; i++)
+        TEST_ASSERT_EQUAL_STRING(std::to_string(i).c_str(), payloads[i].c_str());
+}
+
+void test_messages_are_dropped_without_outbox(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.setPublishRateLimit(1, 1, RATE_LIMIT_QUEUE);
+    TEST_ASSERT_TRUE(connectClient(client));
+    loopFor(client, 1000);
+
+    TEST_ASSERT_TRUE(client.publish("data/out", "kept"));
+    TEST_ASSERT_FALSE(client.publish("data/out", "lost"));
+    TEST_ASSERT_EQUAL(1, client.getRateLimitDroppedCount());
+
+    // Refilled after a second
+    loopFor(client, 1000);
+    TEST_ASSERT_TRUE(client.publish("data/out", "next"));
+    loopFor(client, 20);
+    std::vector<std::string> payloads = payloadsOn(broker, "data/out");
+    TEST_ASSERT_EQUAL(2, payloads.size());
+    TEST_ASSERT_EQUAL_STRING("next", payloads[1].c_str());
+}
+
+void test_coalesced_topic_keeps_the_latest_message(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.enableOutbox();
+    client.setTopicRateLimit("sensor/#", 1, 1, RATE_LIMIT_COALESCE);
+    TEST_ASSERT_TRUE(connectClient(client));
+    loopFor(client, 1000);
+
+    for (int i = 1; i <= 5; i++)
+        client.publish("sensor/t", String(i));
+    TEST_ASSERT_EQUAL(1, client.getRateLimitCoalescedCount());
+    TEST_ASSERT_EQUAL(1, client.getOutboxCount());
+
+    TEST_ASSERT_TRUE(loopUntil(client, 1500, [&client]
+                               { return client.getOutboxCount() == 0; }));
+    std::vector<std::string> payloads = payloadsOn(broker, "sensor/t");
+    TEST_ASSERT_EQUAL(2, payloads.size());
+    TEST_ASSERT_EQUAL_STRING("1", payloads[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("5", payloads[1].c_str());
+}
+
+void test_topic_budget_does_not_limit_the_other_topics(void)
+{
+    LoopbackBroker broker;
+    ThingsCloudMQTT client(TEST_BROKER_HOST, "test-access-token", "test-project-key");
+    client.setTopicRateLimit("data/slow", 1, 1, RATE_LIMIT_DROP);
+    TEST_ASSERT_TRUE(connectClient(client));
+    loopFor(client, 1000);
+
+    TEST_ASSERT_TRUE(client.publish("data/slow", "1"));
+    TEST_ASSERT_FALSE(client.publish("data/slow", "2"));
+    for (int i = 0; i < 10; i++)
+        TEST_ASSERT_TRUE(client.publish("data/fast", String(i)));
+    loopFor(client, 20);
+
+    TEST_ASSERT_EQUAL(1, payloadsOn(broker, "data/slow").size());
+    TEST_ASSERT_EQUAL(10, payloadsOn(broker, "data/fast").size());
+    TEST_ASSERT_EQUAL(1, client.getRateLimitDroppedCount());
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_messages_over_the_budget_are_queued_in_order);
+    RUN_TEST(test_messages_are_dropped_without_outbox);
+    RUN_TEST(test_coalesced_topic_keeps_the_latest_message);
+    RUN_TEST(test_topic_budget_does_not_limit_the_other_topics);
+    return UNITY_END();
+}
@@ -0,0 +1,171 @@
+/*
+  Subscription filter matching of ThingsCloudTopicTrie.
+*/
+
+#include <ThingsCloudTestHarness.h>
+#include <ThingsCloudTopicTrie.h>
+
+static ThingsCloudTopicTrie trie;
+
+// Matched record indexes, as "0,2,3"
+static std::string matchList(const char *topic)
+{
+    std::string list;
+    const std::vector<uint16_t> &matches = trie.match(topic);
+    for (std::size_t i = 0; i < matches.size(); i++)
+    {
+        if (i > 0)
+            list += ",";
+        list += std::to_string(matches[i]);
+    }
+    return list;
+}
+
+void setUpTest(void)
+{
+    trie.clear();
+}
+
+void test_empty_trie_matches_nothing(void)
+{
+    TEST_ASSERT_EQUAL_STRING("", matchList("attributes/push").c_str());
+}
+
+void test_literal_filter(void)
+{
+    trie.insert("attributes/push", 0);
+    trie.insert("attributes/response", 1);
+
+    TEST_ASSERT_EQUAL_STRING("0", matchList("attributes/push").c_str());
+    TEST_ASSERT_EQUAL_STRING("1", matchList("attributes/response").c_str());
+    TEST_ASSERT_EQUAL_STRING("", matchList("attributes").c_str());
+    TEST_ASSERT_EQUAL_STRING("", matchList("attributes/push/1").c_str());
+    TEST_ASSERT_EQUAL_STRING("", matchList("attributes/pus").c_str());
+}
+
+void test_plus_matches_one_level(void)
+{
+    trie.insert("command/send/+", 0);
+    trie.insert("a/+/c", 1);
+
+    TEST_ASSERT_EQUAL_STRING("0", matchList("command/send/42").c_str());
+    TEST_ASSERT_EQUAL_STRING("", matchList("command/send").c_str());
+    TEST_ASSERT_EQUAL_STRING("", matchList("command/send/42/extra").c_str());
+    TEST_ASSERT_EQUAL_STRING("1", matchList("a/b/c").c_str());
+    TEST_ASSERT_EQUAL_STRING("", matchList("a/c").c_str());
+}
+
+void test_plus_matches_empty_level(void)
+{
+    trie.insert("a/+", 0);
+    trie.insert("+/b", 1);
+
+    TEST_ASSERT_EQUAL_STRING("0", matchList("a/").c_str());
+    TEST_ASSERT_EQUAL_STRING("1", matchList("/b").c_str());
+}
+
+void test_hash_matches_parent_and_child_levels(void)
+{
+    trie.insert("a/#", 0);
+
+    TEST_ASSERT_EQUAL_STRING("0", matchList("a").c_str());
+    TEST_ASSERT_EQUAL_STRING("0", matchList("a/b").c_str());
+    TEST_ASSERT_EQUAL_STRING("0", matchList("a/b/c").c_str());
+    TEST_ASSERT_EQUAL_STRING("", matchList("b").c_str());
+    TEST_ASSERT_EQUAL_STRING("", matchList("ab").c_str());
+}
+
+void test_hash_alone_matches_every_topic(void)
+{
+    trie.insert("#", 0);
+
+    TEST_ASSERT_EQUAL_STRING("0", matchList("a").c_str());
+    TEST_ASSERT_EQUAL_STRING("0", matchList("a/b/c").c_str());
+    TEST_ASSERT_EQUAL_STRING("0", matchList("/").c_str());
+}
+
+void test_first_level_wildcards_skip_dollar_topics(void)
+{
+    trie.insert("#", 0);
+    trie.insert("+/info", 1);
+    trie.insert("$SYS/#", 2);
+    trie.insert("$SYS/+", 3);
+
+    TEST_ASSERT_EQUAL_STRING("2,3", matchList("$SYS/info").c_str());
+    TEST_ASSERT_EQUAL_STRING("0,1", matchList("SYS/info").c_str());
+}
+
+void test_matches_are_sorted_and_shared_indexes_kept(void)
+{
+    trie.insert("a/b", 3);
+    trie.insert("a/+", 1);
+    trie.insert("#", 2);
+    trie.insert("a/#", 0);
+    trie.insert("a/b", 1);
+
+    TEST_ASSERT_EQUAL_STRING("0,1,1,2,3", matchList("a/b").c_str());
+}
+
+void test_clear_removes_every_filter(void)
+{
+    trie.insert("a/b", 0);
+    trie.clear();
+    trie.insert("c", 1);
+
+    TEST_ASSERT_EQUAL_STRING("", matchList("a/b").c_str());
+    TEST_ASSERT_EQUAL_STRING("1", matchList("c").c_str());
+}
+
+void test_filter_matches(void)
+{
+    TEST_ASSERT_TRUE(ThingsCloudTopicTrie::filterMatches("attributes/push", "attributes/push"));
+    TEST_ASSERT_FALSE(ThingsCloudTopicTrie::filterMatches("attributes/push", "attributes/push/1"));
+    TEST_ASSERT_FALSE(ThingsCloudTopicTrie::filterMatches("attributes/push", "attributes/pus"));
+    TEST_ASSERT_FALSE(ThingsCloudTopicTrie::filterMatches("attributes/pus", "attributes/push"));
+    TEST_ASSERT_TRUE(ThingsCloudTopicTrie::filterMatches("command/send/+", "command/send/42"));
+    TEST_ASSERT_FALSE(ThingsCloudTopicTrie::filterMatches("command/send/+", "command/send"));
+    TEST_ASSERT_FALSE(ThingsCloudTopicTrie::filterMatches("command/send/+", "command/send/42/extra"));
+    TEST_ASSERT_TRUE(ThingsCloudTopicTrie::filterMatches("a/+", "a/"));
+    TEST_ASSERT_TRUE(ThingsCloudTopicTrie::filterMatches("a/#", "a"));
+    TEST_ASSERT_TRUE(ThingsCloudTopicTrie::filterMatches("a/#", "a/b/c"));
+    TEST_ASSERT_FALSE(ThingsCloudTopicTrie::filterMatches("a/#", "ab"));
+    TEST_ASSERT_TRUE(ThingsCloudTopicTrie::filterMatches("#", "a/b"));
+    TEST_ASSERT_FALSE(ThingsCloudTopicTrie::filterMatches("#", "$SYS/info"));
+    TEST_ASSERT_FALSE(ThingsCloudTopicTrie::filterMatches("+/info", "$SYS/info"));
+    TEST_ASSERT_TRUE(ThingsCloudTopicTrie::filterMatches("$SYS/+", "$SYS/info"));
+}
+
+// The single filter helper and the trie agree on every pair
+void test_filter_matches_agrees_with_the_trie(void)
+{
+    const char *filters[] = {"a", "a/b", "a/+", "+/b", "+", "#", "a/#", "a/+/c", "+/+", "/", "/#", "$SYS/#", "a/b/#"};
+    const char *topics[] = {"a", "a/b", "a/", "/b", "b", "a/b/c", "a/c", "/", "", "$SYS/info", "ab", "a/x/c", "a/b/c/d"};
+
+    for (const char *filter : filters)
+    {
+        trie.clear();
+        trie.insert(filter, 0);
+        for (const char *topic : topics)
+        {
+            bool inTrie = !trie.match(topic).empty();
+            TEST_ASSERT_EQUAL_MESSAGE(inTrie, ThingsCloudTopicTrie::filterMatches(filter, topic), (std::string(filter) + " on " + topic).c_str());
+        }
+    }
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_trie_matches_nothing);
+    RUN_TEST(test_literal_filter);
+    RUN_TEST(test_plus_matches_one_level);
+    RUN_TEST(test_plus_matches_empty_level);
+    RUN_TEST(test_hash_matches_parent_and_child_levels);
+    RUN_TEST(test_hash_alone_matches_every_topic);
+    RUN_TEST(test_first_level_wildcards_skip_dollar_topics);
+    RUN_TEST(test_matches_are_sorted_and_shared_indexes_kept);
+    RUN_TEST(test_clear_removes_every_filter);
+    RUN_TEST(test_filter_matches);
+    RUN_TEST(test_filter_matches_agrees_with_the_trie);
+    return UNITY_END();
+}
@@ -0,0 +1,75 @@
+/*
+  Configuration portal API of ThingsCloudWiFiManager, its handlers called through the WebServer stub.
+*/
+
+#include <ThingsCloudTestHarness.h>
+#include <ThingsCloudWiFiManager.h>
+
+static void startPortal(ThingsCloudWiFiManager &wifiManager)
+{
+    WiFi.hostStatus = WL_DISCONNECTED;
+    wifiManager.setConfigPortalBlocking(false);
+    wifiManager.startConfigPortal();
+    TEST_ASSERT_NOT_NULL(wifiManager.server.get());
+}
+
+void test_wifi_list_is_sorted_without_duplicates(void)
+{
+    WiFi.hostNetworks = {{"office", -80, WIFI_AUTH_WPA2_PSK, 1},
+                         {"home", -50, WIFI_AUTH_WPA2_PSK, 6},
+                         {"office", -60, WIFI_AUTH_WPA2_PSK, 11},
+                         {"guest", -70, WIFI_AUTH_OPEN, 1}};
+    ThingsCloudWiFiManager wifiManager(Serial);
+    startPortal(wifiManager);
+
+    TEST_ASSERT_TRUE(wifiManager.server->hostRequest("/api/wifilist"));
+    TEST_ASSERT_EQUAL(200, wifiManager.server->responseCode);
+
+    DynamicJsonDocument doc(1024);
+    TEST_ASSERT_FALSE(deserializeJson(doc, wifiManager.server->responseContent));
+    JsonArray networks = doc["wifi"].as<JsonArray>();
+    TEST_ASSERT_EQUAL(3, networks.size());
+    TEST_ASSERT_EQUAL_STRING("home", networks[0]["v"].as<const char *>());
+    TEST_ASSERT_EQUAL_STRING("office", networks[1]["v"].as<const char *>());
+    TEST_ASSERT_EQUAL_STRING("-60", networks[1]["R"].as<const char *>());
+    TEST_ASSERT_EQUAL_STRING("guest", networks[2]["v"].as<const char *>());
+}
+
+void test_wifi_list_without_networks(void)
+{
+    ThingsCloudWiFiManager wifiManager(Serial);
+    startPortal(wifiManager);
+
+    TEST_ASSERT_TRUE(wifiManager.server->hostRequest("/api/wifilist"));
+    TEST_ASSERT_EQUAL_STRING("{\"result\":false}", wifiManager.server->responseContent.c_str());
+}
+
+void test_wifi_save_requires_the_customer_id(void)
+{
+    ThingsCloudWiFiManager wifiManager(Serial);
+    startPortal(wifiManager);
+
+    TEST_ASSERT_TRUE(wifiManager.server->hostRequest("/api/wifisave", {{"ssid", "home"}, {"password", "secret"}}));
+    TEST_ASSERT_EQUAL(200, wifiManager.server->responseCode);
+    TEST_ASSERT_EQUAL_STRING("{\"result\":false}", wifiManager.server->responseContent.c_str());
+    TEST_ASSERT_EQUAL(0, WiFi.hostBeginCount);
+}
+
+void test_wifi_status(void)
+{
+    ThingsCloudWiFiManager wifiManager(Serial);
+    startPortal(wifiManager);
+
+    TEST_ASSERT_TRUE(wifiManager.server->hostRequest("/api/wifistatus"));
+    TEST_ASSERT_EQUAL_STRING("{\"result\":true,\"count\":1}", wifiManager.server->responseContent.c_str());
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_wifi_list_is_sorted_without_duplicates);
+    RUN_TEST(test_wifi_list_without_networks);
+    RUN_TEST(test_wifi_save_requires_the_customer_id);
+    RUN_TEST(test_wifi_status);
+    return UNITY_END();
+}